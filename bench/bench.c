@@ -0,0 +1,229 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "adler32.h"
+#include "corpus.h"
+#include "crc32.h"
+#include "lzip.h"
+#include "match_copy.h"
+#include "timer.h"
+
+enum { DEFAULT_ITERATIONS = 5, DEFAULT_SIZE_KB = 1024 };
+
+typedef struct {
+	const corpus_entry* entry;
+	size_t compressed_size;
+	timing compress;
+	timing decompress;
+	long peak_rss_kb;
+} bench_result;
+
+static long peak_rss_kb(void) {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) < 0)
+		return -1;
+	return usage.ru_maxrss;
+}
+
+static bool compress_entry(lzip_context* ctx, const corpus_entry* entry,
+	unsigned char* compressed, size_t capacity, size_t* compressed_size) {
+	lzip_deflate_reset(ctx);
+	lzip_in_buffer in = {entry->data, entry->size, 0};
+	lzip_out_buffer out = {compressed, capacity, 0};
+	if(lzip_deflate(ctx, &in, &out, LZIP_FINISH) != LZIP_STREAM_END) {
+		fprintf(stderr, "Compressing '%s' failed.\n", entry->name);
+		return false;
+	}
+	*compressed_size = out.pos;
+	return true;
+}
+
+static bool decompress_entry(lzip_context* ctx, const corpus_entry* entry,
+	const unsigned char* compressed, size_t compressed_size, unsigned char* decompressed) {
+	lzip_in_buffer in = {compressed, compressed_size, 0};
+	lzip_out_buffer out = {decompressed, entry->size, 0};
+	if(lzip_inflate(ctx, &in, &out) != LZIP_STREAM_END || out.pos != entry->size) {
+		fprintf(stderr, "Decompressing '%s' failed.\n", entry->name);
+		return false;
+	}
+	return true;
+}
+
+static bool run_entry(lzip_context* ctx, const corpus_entry* entry, unsigned iterations,
+	bench_result* result) {
+	// Stored blocks bound the growth of incompressible input
+	size_t capacity = entry->size + entry->size / 16 + 1024;
+	unsigned char* compressed = malloc(capacity);
+	unsigned char* decompressed = malloc(entry->size ? entry->size : 1);
+	bool success = false;
+
+	memset(result, '\0', sizeof(bench_result));
+	result->entry = entry;
+	if(!compressed || !decompressed) {
+		fprintf(stderr, "Out of memory.\n");
+		goto done;
+	}
+
+	for(unsigned i = 0; i < iterations; ++i) {
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+		if(!compress_entry(ctx, entry, compressed, capacity, &result->compressed_size))
+			goto done;
+		keep_best(&result->compress, start_seconds, start_cycles);
+	}
+
+	for(unsigned i = 0; i < iterations; ++i) {
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+		if(!decompress_entry(ctx, entry, compressed, result->compressed_size, decompressed))
+			goto done;
+		keep_best(&result->decompress, start_seconds, start_cycles);
+	}
+
+	if(memcmp(decompressed, entry->data, entry->size)) {
+		fprintf(stderr, "Round trip of '%s' doesn't match.\n", entry->name);
+		goto done;
+	}
+
+	result->peak_rss_kb = peak_rss_kb();
+	success = true;
+
+done:
+	free(compressed);
+	free(decompressed);
+	return success;
+}
+
+static double mb_per_s(const corpus_entry* entry, const timing* t) {
+	return t->seconds ? entry->size / t->seconds / 1e6 : 0;
+}
+
+static double cycles_per_byte(const corpus_entry* entry, const timing* t) {
+	return entry->size ? (double)t->cycles / entry->size : 0;
+}
+
+static void print_table(const bench_result* results, unsigned numof_results) {
+	printf("%-12s %10s %7s %12s %8s %12s %8s %10s\n", "name", "size", "ratio", "comp MB/s",
+		"c/B", "decomp MB/s", "c/B", "rss KB");
+	for(unsigned i = 0; i < numof_results; ++i) {
+		const bench_result* r = &results[i];
+		printf("%-12s %10zu %7.3f %12.2f %8.2f %12.2f %8.2f %10ld\n", r->entry->name,
+			r->entry->size,
+			r->entry->size ? (double)r->compressed_size / r->entry->size : 0,
+			mb_per_s(r->entry, &r->compress), cycles_per_byte(r->entry, &r->compress),
+			mb_per_s(r->entry, &r->decompress), cycles_per_byte(r->entry, &r->decompress),
+			r->peak_rss_kb);
+	}
+	printf("kernels: crc32 %s, adler32 %s, match copy %s\n", crc32_kernel_name(),
+		adler32_kernel_name(), match_copy_select()->name);
+}
+
+static void print_json_timing(const char* name, const corpus_entry* entry, const timing* t) {
+	printf("\"%s\": {\"seconds\": %.9f, \"mb_per_s\": %.3f, \"cycles_per_byte\": ", name,
+		t->seconds, mb_per_s(entry, t));
+	if(HAVE_CYCLE_COUNTER)
+		printf("%.3f}", cycles_per_byte(entry, t));
+	else
+		printf("null}");
+}
+
+static void print_json(
+	const bench_result* results, unsigned numof_results, unsigned iterations, int level) {
+	printf("{\n  \"iterations\": %u,\n  \"level\": %d,\n", iterations, level);
+	printf("  \"kernels\": {\"crc32\": \"%s\", \"adler32\": \"%s\", \"match_copy\": \"%s\"},\n",
+		crc32_kernel_name(), adler32_kernel_name(), match_copy_select()->name);
+	printf("  \"results\": [\n");
+	for(unsigned i = 0; i < numof_results; ++i) {
+		const bench_result* r = &results[i];
+		// Names of loaded files are printed as given, keep them free of quotes
+		printf("    {\"name\": \"%s\", \"size\": %zu, \"compressed_size\": %zu, ", r->entry->name,
+			r->entry->size, r->compressed_size);
+		print_json_timing("compress", r->entry, &r->compress);
+		printf(", ");
+		print_json_timing("decompress", r->entry, &r->decompress);
+		printf(", \"peak_rss_kb\": %ld}%s\n", r->peak_rss_kb, i + 1 < numof_results ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+		"Usage: %s [-i iterations] [-s size KB] [-0 .. -12] [-j] [file...]\n"
+		"Without files a generated corpus of logs, JSON, binary records, compressed\n"
+		"data and a mix of them is used.\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	unsigned iterations = DEFAULT_ITERATIONS;
+	size_t size = DEFAULT_SIZE_KB * 1024;
+	int level = DEFAULT_LEVEL;
+	int digits_arg = -1;
+	bool json = false;
+	int opt;
+
+	for(;;) {
+		int arg = optind;
+		if((opt = getopt(argc, argv, "i:s:j0123456789")) == -1)
+			break;
+
+		if(opt >= '0' && opt <= '9') {
+			level = (digits_arg == arg) ? level * 10 + (opt - '0') : opt - '0';
+			digits_arg = arg;
+		} else if(opt == 'i')
+			iterations = atoi(optarg);
+		else if(opt == 's')
+			size = (size_t)atol(optarg) * 1024;
+		else if(opt == 'j')
+			json = true;
+		else
+			usage(argv[0]);
+	}
+	if(!iterations || level > MAX_LEVEL)
+		usage(argv[0]);
+
+	unsigned numof_entries = (optind < argc) ? argc - optind : NUMOF_CORPUS_ENTRIES;
+	corpus_entry* entries = calloc(numof_entries, sizeof(corpus_entry));
+	bench_result* results = calloc(numof_entries, sizeof(bench_result));
+	lzip_context ctx;
+	bool success = false;
+
+	if(!entries || !results || !lzip_context_init(&ctx, level, LZIP_FORMAT_RAW)) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	if(optind < argc) {
+		for(unsigned i = 0; i < numof_entries; ++i) {
+			if(!corpus_load(&entries[i], argv[optind + i]))
+				goto done;
+		}
+	} else if(!corpus_generate(entries, size)) {
+		fprintf(stderr, "Could not generate the corpus.\n");
+		goto done;
+	}
+
+	for(unsigned i = 0; i < numof_entries; ++i) {
+		if(!run_entry(&ctx, &entries[i], iterations, &results[i]))
+			goto done;
+	}
+
+	if(json)
+		print_json(results, numof_entries, iterations, level);
+	else
+		print_table(results, numof_entries);
+	success = true;
+
+done:
+	for(unsigned i = 0; i < numof_entries; ++i)
+		corpus_free(&entries[i]);
+	free(entries);
+	free(results);
+	lzip_context_free(&ctx);
+	exit(success ? 0 : 1);
+}
@@ -0,0 +1,236 @@
+#include "corpus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+
+typedef struct {
+	unsigned long long state;
+} rng;
+
+// xorshift64*, plenty for test data
+static unsigned long long next_random(rng* r) {
+	r->state ^= r->state >> 12;
+	r->state ^= r->state << 25;
+	r->state ^= r->state >> 27;
+	return r->state * 0x2545f4914f6cdd1dull;
+}
+
+static unsigned pick(rng* r, unsigned n) {
+	return (next_random(r) >> 32) % n;
+}
+
+// Roughly Zipf distributed choice, small indices are far more likely
+static unsigned pick_skewed(rng* r, unsigned n) {
+	unsigned i = pick(r, n);
+	return pick(r, i + 1);
+}
+
+static const char* const words[] = {"request", "session", "user", "cache", "miss",
+	"hit", "timeout", "connection", "closed", "opened", "retry", "upstream", "served",
+	"queue", "worker", "flush", "commit", "rollback", "index", "shard"};
+static const char* const names[] = {"alice", "bob", "carol", "dave", "erin", "frank",
+	"grace", "heidi", "ivan", "judy", "mallory", "oscar", "peggy", "trent"};
+enum {
+	NUMOF_WORDS = sizeof(words) / sizeof(words[0]),
+	NUMOF_NAMES = sizeof(names) / sizeof(names[0])
+};
+
+// Appends formatted lines until size bytes are filled, the last line is cut off
+typedef struct {
+	unsigned char* data;
+	size_t size;
+	size_t len;
+} text_buffer;
+
+static void append(text_buffer* b, const char* text, size_t len) {
+	if(len > b->size - b->len)
+		len = b->size - b->len;
+	memcpy(b->data + b->len, text, len);
+	b->len += len;
+}
+
+static void generate_logs(unsigned char* data, size_t size, unsigned long long seed) {
+	static const char* const levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+	rng r = {seed};
+	text_buffer b = {data, size, 0};
+	unsigned long long ms = 1700000000000ull;
+	char line[256];
+
+	while(b.len < size) {
+		ms += pick(&r, 2000);
+		unsigned long long s = ms / 1000;
+		int len = snprintf(line, sizeof(line),
+			"2024-%02llu-%02llu %02llu:%02llu:%02llu.%03llu %-5s [worker-%u] %s %s %u path=/api/v1/%s/%u took %ums\n",
+			s / 2592000 % 12 + 1, s / 86400 % 30 + 1, s / 3600 % 24, s / 60 % 60, s % 60,
+			ms % 1000, levels[pick_skewed(&r, 4)], pick(&r, 16),
+			words[pick_skewed(&r, NUMOF_WORDS)], words[pick_skewed(&r, NUMOF_WORDS)],
+			pick(&r, 100000), words[pick(&r, NUMOF_WORDS)], pick_skewed(&r, 5000),
+			pick_skewed(&r, 900));
+		append(&b, line, len);
+	}
+}
+
+static void generate_json(unsigned char* data, size_t size, unsigned long long seed) {
+	static const char* const domains[] = {"example.com", "mail.example.org", "corp.test"};
+	rng r = {seed};
+	text_buffer b = {data, size, 0};
+	char record[512];
+
+	append(&b, "[\n", 2);
+	for(unsigned id = 1; b.len < size; ++id) {
+		const char* name = names[pick(&r, NUMOF_NAMES)];
+		int len = snprintf(record, sizeof(record),
+			"  {\"id\": %u, \"name\": \"%s\", \"email\": \"%s.%u@%s\", \"active\": %s, "
+			"\"score\": %u.%02u, \"tags\": [\"%s\", \"%s\"], \"visits\": %u},\n",
+			id, name, name, pick(&r, 1000), domains[pick_skewed(&r, 3)],
+			pick(&r, 4) ? "true" : "false", pick(&r, 100), pick(&r, 100),
+			words[pick_skewed(&r, NUMOF_WORDS)], words[pick_skewed(&r, NUMOF_WORDS)],
+			pick_skewed(&r, 100000));
+		append(&b, record, len);
+	}
+}
+
+// Fixed-size little-endian records with slowly changing fields, like tables,
+// object files or telemetry
+static void generate_binary(unsigned char* data, size_t size, unsigned long long seed) {
+	rng r = {seed};
+	unsigned timestamp = 1700000000;
+	unsigned long long counter = 0;
+
+	for(size_t pos = 0; pos < size; pos += 32) {
+		unsigned char record[32] = {0};
+		timestamp += pick_skewed(&r, 64);
+		counter += 1 + pick_skewed(&r, 4);
+		unsigned type = pick_skewed(&r, 12);
+		unsigned long long value = next_random(&r);
+
+		for(unsigned i = 0; i < 4; ++i)
+			record[i] = timestamp >> (8 * i);
+		record[4] = type;
+		record[6] = pick(&r, 8) ? 0 : pick(&r, 256);
+		for(unsigned i = 0; i < 8; ++i)
+			record[8 + i] = counter >> (8 * i);
+		// Noisy measurement, only the low bytes really vary
+		for(unsigned i = 0; i < 3; ++i)
+			record[16 + i] = value >> (8 * i);
+		for(unsigned i = 0; i < 4; ++i)
+			record[24 + i] = (type * 0x9e3779b9u) >> (8 * i);
+
+		size_t len = size - pos < sizeof(record) ? size - pos : sizeof(record);
+		memcpy(data + pos, record, len);
+	}
+}
+
+// Back to back deflate streams of log text, as found inside archives or images
+static bool generate_compressed(unsigned char* data, size_t size, unsigned long long seed) {
+	enum { CHUNK_SIZE = 1 << 18 };
+	unsigned char* text = malloc(CHUNK_SIZE);
+	deflate_state state;
+	if(!text || !deflate_init(&state, DEFAULT_LEVEL)) {
+		free(text);
+		return false;
+	}
+
+	bool success = true;
+	size_t pos = 0;
+	while(pos < size) {
+		generate_logs(text, CHUNK_SIZE, seed++);
+		deflate_reset(&state);
+		if(!deflate_compress(&state, text, CHUNK_SIZE, LZIP_FINISH)) {
+			success = false;
+			break;
+		}
+
+		size_t len = size - pos < state.out.len ? size - pos : state.out.len;
+		memcpy(data + pos, state.out.buf, len);
+		pos += len;
+	}
+
+	deflate_end(&state);
+	free(text);
+	return success;
+}
+
+// Interleave 64K pieces of the other entries like a tarball of mixed files
+static void generate_mix(unsigned char* data, size_t size, const corpus_entry* sources,
+	unsigned numof_sources) {
+	enum { PIECE_SIZE = 1 << 16 };
+	for(size_t pos = 0, i = 0; pos < size; pos += PIECE_SIZE, ++i) {
+		const corpus_entry* source = &sources[i % numof_sources];
+		size_t offset = (i / numof_sources * PIECE_SIZE) % source->size;
+		size_t len = size - pos < PIECE_SIZE ? size - pos : PIECE_SIZE;
+		size_t available = source->size - offset < len ? source->size - offset : len;
+		memcpy(data + pos, source->data + offset, available);
+		memset(data + pos + available, '\0', len - available);
+	}
+}
+
+bool corpus_generate(corpus_entry entries[NUMOF_CORPUS_ENTRIES], size_t size) {
+	static const char* const entry_names[NUMOF_CORPUS_ENTRIES] = {
+		"logs", "json", "binary", "compressed", "mix"};
+
+	for(unsigned i = 0; i < NUMOF_CORPUS_ENTRIES; ++i) {
+		entries[i].name = entry_names[i];
+		entries[i].size = size;
+		entries[i].data = malloc(size ? size : 1);
+		if(!entries[i].data) {
+			while(i--)
+				corpus_free(&entries[i]);
+			return false;
+		}
+	}
+
+	generate_logs(entries[0].data, size, 1);
+	generate_json(entries[1].data, size, 2);
+	generate_binary(entries[2].data, size, 3);
+	bool success = generate_compressed(entries[3].data, size, 4);
+	generate_mix(entries[4].data, size, entries, 4);
+
+	if(!success) {
+		for(unsigned i = 0; i < NUMOF_CORPUS_ENTRIES; ++i)
+			corpus_free(&entries[i]);
+	}
+	return success;
+}
+
+bool corpus_load(corpus_entry* entry, const char* path) {
+	FILE* in = fopen(path, "r");
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+
+	bool success = false;
+	entry->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	entry->data = NULL;
+	if(fseek(in, 0, SEEK_END) < 0 || (long)(entry->size = ftell(in)) < 0 ||
+		fseek(in, 0, SEEK_SET) < 0) {
+		perror("Could not determine the file size");
+		goto done;
+	}
+
+	entry->data = malloc(entry->size ? entry->size : 1);
+	if(!entry->data) {
+		fprintf(stderr, "Out of memory.\n");
+		goto done;
+	}
+	if(fread(entry->data, 1, entry->size, in) != entry->size) {
+		perror("Error reading input");
+		goto done;
+	}
+	success = true;
+
+done:
+	if(!success)
+		corpus_free(entry);
+	fclose(in);
+	return success;
+}
+
+void corpus_free(corpus_entry* entry) {
+	free(entry->data);
+	entry->data = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef LZIP_BENCH_CORPUS_H
+#define LZIP_BENCH_CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	const char* name;
+	unsigned char* data;
+	size_t size;
+} corpus_entry;
+
+enum { NUMOF_CORPUS_ENTRIES = 5 };
+
+// Generate the standard corpus: text logs, JSON, structured binary records,
+// already-compressed data and a mix of all of them. Every entry is size bytes.
+// The data only depends on size, so numbers stay comparable across runs and
+// machines.
+bool corpus_generate(corpus_entry entries[NUMOF_CORPUS_ENTRIES], size_t size);
+bool corpus_load(corpus_entry* entry, const char* path);
+void corpus_free(corpus_entry* entry);
+
+#endif
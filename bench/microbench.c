@@ -0,0 +1,423 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "deflate.h"
+#include "inflate.h"
+#include "timer.h"
+
+enum { DEFAULT_ITERATIONS = 5, DEFAULT_SIZE_KB = 4096, NUMOF_TREE_BUILDS = 2000 };
+
+// One measured stage, work is the number of bytes or operations of a single run
+typedef struct {
+	char name[48];
+	const char* unit;
+	double work;
+	timing best;
+} stage_result;
+
+typedef struct {
+	stage_result* results;
+	unsigned numof_results;
+	unsigned capacity;
+	unsigned iterations;
+} stage_list;
+
+static stage_result* add_result(stage_list* list, const char* name, const char* unit, double work) {
+	if(list->numof_results == list->capacity) {
+		unsigned capacity = list->capacity ? 2 * list->capacity : 32;
+		stage_result* results = realloc(list->results, capacity * sizeof(stage_result));
+		if(!results)
+			return NULL;
+		list->results = results;
+		list->capacity = capacity;
+	}
+
+	stage_result* r = &list->results[list->numof_results++];
+	memset(r, '\0', sizeof(stage_result));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->unit = unit;
+	r->work = work;
+	return r;
+}
+
+// Writes fixed Huffman blocks (see RFC 1951 section 3.2.6) by hand so that every
+// decode stage can be fed exactly one kind of symbol
+typedef struct {
+	unsigned char* buf;
+	size_t len;
+	unsigned long long bits;
+	unsigned numof_bits;
+} block_writer;
+
+static void put_bits(block_writer* w, unsigned value, unsigned numof_bits) {
+	w->bits |= (unsigned long long)value << w->numof_bits;
+	w->numof_bits += numof_bits;
+	while(w->numof_bits >= 8) {
+		w->buf[w->len++] = w->bits & 0xff;
+		w->bits >>= 8;
+		w->numof_bits -= 8;
+	}
+}
+
+// Huffman codes are packed starting with their most significant bit
+static void put_code(block_writer* w, unsigned code, unsigned numof_bits) {
+	unsigned reversed = 0;
+	for(unsigned i = 0; i < numof_bits; ++i)
+		reversed |= ((code >> i) & 1) << (numof_bits - 1 - i);
+	put_bits(w, reversed, numof_bits);
+}
+
+static void put_symbol(block_writer* w, unsigned symbol) {
+	if(symbol < 144)
+		put_code(w, 0x30 + symbol, 8);
+	else if(symbol < 256)
+		put_code(w, 0x190 + symbol - 144, 9);
+	else if(symbol < 280)
+		put_code(w, symbol - 256, 7);
+	else
+		put_code(w, 0xc0 + symbol - 280, 8);
+}
+
+static const unsigned short length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15,
+	17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+	2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+	65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193,
+	12289, 16385, 24577};
+static const unsigned char dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+	6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void put_match(block_writer* w, unsigned length, unsigned dist) {
+	unsigned l = 28;
+	while(length_base[l] > length)
+		--l;
+	put_symbol(w, 257 + l);
+	put_bits(w, length - length_base[l], length_extra[l]);
+
+	unsigned d = 29;
+	while(dist_base[d] > dist)
+		--d;
+	put_code(w, d, 5);
+	put_bits(w, dist - dist_base[d], dist_extra[d]);
+}
+
+static void begin_fixed_block(block_writer* w, unsigned char* buf) {
+	memset(w, '\0', sizeof(block_writer));
+	w->buf = buf;
+	// BFINAL, then BTYPE 01
+	put_bits(w, 1, 1);
+	put_bits(w, 1, 2);
+}
+
+static void end_fixed_block(block_writer* w) {
+	put_symbol(w, 256);
+	put_bits(w, 0, 7);
+}
+
+static unsigned long long next_random(unsigned long long* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static bool null_sink(void* opaque, const unsigned char* data, size_t len) {
+	(void)opaque;
+	(void)data;
+	(void)len;
+	return true;
+}
+
+static volatile unsigned sink_value;
+
+static void bench_next_bit(stage_list* list, const unsigned char* data, size_t size) {
+	stage_result* r = add_result(list, "next_bit", "MB", size);
+	if(!r)
+		return;
+
+	for(unsigned i = 0; i < list->iterations; ++i) {
+		bit_stream stream;
+		unsigned value = 0;
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+
+		bit_stream_open_memory(&stream, data, size);
+		while(!stream.eof)
+			value += next_bit(&stream);
+
+		keep_best(&r->best, start_seconds, start_cycles);
+		sink_value = value;
+	}
+}
+
+static void bench_read_bits(stage_list* list, const unsigned char* data, size_t size,
+	bool invert, unsigned numof_bits) {
+	char name[48];
+	snprintf(name, sizeof(name), "%s/%u", invert ? "read_bits_and_invert" : "read_bits",
+		numof_bits);
+	stage_result* r = add_result(list, name, "MB", size);
+	if(!r)
+		return;
+
+	for(unsigned i = 0; i < list->iterations; ++i) {
+		bit_stream stream;
+		unsigned value = 0;
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+
+		bit_stream_open_memory(&stream, data, size);
+		if(invert) {
+			while(!stream.eof)
+				value += read_bits_and_invert(&stream, numof_bits);
+		} else {
+			while(!stream.eof)
+				value += read_bits(&stream, numof_bits);
+		}
+
+		keep_best(&r->best, start_seconds, start_cycles);
+		sink_value = value;
+	}
+}
+
+static void bench_fixed_tree(stage_list* list) {
+	stage_result* r = add_result(list, "build_fixed_huffman_tree", "tree", NUMOF_TREE_BUILDS);
+	static huffman_pool pool;
+	if(!r)
+		return;
+
+	for(unsigned i = 0; i < list->iterations; ++i) {
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+
+		for(unsigned j = 0; j < NUMOF_TREE_BUILDS; ++j) {
+			huffman_node root;
+			memset(&root, '\0', sizeof(huffman_node));
+			huffman_pool_reset(&pool);
+			build_fixed_huffman_tree(&pool, &root);
+		}
+
+		keep_best(&r->best, start_seconds, start_cycles);
+	}
+}
+
+// Parse the dynamic header of the first block of compressed log text and build
+// both trees from it
+static bool bench_dynamic_header(stage_list* list) {
+	corpus_entry entries[NUMOF_CORPUS_ENTRIES];
+	deflate_state state;
+	if(!corpus_generate(entries, 1 << 16))
+		return false;
+	if(!deflate_init(&state, DEFAULT_LEVEL)) {
+		for(unsigned i = 0; i < NUMOF_CORPUS_ENTRIES; ++i)
+			corpus_free(&entries[i]);
+		return false;
+	}
+
+	bool success = false;
+	if(!deflate_compress(&state, entries[0].data, entries[0].size, LZIP_FINISH))
+		goto done;
+
+	bit_stream stream;
+	bit_stream_open_memory(&stream, state.out.buf, state.out.len);
+	next_bit(&stream);
+	if(read_bits_and_invert(&stream, 2) != 2) {
+		fprintf(stderr, "Expected a dynamic block.\n");
+		goto done;
+	}
+
+	stage_result* r = add_result(list, "read_dynamic_huffman_tree", "header", NUMOF_TREE_BUILDS);
+	static huffman_pool pool;
+	if(!r)
+		goto done;
+
+	for(unsigned i = 0; i < list->iterations; ++i) {
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+
+		for(unsigned j = 0; j < NUMOF_TREE_BUILDS; ++j) {
+			huffman_node literals_root;
+			huffman_node distances_root;
+			memset(&literals_root, '\0', sizeof(huffman_node));
+			memset(&distances_root, '\0', sizeof(huffman_node));
+
+			bit_stream_open_memory(&stream, state.out.buf, state.out.len);
+			read_bits(&stream, 3);
+			huffman_pool_reset(&pool);
+			read_dynamic_huffman_tree(&stream, &pool, &literals_root, &distances_root);
+		}
+
+		keep_best(&r->best, start_seconds, start_cycles);
+	}
+	success = true;
+
+done:
+	deflate_end(&state);
+	for(unsigned i = 0; i < NUMOF_CORPUS_ENTRIES; ++i)
+		corpus_free(&entries[i]);
+	return success;
+}
+
+// Decode a prepared stream, work is counted in decompressed bytes
+static bool bench_inflate(stage_list* list, const char* name, const unsigned char* data,
+	size_t len, size_t decompressed_size) {
+	inflate_state state;
+	if(!inflate_init(&state, null_sink, NULL))
+		return false;
+
+	bool success = false;
+	stage_result* r = add_result(list, name, "MB", decompressed_size);
+	if(!r)
+		goto done;
+
+	for(unsigned i = 0; i < list->iterations; ++i) {
+		double start_seconds = now();
+		unsigned long long start_cycles = cycles();
+
+		bit_stream_open_memory(&state.stream, data, len);
+		inflate_reset(&state);
+		if(!inflate(&state) || state.total_out != decompressed_size) {
+			fprintf(stderr, "Decoding the %s stream failed.\n", name);
+			goto done;
+		}
+
+		keep_best(&r->best, start_seconds, start_cycles);
+	}
+	success = true;
+
+done:
+	inflate_end(&state);
+	return success;
+}
+
+static bool bench_literals(stage_list* list, unsigned char* buf, size_t size) {
+	block_writer w;
+	unsigned long long random = 0x9e3779b97f4a7c15ull;
+	begin_fixed_block(&w, buf);
+	for(size_t i = 0; i < size; ++i)
+		put_symbol(&w, next_random(&random) & 0xff);
+	end_fixed_block(&w);
+	return bench_inflate(list, "literals", w.buf, w.len, size);
+}
+
+static bool bench_copy(
+	stage_list* list, unsigned char* buf, size_t size, unsigned length, unsigned dist) {
+	block_writer w;
+	unsigned long long random = 0x9e3779b97f4a7c15ull;
+	begin_fixed_block(&w, buf);
+
+	// History the back-references copy from
+	for(unsigned i = 0; i < dist; ++i)
+		put_symbol(&w, next_random(&random) & 0xff);
+	size_t decompressed_size = dist;
+	while(decompressed_size + length <= size) {
+		put_match(&w, length, dist);
+		decompressed_size += length;
+	}
+	end_fixed_block(&w);
+
+	char name[48];
+	snprintf(name, sizeof(name), "copy/len=%u/dist=%u", length, dist);
+	return bench_inflate(list, name, w.buf, w.len, decompressed_size);
+}
+
+static void print_table(const stage_list* list) {
+	printf("%-28s %20s %12s %12s\n", "stage", "rate", "ns/unit", "cycles/unit");
+	for(unsigned i = 0; i < list->numof_results; ++i) {
+		const stage_result* r = &list->results[i];
+		double per_unit = r->best.seconds / r->work;
+		double rate = strcmp(r->unit, "MB") ? 1 / per_unit : 1 / per_unit / 1e6;
+		char unit[16];
+		snprintf(unit, sizeof(unit), "%s/s", r->unit);
+		printf("%-28s %12.2f %-7s %12.3f %12.2f\n", r->name, rate, unit, per_unit * 1e9,
+			(double)r->best.cycles / r->work);
+	}
+}
+
+static void print_json(const stage_list* list) {
+	printf("{\n  \"iterations\": %u,\n  \"stages\": [\n", list->iterations);
+	for(unsigned i = 0; i < list->numof_results; ++i) {
+		const stage_result* r = &list->results[i];
+		// Bytes are reported per byte, everything else per operation
+		printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"seconds\": %.9f, \"ns_per_unit\": %.3f, "
+			   "\"cycles_per_unit\": ",
+			r->name, strcmp(r->unit, "MB") ? r->unit : "byte", r->best.seconds,
+			r->best.seconds / r->work * 1e9);
+		if(HAVE_CYCLE_COUNTER)
+			printf("%.3f}", (double)r->best.cycles / r->work);
+		else
+			printf("null}");
+		printf("%s\n", i + 1 < list->numof_results ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+	static const unsigned lengths[] = {3, 8, 32, 258};
+	static const unsigned dists[] = {1, 2, 4, 8, 16, 64, 1024, 32768};
+	stage_list list = {NULL, 0, 0, DEFAULT_ITERATIONS};
+	size_t size = DEFAULT_SIZE_KB * 1024;
+	bool json = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "i:s:j")) != -1) {
+		if(opt == 'i')
+			list.iterations = atoi(optarg);
+		else if(opt == 's')
+			size = (size_t)atol(optarg) * 1024;
+		else if(opt == 'j')
+			json = true;
+		else
+			list.iterations = 0;
+	}
+	if(!list.iterations || size < 2 * MAX_DISTANCE || optind != argc) {
+		fprintf(stderr, "Usage: %s [-i iterations] [-s size KB] [-j]\n", argv[0]);
+		exit(1);
+	}
+
+	// Large enough for 9-bit literals, the largest symbols written
+	unsigned char* buf = malloc(size * 9 / 8 + 64);
+	bool success = false;
+	if(!buf) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	unsigned long long random = 0x243f6a8885a308d3ull;
+	for(size_t i = 0; i < size; ++i)
+		buf[i] = next_random(&random);
+
+	bench_next_bit(&list, buf, size);
+	for(unsigned n = 1; n <= 13; n += 4) {
+		bench_read_bits(&list, buf, size, false, n);
+		bench_read_bits(&list, buf, size, true, n);
+	}
+
+	bench_fixed_tree(&list);
+	if(!bench_dynamic_header(&list))
+		goto done;
+
+	if(!bench_literals(&list, buf, size))
+		goto done;
+	for(unsigned i = 0; i < sizeof(dists) / sizeof(dists[0]); ++i) {
+		for(unsigned j = 0; j < sizeof(lengths) / sizeof(lengths[0]); ++j) {
+			if(!bench_copy(&list, buf, size, lengths[j], dists[i]))
+				goto done;
+		}
+	}
+
+	if(json)
+		print_json(&list);
+	else
+		print_table(&list);
+	success = true;
+
+done:
+	free(list.results);
+	free(buf);
+	exit(success ? 0 : 1);
+}
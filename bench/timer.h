@@ -0,0 +1,44 @@
+#ifndef LZIP_BENCH_TIMER_H
+#define LZIP_BENCH_TIMER_H
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#else
+#define HAVE_CYCLE_COUNTER 0
+#endif
+
+// Fastest of all iterations, the others were disturbed by something
+typedef struct {
+	double seconds;
+	unsigned long long cycles;
+} timing;
+
+static inline double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reference cycles (TSC) on x86, not affected by frequency scaling
+static inline unsigned long long cycles(void) {
+#if HAVE_CYCLE_COUNTER
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static inline void keep_best(
+	timing* best, double start_seconds, unsigned long long start_cycles) {
+	double seconds = now() - start_seconds;
+	unsigned long long elapsed_cycles = cycles() - start_cycles;
+	if(!best->seconds || seconds < best->seconds) {
+		best->seconds = seconds;
+		best->cycles = elapsed_cycles;
+	}
+}
+
+#endif
@@ -0,0 +1,17 @@
+# Merge the raw profiles written by clang-instrumented binaries into the single
+# file -fprofile-use expects. Run with -DLLVM_PROFDATA=... -DPROFILE_DIR=...
+if (NOT LLVM_PROFDATA)
+	message(FATAL_ERROR "llvm-profdata is needed to merge clang profiles")
+endif ()
+
+file(GLOB RAW_PROFILES "${PROFILE_DIR}/*.profraw")
+if (NOT RAW_PROFILES)
+	message(FATAL_ERROR "No profiles found in ${PROFILE_DIR}")
+endif ()
+
+execute_process(
+	COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIR}/merged.profdata ${RAW_PROFILES}
+	RESULT_VARIABLE MERGE_RESULT)
+if (NOT MERGE_RESULT EQUAL 0)
+	message(FATAL_ERROR "Merging profiles failed")
+endif ()
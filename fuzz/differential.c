@@ -0,0 +1,374 @@
+// Compares lzip with a reference gzip (the gzip program, or whatever --gzip
+// names) on every file of a corpus:
+// - gzip files are decompressed by both, which have to produce the same data or
+//   both reject the file
+// - any other file is compressed by lzip at several levels and decompressed by
+//   the reference, and the other way around; every round trip must restore it
+// - the same files go through lzip_deflate() and lzip_inflate() on one reused
+//   context, with a different preset dictionary for every stream
+// Files are run one after another, directories are searched one level deep.
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bytes.h"
+#include "crc32.h"
+#include "deflate.h"
+#include "gzip.h"
+#include "inflate.h"
+#include "lzip.h"
+
+typedef struct {
+	unsigned char* data;
+	size_t len;
+	size_t capacity;
+} buffer;
+
+typedef struct {
+	const char* gzip;
+	inflate_state inflate;
+	buffer expected;
+	buffer compressed;
+	buffer actual;
+	unsigned numof_files;
+	unsigned numof_mismatches;
+} differential;
+
+static const int lzip_levels[] = {MIN_LEVEL, 1, 6, 9, MAX_LEVEL};
+static const char* const reference_levels[] = {"-1", "-6", "-9"};
+
+static bool buffer_append(buffer* b, const unsigned char* data, size_t len) {
+	if(b->len + len > b->capacity) {
+		size_t capacity = b->capacity ? b->capacity : 1 << 16;
+		while(capacity < b->len + len)
+			capacity *= 2;
+		unsigned char* grown = realloc(b->data, capacity);
+		if(!grown) {
+			fprintf(stderr, "Out of memory.\n");
+			return false;
+		}
+		b->data = grown;
+		b->capacity = capacity;
+	}
+	if(len)
+		memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return true;
+}
+
+// inflate_sink collecting the output in a buffer
+static bool append_output(void* opaque, const unsigned char* data, size_t len) {
+	return buffer_append(opaque, data, len);
+}
+
+static bool read_fd(int fd, buffer* b) {
+	b->len = 0;
+	unsigned char chunk[1 << 16];
+	ssize_t n;
+	while((n = read(fd, chunk, sizeof(chunk))) > 0) {
+		if(!buffer_append(b, chunk, n))
+			return false;
+	}
+	if(n < 0)
+		perror("Error reading input");
+	return n == 0;
+}
+
+// Feed data to the reference with the given flag through temporary files, so
+// that neither side can block the other. False if it failed or rejected the data.
+static bool run_reference(
+	const char* gzip, const char* flag, const unsigned char* data, size_t len, buffer* out) {
+	bool success = false;
+	FILE* in = tmpfile();
+	FILE* result = tmpfile();
+	if(!in || !result) {
+		perror("Could not create temporary file");
+		goto done;
+	}
+	if((len && fwrite(data, 1, len, in) != len) || fflush(in) != 0) {
+		perror("Error writing temporary file");
+		goto done;
+	}
+	rewind(in);
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("Could not start the reference");
+		goto done;
+	}
+	if(pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(fileno(in), 0);
+		dup2(fileno(result), 1);
+		if(null >= 0)
+			dup2(null, 2);
+		execlp(gzip, gzip, "-c", flag, (char*)NULL);
+		_exit(127);
+	}
+	int status;
+	if(waitpid(pid, &status, 0) < 0) {
+		perror("Could not wait for the reference");
+		goto done;
+	}
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "Could not run '%s'.\n", gzip);
+		exit(2);
+	}
+	success = WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+		lseek(fileno(result), 0, SEEK_SET) == 0 && read_fd(fileno(result), out);
+
+done:
+	if(in)
+		fclose(in);
+	if(result)
+		fclose(result);
+	return success;
+}
+
+// Every member through lzip's header parser and decoder, checked against its
+// trailer. Zeros after the last member are padding, anything else is rejected.
+static bool lzip_gunzip(differential* diff, const unsigned char* data, size_t len, buffer* out) {
+	inflate_state* state = &diff->inflate;
+	out->len = 0;
+	state->opaque = out;
+	bit_stream_open_memory(&state->stream, data, len);
+	do {
+		gzip_file gzip;
+		memset(&gzip, '\0', sizeof(gzip));
+		bool header_read = read_gzip_header(&state->stream, &gzip);
+		free_gzip_file(&gzip);
+		if(!header_read)
+			return false;
+
+		size_t start = out->len;
+		unsigned char trailer[8];
+		inflate_reset(state);
+		if(!inflate(state) || !read_bytes(&state->stream, trailer, sizeof(trailer)))
+			return false;
+		if(load_le32(trailer) != crc32_update(0, out->data + start, out->len - start) ||
+			load_le32(trailer + 4) != ((out->len - start) & 0xffffffff))
+			return false;
+
+		const unsigned char* p = state->stream.next;
+		while(p < state->stream.end && !*p)
+			++p;
+		if(p == state->stream.end)
+			break;
+	} while(!bit_stream_at_end(&state->stream));
+	return true;
+}
+
+// A gzip member of data as lzip's compressor writes it, minus the file name
+static bool lzip_gzip(const unsigned char* data, size_t len, int level, buffer* out) {
+	static const unsigned char header[10] = {31, 139, 8, 0, 0, 0, 0, 0, 0, 3};
+	deflate_state state;
+	if(!deflate_init(&state, level)) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	out->len = 0;
+	bool success = buffer_append(out, header, sizeof(header));
+	if(success && !deflate_compress(&state, data, len, LZIP_FINISH)) {
+		fprintf(stderr, "Compression failed.\n");
+		success = false;
+	}
+	if(success)
+		success = buffer_append(out, state.out.buf, state.out.len);
+	deflate_end(&state);
+
+	unsigned long crc = crc32_update(0, data, len);
+	unsigned char trailer[8];
+	store_le32(trailer, crc);
+	store_le32(trailer + 4, len & 0xffffffff);
+	return success && buffer_append(out, trailer, sizeof(trailer));
+}
+
+static bool same(const buffer* a, const buffer* b) {
+	return a->len == b->len && (!a->len || !memcmp(a->data, b->data, a->len));
+}
+
+static void mismatch(differential* diff, const char* path, const char* what) {
+	printf("Mismatch in '%s': %s\n", path, what);
+	++diff->numof_mismatches;
+}
+
+static void compare_decompression(differential* diff, const char* path, const buffer* file) {
+	bool reference_ok = run_reference(diff->gzip, "-d", file->data, file->len, &diff->expected);
+	bool lzip_ok = lzip_gunzip(diff, file->data, file->len, &diff->actual);
+	if(reference_ok != lzip_ok)
+		mismatch(diff, path, lzip_ok ? "only lzip accepts it" : "only the reference accepts it");
+	else if(lzip_ok && !same(&diff->expected, &diff->actual))
+		mismatch(diff, path, "decompressed data differs");
+}
+
+static void compare_round_trips(differential* diff, const char* path, const buffer* file) {
+	char what[64];
+	for(size_t i = 0; i < sizeof(lzip_levels) / sizeof(lzip_levels[0]); ++i) {
+		if(!lzip_gzip(file->data, file->len, lzip_levels[i], &diff->compressed))
+			exit(2);
+		if(!run_reference(
+			   diff->gzip, "-d", diff->compressed.data, diff->compressed.len, &diff->actual) ||
+			!same(file, &diff->actual)) {
+			snprintf(what, sizeof(what), "lzip -%d, reference -d", lzip_levels[i]);
+			mismatch(diff, path, what);
+		}
+	}
+	for(size_t i = 0; i < sizeof(reference_levels) / sizeof(reference_levels[0]); ++i) {
+		if(!run_reference(diff->gzip, reference_levels[i], file->data, file->len, &diff->compressed))
+			continue;
+		if(!lzip_gunzip(diff, diff->compressed.data, diff->compressed.len, &diff->actual) ||
+			!same(file, &diff->actual)) {
+			snprintf(what, sizeof(what), "reference %s, lzip -d", reference_levels[i]);
+			mismatch(diff, path, what);
+		}
+	}
+}
+
+// One zlib stream of data through lzip_deflate() with small output buffers, then
+// back through lzip_inflate() on the same context
+static bool context_round_trip(differential* diff, lzip_context* ctx, const buffer* file) {
+	lzip_in_buffer in = {file->data, file->len, 0};
+	diff->compressed.len = 0;
+	lzip_status status;
+	do {
+		unsigned char chunk[4096];
+		lzip_out_buffer out = {chunk, sizeof(chunk), 0};
+		status = lzip_deflate(ctx, &in, &out, LZIP_FINISH);
+		if(status == LZIP_ERROR || !buffer_append(&diff->compressed, chunk, out.pos))
+			return false;
+	} while(status != LZIP_STREAM_END);
+
+	// Room for the whole output, lzip_inflate() doesn't grow it
+	diff->actual.len = 0;
+	if(!buffer_append(&diff->actual, file->data, file->len))
+		return false;
+	in = (lzip_in_buffer){diff->compressed.data, diff->compressed.len, 0};
+	lzip_out_buffer out = {diff->actual.data, diff->actual.capacity, 0};
+	if(lzip_inflate(ctx, &in, &out) != LZIP_STREAM_END)
+		return false;
+	diff->actual.len = out.pos;
+	return same(file, &diff->actual);
+}
+
+// Streams on a reused context: the first half of the file as the dictionary, then
+// after a reset the second half. A dictionary set while a stream is underway must
+// be refused and leave the stream alone.
+static void compare_context(differential* diff, const char* path, const buffer* file) {
+	lzip_context ctx;
+	if(!lzip_context_init(&ctx, DEFAULT_LEVEL, LZIP_FORMAT_ZLIB)) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(2);
+	}
+	size_t half = file->len / 2;
+	if(!lzip_set_dictionary(&ctx, file->data, half) || !context_round_trip(diff, &ctx, file))
+		mismatch(diff, path, "lzip_deflate() with a dictionary");
+
+	lzip_deflate_reset(&ctx);
+	if(!lzip_set_dictionary(&ctx, file->data + half, file->len - half))
+		mismatch(diff, path, "lzip_set_dictionary() after a reset");
+	lzip_in_buffer in = {file->data, file->len / 4, 0};
+	unsigned char chunk[4096];
+	lzip_out_buffer out = {chunk, sizeof(chunk), 0};
+	if(lzip_deflate(&ctx, &in, &out, LZIP_NO_FLUSH) == LZIP_ERROR ||
+		lzip_set_dictionary(&ctx, file->data, half))
+		mismatch(diff, path, "lzip_set_dictionary() during a stream");
+
+	lzip_deflate_reset(&ctx);
+	if(!context_round_trip(diff, &ctx, file))
+		mismatch(diff, path, "lzip_deflate() with a new dictionary after a reset");
+	lzip_context_free(&ctx);
+}
+
+static bool check_file(differential* diff, const char* path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+	buffer file = {NULL, 0, 0};
+	bool success = read_fd(fd, &file);
+	close(fd);
+	if(success) {
+		++diff->numof_files;
+		if(file.len >= 2 && file.data[0] == 31 && file.data[1] == 139)
+			compare_decompression(diff, path, &file);
+		else {
+			compare_round_trips(diff, path, &file);
+			compare_context(diff, path, &file);
+		}
+	}
+	free(file.data);
+	return success;
+}
+
+static bool check_path(differential* diff, const char* path) {
+	struct stat st;
+	if(stat(path, &st) < 0) {
+		perror(path);
+		return false;
+	}
+	if(!S_ISDIR(st.st_mode))
+		return check_file(diff, path);
+
+	DIR* dir = opendir(path);
+	if(!dir) {
+		perror(path);
+		return false;
+	}
+	bool success = true;
+	struct dirent* entry;
+	while((entry = readdir(dir))) {
+		if(entry->d_name[0] == '.')
+			continue;
+		char* file = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		if(!file) {
+			fprintf(stderr, "Out of memory.\n");
+			success = false;
+			break;
+		}
+		sprintf(file, "%s/%s", path, entry->d_name);
+		if(stat(file, &st) == 0 && S_ISREG(st.st_mode))
+			success &= check_file(diff, file);
+		free(file);
+	}
+	closedir(dir);
+	return success;
+}
+
+int main(int argc, char** argv) {
+	differential diff;
+	memset(&diff, '\0', sizeof(diff));
+	diff.gzip = "gzip";
+	int first = 1;
+	if(argc > 2 && !strcmp(argv[1], "--gzip")) {
+		diff.gzip = argv[2];
+		first = 3;
+	}
+	if(first == argc) {
+		fprintf(stderr, "Usage: %s [--gzip program] file|directory...\n", argv[0]);
+		return 2;
+	}
+	if(!inflate_init(&diff.inflate, append_output, NULL)) {
+		fprintf(stderr, "Out of memory.\n");
+		return 2;
+	}
+
+	bool success = true;
+	for(int i = first; i < argc; ++i)
+		success &= check_path(&diff, argv[i]);
+	fprintf(stderr, "%u files, %u mismatches\n", diff.numof_files, diff.numof_mismatches);
+
+	inflate_end(&diff.inflate);
+	free(diff.expected.data);
+	free(diff.compressed.data);
+	free(diff.actual.data);
+	if(!success)
+		return 2;
+	return diff.numof_mismatches ? 1 : 0;
+}
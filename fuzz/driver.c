@@ -0,0 +1,158 @@
+// Runs a fuzz target without libFuzzer, for GCC builds, AFL and replaying a
+// corpus. Inputs come from the files given, directories are searched one level
+// deep, or from stdin if there are none. Files are also timed: a unit decoding
+// slower than the floor given with --min-mbps is reported, as inputs that make
+// the decoder crawl matter as much as those that crash it.
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+// Set by targets that produce output, which counts towards their throughput
+__attribute__((weak)) unsigned long long fuzz_bytes_out;
+
+enum { DEFAULT_MIN_MBPS = 5 };
+// Every file is repeated until this much time has passed to get a stable rate
+#define MEASURE_SECONDS 0.01
+// Inputs done faster than this are never slow, whatever their size
+#define MIN_SLOW_SECONDS 1e-4
+
+typedef struct {
+	double min_mbps;
+	unsigned numof_inputs;
+	unsigned numof_slow;
+} driver;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char* read_all(FILE* in, size_t* size) {
+	size_t capacity = 1 << 16;
+	unsigned char* data = malloc(capacity);
+	*size = 0;
+	while(data) {
+		*size += fread(data + *size, 1, capacity - *size, in);
+		if(*size < capacity)
+			break;
+		unsigned char* grown = realloc(data, capacity *= 2);
+		if(!grown)
+			free(data);
+		data = grown;
+	}
+	if(!data)
+		fprintf(stderr, "Out of memory.\n");
+	else if(ferror(in)) {
+		perror("Error reading input");
+		free(data);
+		data = NULL;
+	}
+	return data;
+}
+
+// Bytes going in and out over the time a single run takes
+static void run_timed(driver* d, const char* path, const unsigned char* data, size_t size) {
+	unsigned numof_runs = 0;
+	double start = now();
+	double elapsed;
+	do {
+		LLVMFuzzerTestOneInput(data, size);
+		++numof_runs;
+		elapsed = now() - start;
+	} while(elapsed < MEASURE_SECONDS);
+
+	double seconds = elapsed / numof_runs;
+	double mbps = (size + fuzz_bytes_out) / seconds / 1e6;
+	++d->numof_inputs;
+	if(seconds >= MIN_SLOW_SECONDS && mbps < d->min_mbps) {
+		printf("Slow unit '%s': %zu bytes in, %llu out in %.3f ms (%.2f MB/s)\n", path, size,
+			fuzz_bytes_out, seconds * 1e3, mbps);
+		++d->numof_slow;
+	}
+}
+
+static bool run_file(driver* d, const char* path) {
+	FILE* in = fopen(path, "rb");
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+	size_t size;
+	unsigned char* data = read_all(in, &size);
+	fclose(in);
+	if(!data)
+		return false;
+	run_timed(d, path, data, size);
+	free(data);
+	return true;
+}
+
+static bool run_path(driver* d, const char* path) {
+	struct stat st;
+	if(stat(path, &st) < 0) {
+		perror(path);
+		return false;
+	}
+	if(!S_ISDIR(st.st_mode))
+		return run_file(d, path);
+
+	DIR* dir = opendir(path);
+	if(!dir) {
+		perror(path);
+		return false;
+	}
+	bool success = true;
+	struct dirent* entry;
+	while((entry = readdir(dir))) {
+		if(entry->d_name[0] == '.')
+			continue;
+		char* file = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		if(!file) {
+			fprintf(stderr, "Out of memory.\n");
+			success = false;
+			break;
+		}
+		sprintf(file, "%s/%s", path, entry->d_name);
+		if(stat(file, &st) == 0 && S_ISREG(st.st_mode))
+			success &= run_file(d, file);
+		free(file);
+	}
+	closedir(dir);
+	return success;
+}
+
+int main(int argc, char** argv) {
+	driver d = {DEFAULT_MIN_MBPS, 0, 0};
+	int first = 1;
+	if(argc > 2 && !strcmp(argv[1], "--min-mbps")) {
+		d.min_mbps = atof(argv[2]);
+		first = 3;
+	}
+
+	// A single run per input, AFL measures time itself
+	if(first == argc) {
+		size_t size;
+		unsigned char* data = read_all(stdin, &size);
+		if(!data)
+			return 2;
+		LLVMFuzzerTestOneInput(data, size);
+		free(data);
+		return 0;
+	}
+
+	bool success = true;
+	for(int i = first; i < argc; ++i)
+		success &= run_path(&d, argv[i]);
+	fprintf(stderr, "%u inputs, %u slow units below %.2f MB/s\n", d.numof_inputs, d.numof_slow,
+		d.min_mbps);
+	if(!success)
+		return 2;
+	return d.numof_slow ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inflate.h"
+
+// The header of a dynamic Huffman block (RFC 1951 section 3.2.7), starting right
+// after BTYPE. Every tree built from it has to fit the pool.
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	static huffman_pool pool;
+	bit_stream stream;
+	huffman_node literals_root, distances_root;
+	bit_stream_open_memory(&stream, data, size);
+	huffman_pool_reset(&pool);
+	read_dynamic_huffman_tree(&stream, &pool, &literals_root, &distances_root);
+	return 0;
+}
@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gzip.h"
+
+// Both header parsers main() runs before the deflate data, on arbitrary bytes
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	bit_stream stream;
+	gzip_file gzip;
+	memset(&gzip, '\0', sizeof(gzip));
+	bit_stream_open_memory(&stream, data, size);
+	read_gzip_header(&stream, &gzip);
+	free_gzip_file(&gzip);
+
+	bit_stream_open_memory(&stream, data, size);
+	read_zlib_header(&stream);
+	return 0;
+}
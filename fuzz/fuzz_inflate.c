@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "crc32.h"
+#include "inflate.h"
+
+// Decompressed size of the last input, the standalone driver judges slow units
+// by it
+unsigned long long fuzz_bytes_out;
+// Checksumming the output makes sure every byte of it is read
+static volatile unsigned long checksum;
+
+static bool checksum_output(void* opaque, const unsigned char* data, size_t len) {
+	(void)opaque;
+	checksum = crc32_update(checksum, data, len);
+	fuzz_bytes_out += len;
+	return true;
+}
+
+// A raw deflate stream through inflate(), with all block types and both the fast
+// and the checked decoding loop. The state is set up once like for a long batch.
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	static inflate_state state;
+	static bool initialized;
+	if(!initialized) {
+		if(!inflate_init(&state, checksum_output, NULL))
+			abort();
+		initialized = true;
+	}
+
+	fuzz_bytes_out = 0;
+	bit_stream_open_memory(&state.stream, data, size);
+	inflate_reset(&state);
+	inflate(&state);
+	return 0;
+}
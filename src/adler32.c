@@ -0,0 +1,207 @@
+#include "adler32.h"
+
+#include <stdatomic.h>
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+enum {
+	ADLER_MOD = 65521,
+	// Most bytes that can be summed up before the sums may overflow 32 bits
+	ADLER_NMAX = 5552
+};
+
+// Every kernel adds whole blocks to the unreduced sums. Over one block a grows by
+// the sum of its bytes while b grows by block_size times the old a plus every
+// byte weighted by its distance from the end of the block.
+typedef struct {
+	const char* name;
+	unsigned block_size;
+	void (*sum_blocks)(
+		unsigned long* a, unsigned long* b, const unsigned char* buf, size_t numof_blocks);
+} adler32_kernel;
+
+#if defined(__SSE2__)
+static unsigned long sum_lanes(__m128i v) {
+	unsigned lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, v);
+	return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static void sum_blocks_sse2(
+	unsigned long* a, unsigned long* b, const unsigned char* buf, size_t numof_blocks) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+	__m128i byte_sums = zero;
+	// Byte sums as of the start of each block, each of them is later worth 16 in b
+	__m128i prefix_sums = zero;
+	__m128i weighted_sums = zero;
+
+	for(size_t i = 0; i < numof_blocks; ++i) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(buf + 16 * i));
+		prefix_sums = _mm_add_epi32(prefix_sums, byte_sums);
+		byte_sums = _mm_add_epi32(byte_sums, _mm_sad_epu8(bytes, zero));
+		weighted_sums = _mm_add_epi32(weighted_sums,
+			_mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_lo));
+		weighted_sums = _mm_add_epi32(weighted_sums,
+			_mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_hi));
+	}
+
+	*b += 16 * numof_blocks * *a + 16 * sum_lanes(prefix_sums) + sum_lanes(weighted_sums);
+	*a += sum_lanes(byte_sums);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static unsigned long sum_lanes_avx2(__m256i v) {
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+	return (unsigned)_mm_cvtsi128_si32(sum);
+}
+
+// Same as SSE2 with 32 byte blocks, pmaddubsw weighs the bytes without unpacking
+__attribute__((target("avx2"))) static void sum_blocks_avx2(
+	unsigned long* a, unsigned long* b, const unsigned char* buf, size_t numof_blocks) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22,
+		21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	__m256i byte_sums = zero;
+	__m256i prefix_sums = zero;
+	__m256i weighted_sums = zero;
+
+	for(size_t i = 0; i < numof_blocks; ++i) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*)(buf + 32 * i));
+		prefix_sums = _mm256_add_epi32(prefix_sums, byte_sums);
+		byte_sums = _mm256_add_epi32(byte_sums, _mm256_sad_epu8(bytes, zero));
+		weighted_sums = _mm256_add_epi32(
+			weighted_sums, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+	}
+
+	*b += 32 * numof_blocks * *a + 32 * sum_lanes_avx2(prefix_sums) +
+		sum_lanes_avx2(weighted_sums);
+	*a += sum_lanes_avx2(byte_sums);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void sum_blocks_avx512(
+	unsigned long* a, unsigned long* b, const unsigned char* buf, size_t numof_blocks) {
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i ones = _mm512_set1_epi16(1);
+	const __m512i weights = _mm512_set_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+		15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+		36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56,
+		57, 58, 59, 60, 61, 62, 63, 64);
+	__m512i byte_sums = zero;
+	__m512i prefix_sums = zero;
+	__m512i weighted_sums = zero;
+
+	for(size_t i = 0; i < numof_blocks; ++i) {
+		__m512i bytes = _mm512_loadu_si512((const void*)(buf + 64 * i));
+		prefix_sums = _mm512_add_epi32(prefix_sums, byte_sums);
+		byte_sums = _mm512_add_epi32(byte_sums, _mm512_sad_epu8(bytes, zero));
+		weighted_sums = _mm512_add_epi32(
+			weighted_sums, _mm512_madd_epi16(_mm512_maddubs_epi16(bytes, weights), ones));
+	}
+
+	*b += 64 * numof_blocks * *a + 64 * (unsigned long)(unsigned)_mm512_reduce_add_epi32(prefix_sums) +
+		(unsigned)_mm512_reduce_add_epi32(weighted_sums);
+	*a += (unsigned)_mm512_reduce_add_epi32(byte_sums);
+}
+#endif
+
+#if defined(__aarch64__)
+// NEON is part of the AArch64 baseline
+static void sum_blocks_neon(
+	unsigned long* a, unsigned long* b, const unsigned char* buf, size_t numof_blocks) {
+	static const uint16_t weights[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+	const uint16x8_t weights_lo = vld1q_u16(weights);
+	const uint16x8_t weights_hi = vld1q_u16(weights + 8);
+	uint32x4_t byte_sums = vdupq_n_u32(0);
+	uint32x4_t prefix_sums = vdupq_n_u32(0);
+	uint32x4_t weighted_sums = vdupq_n_u32(0);
+
+	for(size_t i = 0; i < numof_blocks; ++i) {
+		uint8x16_t bytes = vld1q_u8(buf + 16 * i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+		uint16x8_t hi = vmovl_high_u8(bytes);
+		prefix_sums = vaddq_u32(prefix_sums, byte_sums);
+		byte_sums = vpadalq_u16(byte_sums, vpaddlq_u8(bytes));
+		weighted_sums = vmlal_u16(weighted_sums, vget_low_u16(lo), vget_low_u16(weights_lo));
+		weighted_sums = vmlal_high_u16(weighted_sums, lo, weights_lo);
+		weighted_sums = vmlal_u16(weighted_sums, vget_low_u16(hi), vget_low_u16(weights_hi));
+		weighted_sums = vmlal_high_u16(weighted_sums, hi, weights_hi);
+	}
+
+	*b += 16 * numof_blocks * *a + 16 * (unsigned long)vaddvq_u32(prefix_sums) +
+		vaddvq_u32(weighted_sums);
+	*a += vaddvq_u32(byte_sums);
+}
+#endif
+
+static const adler32_kernel* select_kernel(void) {
+	static const adler32_kernel generic = {"generic", 0, NULL};
+	unsigned features = cpu_features();
+	(void)features;
+#if defined(__x86_64__) || defined(__i386__)
+	static const adler32_kernel avx512 = {"avx512bw", 64, sum_blocks_avx512};
+	static const adler32_kernel avx2 = {"avx2", 32, sum_blocks_avx2};
+	if(features & CPU_AVX512BW)
+		return &avx512;
+	if(features & CPU_AVX2)
+		return &avx2;
+#endif
+#if defined(__SSE2__)
+	static const adler32_kernel sse2 = {"sse2", 16, sum_blocks_sse2};
+	return &sse2;
+#elif defined(__aarch64__)
+	static const adler32_kernel neon = {"neon", 16, sum_blocks_neon};
+	return &neon;
+#endif
+	return &generic;
+}
+
+static const adler32_kernel* kernel(void) {
+	static const adler32_kernel* _Atomic selected;
+	const adler32_kernel* k = atomic_load_explicit(&selected, memory_order_relaxed);
+	if(!k) {
+		k = select_kernel();
+		atomic_store_explicit(&selected, k, memory_order_relaxed);
+	}
+	return k;
+}
+
+unsigned long adler32_update(unsigned long adler, const unsigned char* buf, size_t len) {
+	const adler32_kernel* k = kernel();
+	unsigned long a = adler & 0xffff;
+	unsigned long b = (adler >> 16) & 0xffff;
+
+	while(len) {
+		size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+		len -= n;
+		if(k->block_size) {
+			size_t numof_blocks = n / k->block_size;
+			k->sum_blocks(&a, &b, buf, numof_blocks);
+			buf += k->block_size * numof_blocks;
+			n -= k->block_size * numof_blocks;
+		}
+		while(n--) {
+			a += *(buf++);
+			b += a;
+		}
+		a %= ADLER_MOD;
+		b %= ADLER_MOD;
+	}
+
+	return (b << 16) | a;
+}
+
+const char* adler32_kernel_name(void) {
+	return kernel()->name;
+}
@@ -0,0 +1,12 @@
+#ifndef LZIP_ADLER32_H
+#define LZIP_ADLER32_H
+
+#include <stddef.h>
+
+// Update a running Adler-32 (RFC 1950 section 8.2) with len bytes of buf.
+// Start with an adler of 1.
+unsigned long adler32_update(unsigned long adler, const unsigned char* buf, size_t len);
+// Name of the implementation picked for this CPU
+const char* adler32_kernel_name(void);
+
+#endif
@@ -0,0 +1,24 @@
+#include "args.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+bool parse_size(const char* arg, size_t* size) {
+	char* end;
+	unsigned long long value = strtoull(arg, &end, 10);
+	if(end == arg)
+		return false;
+	unsigned shift = 0;
+	if(*end == 'K' || *end == 'k')
+		shift = 10;
+	else if(*end == 'M' || *end == 'm')
+		shift = 20;
+	else if(*end == 'G' || *end == 'g')
+		shift = 30;
+	if(shift)
+		++end;
+	if(*end || value > (SIZE_MAX >> shift))
+		return false;
+	*size = value << shift;
+	return true;
+}
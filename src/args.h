@@ -0,0 +1,12 @@
+#ifndef LZIP_ARGS_H
+#define LZIP_ARGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Option values shared by lzip and lzipd
+
+// A number of bytes, optionally followed by K, M or G for powers of 1024
+bool parse_size(const char* arg, size_t* size);
+
+#endif
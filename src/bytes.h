@@ -0,0 +1,37 @@
+#ifndef LZIP_BYTES_H
+#define LZIP_BYTES_H
+
+// Integers stored in a fixed byte order: gzip, deflate and ZIP fields are little
+// endian, zlib's are big endian
+
+static inline unsigned load_le16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline unsigned long load_le32(const unsigned char* p) {
+	return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static inline unsigned long long load_le64(const unsigned char* p) {
+	return load_le32(p) | ((unsigned long long)load_le32(p + 4) << 32);
+}
+
+static inline unsigned long load_be32(const unsigned char* p) {
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void store_le32(unsigned char* p, unsigned long value) {
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+}
+
+static inline void store_be32(unsigned char* p, unsigned long value) {
+	p[0] = (value >> 24) & 0xff;
+	p[1] = (value >> 16) & 0xff;
+	p[2] = (value >> 8) & 0xff;
+	p[3] = value & 0xff;
+}
+
+#endif
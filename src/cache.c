@@ -0,0 +1,200 @@
+// copy_file_range and mkostemp are GNU extensions
+#define _GNU_SOURCE
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Temporary files start with a dot, they aren't entries yet
+#define TEMPORARY_NAME ".tmp-XXXXXX"
+
+typedef struct {
+	char* name;
+	unsigned long long size;
+	struct timespec used;
+} cache_entry;
+
+static char* entry_path(const decode_cache* cache, const char* name) {
+	char* path = malloc(strlen(cache->dir) + strlen(name) + 2);
+	if(path)
+		sprintf(path, "%s/%s", cache->dir, name);
+	return path;
+}
+
+static int compare_use(const void* a, const void* b) {
+	const struct timespec* x = &((const cache_entry*)a)->used;
+	const struct timespec* y = &((const cache_entry*)b)->used;
+	if(x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// Sum up the entries and remove the least recently used ones until no more than
+// target bytes are left
+static void evict(decode_cache* cache, unsigned long long target) {
+	DIR* dir = opendir(cache->dir);
+	if(!dir)
+		return;
+
+	cache_entry* entries = NULL;
+	size_t numof_entries = 0;
+	size_t capacity = 0;
+	unsigned long long total = 0;
+	struct dirent* d;
+	while((d = readdir(dir))) {
+		struct stat st;
+		if(d->d_name[0] == '.' || fstatat(dirfd(dir), d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+			!S_ISREG(st.st_mode))
+			continue;
+		if(numof_entries == capacity) {
+			capacity = capacity ? 2 * capacity : 256;
+			cache_entry* grown = realloc(entries, capacity * sizeof(cache_entry));
+			if(!grown)
+				break;
+			entries = grown;
+		}
+		if(!(entries[numof_entries].name = strdup(d->d_name)))
+			break;
+		entries[numof_entries].size = st.st_size;
+		entries[numof_entries].used = st.st_mtim;
+		total += st.st_size;
+		++numof_entries;
+	}
+
+	if(total > target) {
+		qsort(entries, numof_entries, sizeof(cache_entry), compare_use);
+		for(size_t i = 0; i < numof_entries && total > target; ++i) {
+			// Another thread or process may have removed it already
+			if(unlinkat(dirfd(dir), entries[i].name, 0) == 0 || errno == ENOENT)
+				total -= entries[i].size;
+		}
+	}
+	atomic_store(&cache->size, total);
+
+	closedir(dir);
+	for(size_t i = 0; i < numof_entries; ++i)
+		free(entries[i].name);
+	free(entries);
+}
+
+bool cache_open(decode_cache* cache, const char* dir, unsigned long long max_size) {
+	memset(cache, '\0', sizeof(decode_cache));
+	if(mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		perror("Could not create cache directory");
+		return false;
+	}
+	if(!(cache->dir = strdup(dir))) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	cache->max_size = max_size;
+	evict(cache, max_size);
+	return true;
+}
+
+void cache_close(decode_cache* cache) {
+	free(cache->dir);
+	cache->dir = NULL;
+}
+
+bool cache_key_of(int in_fd, file_format format, cache_key* key) {
+	struct stat st;
+	if(fstat(in_fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return false;
+	unsigned char tail[8] = {0};
+	size_t tail_len = (st.st_size < 8) ? st.st_size : 8;
+	if(pread(in_fd, tail, tail_len, st.st_size - tail_len) != (ssize_t)tail_len)
+		return false;
+
+	int len = snprintf(key->name, sizeof(key->name), "%llx-%llx-%llx-%lld.%09ld-%u-",
+		(unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+		(unsigned long long)st.st_size, (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, format);
+	for(unsigned i = 0; i < sizeof(tail); ++i)
+		len += snprintf(key->name + len, sizeof(key->name) - len, "%02x", tail[i]);
+	return true;
+}
+
+// Copy len bytes of in_fd from offset on to out_fd at its current offset. A whole
+// file going into an empty one is cloned where the file system shares extents
+// (btrfs, XFS), copy_file_range() still copies within the kernel, and sendfile()
+// also reaches other file systems and pipes.
+static bool copy_data(int in_fd, off_t offset, unsigned long long len, int out_fd) {
+	struct stat in_st, out_st;
+	if(offset == 0 && fstat(in_fd, &in_st) == 0 && (unsigned long long)in_st.st_size == len &&
+		fstat(out_fd, &out_st) == 0 && S_ISREG(out_st.st_mode) && out_st.st_size == 0 &&
+		ioctl(out_fd, FICLONE, in_fd) == 0)
+		return lseek(out_fd, len, SEEK_SET) >= 0;
+
+	bool use_sendfile = false;
+	while(len) {
+		size_t chunk = (len < (1u << 30)) ? len : (1u << 30);
+		ssize_t n;
+		if(!use_sendfile) {
+			n = copy_file_range(in_fd, &offset, out_fd, NULL, chunk, 0);
+			if(n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+				use_sendfile = true;
+				continue;
+			}
+		} else
+			n = sendfile(out_fd, in_fd, &offset, chunk);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		len -= n;
+	}
+	return true;
+}
+
+cache_result cache_fetch(
+	decode_cache* cache, const cache_key* key, int out_fd, unsigned long long* size) {
+	char* path = entry_path(cache, key->name);
+	int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+	free(path);
+	if(fd < 0)
+		return CACHE_MISS;
+
+	cache_result result = CACHE_MISS;
+	struct stat st;
+	if(fstat(fd, &st) == 0) {
+		if(copy_data(fd, 0, st.st_size, out_fd)) {
+			*size = st.st_size;
+			// The entry is now the most recently used one
+			futimens(fd, NULL);
+			result = CACHE_HIT;
+		} else {
+			perror("Could not copy from the cache");
+			result = CACHE_ERROR;
+		}
+	}
+	close(fd);
+	return result;
+}
+
+void cache_store(
+	decode_cache* cache, const cache_key* key, int fd, off_t offset, unsigned long long len) {
+	if(len > cache->max_size)
+		return;
+	char* temporary = entry_path(cache, TEMPORARY_NAME);
+	char* path = entry_path(cache, key->name);
+	int temporary_fd = (temporary && path) ? mkostemp(temporary, O_CLOEXEC) : -1;
+	if(temporary_fd >= 0) {
+		if(copy_data(fd, offset, len, temporary_fd) && rename(temporary, path) == 0) {
+			if(atomic_fetch_add(&cache->size, len) + len > cache->max_size)
+				evict(cache, cache->max_size / 10 * 9);
+		} else
+			unlink(temporary);
+		close(temporary_fd);
+	}
+	free(temporary);
+	free(path);
+}
@@ -0,0 +1,53 @@
+#ifndef LZIP_CACHE_H
+#define LZIP_CACHE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "gzip.h"
+
+// Decompressed data of earlier requests kept as files in a local directory, so
+// that decompressing the same input again is a reflink or a kernel-side copy
+// instead of a decode. Entries are named after the identity of the compressed
+// file (device, inode, size and mtime) together with its last eight bytes, which
+// hold the CRC32 and ISIZE of the last gzip member, so a file rewritten in place
+// never hits a stale entry.
+//
+// Entries are written to a temporary file first and renamed, so several threads
+// and processes can share a directory. A hit makes the entry the most recently
+// used one by setting its mtime. Once the entries exceed the size cap, the least
+// recently used ones are removed until they take up 90% of it.
+
+enum { CACHE_KEY_SIZE = 128, CACHE_DEFAULT_SIZE = 1 << 30 };
+
+typedef enum { CACHE_MISS, CACHE_HIT, CACHE_ERROR } cache_result;
+
+typedef struct {
+	char name[CACHE_KEY_SIZE];
+} cache_key;
+
+typedef struct {
+	char* dir;
+	unsigned long long max_size;
+	// Size of all entries as of the last scan plus what was stored since, entries
+	// of other processes are only noticed by the next scan
+	atomic_ullong size;
+} decode_cache;
+
+// The directory is created if it doesn't exist
+bool cache_open(decode_cache* cache, const char* dir, unsigned long long max_size);
+void cache_close(decode_cache* cache);
+
+// False if the input has no identity to go by, like a pipe
+bool cache_key_of(int in_fd, file_format format, cache_key* key);
+// Copy the entry to out_fd at its current offset. An error means that some of
+// it may have been written already.
+cache_result cache_fetch(
+	decode_cache* cache, const cache_key* key, int out_fd, unsigned long long* size);
+// Keep len bytes of fd from offset on as the entry for key. Nothing is stored if
+// fd can't be read, as for pipes or files opened for writing only.
+void cache_store(
+	decode_cache* cache, const cache_key* key, int fd, off_t offset, unsigned long long len);
+
+#endif
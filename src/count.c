@@ -0,0 +1,102 @@
+#include "count.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Eight bytes at a time: a byte of x is zero where the word matched, its top bit
+// is set in t exactly for those (carries can't cross bytes as the top bits are
+// masked off before the addition)
+static size_t count_generic(const unsigned char* data, size_t len, unsigned char byte) {
+	const uint64_t ones = 0x0101010101010101ull;
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+	size_t n = 0;
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		uint64_t x = word ^ (byte * ones);
+		uint64_t t = ~(((x & low7) + low7) | x) & ~low7;
+		n += ((t >> 7) * ones) >> 56;
+	}
+	for(; i < len; ++i)
+		n += data[i] == byte;
+	return n;
+}
+
+// Matches are subtracted as -1 from per-byte counters, which are summed up with
+// psadbw before any of them can overflow
+#if defined(__SSE2__)
+static size_t count_sse2(const unsigned char* data, size_t len, unsigned char byte) {
+	const __m128i needle = _mm_set1_epi8(byte);
+	const __m128i zero = _mm_setzero_si128();
+	size_t n = 0;
+	size_t i = 0;
+	while(i + 16 <= len) {
+		__m128i counts = zero;
+		for(unsigned j = 0; j < 255 && i + 16 <= len; ++j, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(v, needle));
+		}
+		__m128i sums = _mm_sad_epu8(counts, zero);
+		n += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+	return n + count_generic(data + i, len - i, byte);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t count_avx2(
+	const unsigned char* data, size_t len, unsigned char byte) {
+	const __m256i needle = _mm256_set1_epi8(byte);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t n = 0;
+	size_t i = 0;
+	while(i + 32 <= len) {
+		__m256i counts = zero;
+		for(unsigned j = 0; j < 255 && i + 32 <= len; ++j, i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(v, needle));
+		}
+		__m256i sums = _mm256_sad_epu8(counts, zero);
+		__m128i halves =
+			_mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		n += _mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4);
+	}
+	return n + count_generic(data + i, len - i, byte);
+}
+#endif
+
+const byte_count_kernel* byte_count_select(void) {
+	static const byte_count_kernel generic = {"generic", count_generic};
+	unsigned features = cpu_features();
+	(void)features;
+#if defined(__x86_64__) || defined(__i386__)
+	static const byte_count_kernel avx2 = {"avx2", count_avx2};
+	if(features & CPU_AVX2)
+		return &avx2;
+#endif
+#if defined(__SSE2__)
+	static const byte_count_kernel sse2 = {"sse2", count_sse2};
+	return &sse2;
+#endif
+	return &generic;
+}
+
+void record_counter_init(record_counter* counter, unsigned char delimiter) {
+	memset(counter, '\0', sizeof(record_counter));
+	counter->count = byte_count_select()->count;
+	counter->delimiter = delimiter;
+}
+
+bool record_counter_write(void* opaque, const unsigned char* data, size_t len) {
+	record_counter* counter = opaque;
+	counter->numof_records += counter->count(data, len, counter->delimiter);
+	counter->numof_bytes += len;
+	return true;
+}
@@ -0,0 +1,31 @@
+#ifndef LZIP_COUNT_H
+#define LZIP_COUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of occurrences of byte in data
+typedef size_t (*byte_count_fn)(const unsigned char* data, size_t len, unsigned char byte);
+
+typedef struct {
+	const char* name;
+	byte_count_fn count;
+} byte_count_kernel;
+
+// Pick the kernel for this CPU, the result should be kept by the caller
+const byte_count_kernel* byte_count_select(void);
+
+// Counts records ending in the delimiter, like wc -l does for lines, in data
+// passing through without keeping any of it
+typedef struct {
+	byte_count_fn count;
+	unsigned char delimiter;
+	unsigned long long numof_records;
+	unsigned long long numof_bytes;
+} record_counter;
+
+void record_counter_init(record_counter* counter, unsigned char delimiter);
+// inflate_sink taking the next piece of data
+bool record_counter_write(void* opaque, const unsigned char* data, size_t len);
+
+#endif
@@ -0,0 +1,59 @@
+#include "cpu.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+static unsigned detect_features(void) {
+	unsigned features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	if(ecx & bit_PCLMUL)
+		features |= CPU_PCLMUL;
+	if(ecx & bit_SSE4_1)
+		features |= CPU_SSE41;
+
+	// The wide registers are only usable if the OS saves them on context switches
+	if(!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return features;
+	unsigned xcr0, xcr0_high;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+	bool ymm_enabled = (xcr0 & 0x06) == 0x06;
+	bool zmm_enabled = (xcr0 & 0xe6) == 0xe6;
+
+	if(__get_cpuid_max(0, NULL) < 7)
+		return features;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if(ymm_enabled && (ebx & bit_AVX2))
+		features |= CPU_AVX2;
+	if(zmm_enabled && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW))
+		features |= CPU_AVX512BW;
+#elif defined(__aarch64__) && defined(__linux__)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+	if(hwcap & HWCAP_CRC32)
+		features |= CPU_ARM_CRC32;
+#endif
+	return features;
+}
+
+unsigned cpu_features(void) {
+	static atomic_int cached = -1;
+	int features = atomic_load_explicit(&cached, memory_order_relaxed);
+	if(features < 0) {
+		features = detect_features();
+		const char* mask = getenv("LZIP_CPU_MASK");
+		if(mask)
+			features &= strtoul(mask, NULL, 0);
+		atomic_store_explicit(&cached, features, memory_order_relaxed);
+	}
+	return features;
+}
@@ -0,0 +1,17 @@
+#ifndef LZIP_CPU_H
+#define LZIP_CPU_H
+
+// Instruction set extensions the SIMD kernels are selected by
+enum {
+	CPU_PCLMUL = 1 << 0,
+	CPU_SSE41 = 1 << 1,
+	CPU_AVX2 = 1 << 2,
+	CPU_AVX512BW = 1 << 3,
+	CPU_ARM_CRC32 = 1 << 4
+};
+
+// Features of the running CPU (and enabled by the OS), detected on first use.
+// LZIP_CPU_MASK in the environment is and-ed in to try the fallbacks.
+unsigned cpu_features(void);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef LZIP_CRC32_H
+#define LZIP_CRC32_H
+
+#include <stddef.h>
+
+// Update a running CRC-32 (as used by the gzip trailer) with len bytes of buf.
+// Start with a crc of 0.
+unsigned long crc32_update(unsigned long crc, const unsigned char* buf, size_t len);
+// Name of the implementation picked for this CPU
+const char* crc32_kernel_name(void);
+
+#endif
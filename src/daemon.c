@@ -0,0 +1,467 @@
+// accept4 and MSG_CMSG_CLOEXEC are Linux specific
+#define _GNU_SOURCE
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "adler32.h"
+#include "bytes.h"
+#include "cache.h"
+#include "crc32.h"
+#include "gzip.h"
+#include "inflate.h"
+
+// Every connection and the listening socket are armed with EPOLLONESHOT, so the
+// workers can all wait on the same epoll instance and each event goes to exactly
+// one of them. A connection is re-armed once its request has been answered.
+typedef struct {
+	int listen_fd;
+	int epoll_fd;
+	// Becomes readable when the daemon shuts down and stays so, waking every worker
+	int stop_fd;
+	decode_cache* cache;
+} server;
+
+typedef struct {
+	server* server;
+	pthread_t thread;
+	inflate_state state;
+} server_worker;
+
+// Decompressed data on its way to the client's descriptor
+typedef struct {
+	file_format format;
+	int fd;
+	unsigned long check;
+	bool write_failed;
+	// Counts the members and their data
+	lzipd_reply* reply;
+} request_output;
+
+static bool output_write(void* opaque, const unsigned char* data, size_t len) {
+	request_output* out = opaque;
+	if(out->format == FORMAT_GZIP)
+		out->check = crc32_update(out->check, data, len);
+	else if(out->format == FORMAT_ZLIB)
+		out->check = adler32_update(out->check, data, len);
+	while(out->fd >= 0 && len) {
+		ssize_t written = write(out->fd, data, len);
+		if(written < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("Error writing output");
+			out->write_failed = true;
+			return false;
+		}
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+static bool fail(lzipd_reply* reply, const char* error) {
+	snprintf(reply->error, sizeof(reply->error), "%s", error);
+	return false;
+}
+
+static void request_member_begin(void* opaque, unsigned member) {
+	(void)member;
+	request_output* out = opaque;
+	out->check = (out->format == FORMAT_ZLIB) ? 1 : 0;
+}
+
+static bool request_member_check(void* opaque, unsigned long* check) {
+	*check = ((request_output*)opaque)->check;
+	return true;
+}
+
+static void request_member_end(
+	void* opaque, unsigned member, const gzip_file* gzip, unsigned long long size) {
+	(void)member;
+	(void)gzip;
+	request_output* out = opaque;
+	++out->reply->numof_members;
+	out->reply->uncompressed_size += size;
+}
+
+// Strip the framing off the input and decompress every member to out_fd at its
+// current offset, like decompress_file() does without any of its options. Inputs
+// found in the cache are copied from there once their header has been read.
+static bool decode(inflate_state* state, FILE* in, file_format format, int out_fd,
+	decode_cache* cache, lzipd_reply* reply) {
+	request_output out = {format, out_fd, 0, false, reply};
+	member_hooks hooks = {request_member_begin, request_member_check, request_member_end, &out};
+	gzip_file gzip;
+	bool success = false;
+	cache_key key;
+	bool use_cache = cache && out_fd >= 0 && cache_key_of(fileno(in), format, &key);
+	// Pipes have no offset, their output can't be read back for the cache
+	off_t start = use_cache ? lseek(out_fd, 0, SEEK_CUR) : -1;
+
+	memset(&gzip, '\0', sizeof(gzip));
+	if(!bit_stream_reopen_file(&state->stream, in))
+		return fail(reply, "Out of memory");
+	state->sink = output_write;
+	state->opaque = &out;
+
+	if(format == FORMAT_GZIP) {
+		if(!read_gzip_header(&state->stream, &gzip)) {
+			fail(reply, members_error(MEMBERS_BAD_HEADER, format));
+			goto done;
+		}
+		reply->mtime = load_le32(gzip.header.mtime);
+		if(gzip.fname && strlen(gzip.fname) < sizeof(reply->fname))
+			strcpy(reply->fname, gzip.fname);
+	} else if(format == FORMAT_ZLIB && !read_zlib_header(&state->stream)) {
+		fail(reply, members_error(MEMBERS_BAD_HEADER, format));
+		goto done;
+	}
+	if(use_cache) {
+		cache_result result = cache_fetch(cache, &key, out_fd, &reply->uncompressed_size);
+		if(result == CACHE_ERROR) {
+			fail(reply, "Error copying from the cache");
+			goto done;
+		}
+		if(result == CACHE_HIT) {
+			reply->cached = true;
+			success = true;
+			goto done;
+		}
+	}
+
+	members_result result = decode_members(state, format, &gzip, &hooks);
+	if(result != MEMBERS_OK && result != MEMBERS_TRAILING_GARBAGE) {
+		bool write_failed = result == MEMBERS_BAD_DATA && out.write_failed;
+		fail(reply, write_failed ? "Error writing output" : members_error(result, format));
+		goto done;
+	}
+	if(start >= 0)
+		cache_store(cache, &key, out_fd, start, reply->uncompressed_size);
+	success = true;
+
+done:
+	free_gzip_file(&gzip);
+	return success;
+}
+
+// Receive the next request of a connection and answer it. False if the
+// connection is to be closed, as the client hung up or broke the protocol.
+static bool serve_request(server_worker* worker, int connection) {
+	lzipd_request request;
+	lzipd_reply reply;
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct iovec iov = {&request, sizeof(request)};
+	struct msghdr msg;
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t len = recvmsg(connection, &msg, MSG_CMSG_CLOEXEC);
+	if(len <= 0)
+		return false;
+
+	// Descriptors beyond the two a request can have are dropped right away
+	int fds[2];
+	unsigned numof_fds = 0;
+	for(struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+			continue;
+		for(size_t i = 0; i < (c->cmsg_len - CMSG_LEN(0)) / sizeof(int); ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+			if(numof_fds < 2)
+				fds[numof_fds] = fd;
+			else
+				close(fd);
+			++numof_fds;
+		}
+	}
+
+	memset(&reply, '\0', sizeof(reply));
+	reply.version = LZIPD_VERSION;
+	bool has_input = request.flags & LZIPD_INPUT_FD;
+	bool test = request.flags & LZIPD_TEST;
+	if(len != sizeof(request) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+		request.version != LZIPD_VERSION || request.format > FORMAT_RAW ||
+		numof_fds != (unsigned)has_input + !test ||
+		(!has_input && !memchr(request.path, '\0', sizeof(request.path)))) {
+		for(unsigned i = 0; i < numof_fds && i < 2; ++i)
+			close(fds[i]);
+		fail(&reply, "Malformed request");
+		send(connection, &reply, sizeof(reply), MSG_NOSIGNAL);
+		return false;
+	}
+
+	int in_fd = has_input ? fds[0] : open(request.path, O_RDONLY | O_CLOEXEC);
+	int out_fd = test ? -1 : fds[has_input];
+	FILE* in = (in_fd >= 0) ? fdopen(in_fd, "r") : NULL;
+	if(!in) {
+		snprintf(reply.error, sizeof(reply.error), "Unable to open the input: %s", strerror(errno));
+		if(in_fd >= 0)
+			close(in_fd);
+	} else {
+		posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		reply.success = decode(
+			&worker->state, in, request.format, out_fd, worker->server->cache, &reply);
+		fclose(in);
+	}
+	if(out_fd >= 0)
+		close(out_fd);
+
+	return send(connection, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply);
+}
+
+static bool watch(server* s, int fd, int op) {
+	struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.fd = fd}};
+	if(epoll_ctl(s->epoll_fd, op, fd, &event) < 0) {
+		perror("Could not watch connection");
+		return false;
+	}
+	return true;
+}
+
+static void accept_connections(server* s) {
+	for(;;) {
+		int fd = accept4(s->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("Could not accept connection");
+			break;
+		}
+		if(!watch(s, fd, EPOLL_CTL_ADD))
+			close(fd);
+	}
+	watch(s, s->listen_fd, EPOLL_CTL_MOD);
+}
+
+static void* worker_thread(void* opaque) {
+	server_worker* worker = opaque;
+	server* s = worker->server;
+	for(;;) {
+		struct epoll_event event;
+		int n = epoll_wait(s->epoll_fd, &event, 1, -1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0) {
+			perror("Could not wait for requests");
+			break;
+		}
+
+		int fd = event.data.fd;
+		if(fd == s->stop_fd)
+			break;
+		if(fd == s->listen_fd)
+			accept_connections(s);
+		else if(!(event.events & EPOLLIN) || !serve_request(worker, fd) ||
+			!watch(s, fd, EPOLL_CTL_MOD))
+			close(fd);
+	}
+	return NULL;
+}
+
+static bool socket_address(const char* path, struct sockaddr_un* addr) {
+	memset(addr, '\0', sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "Socket path '%s' is too long.\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+// A socket nobody answers on is left over from a daemon that is gone
+static bool remove_stale_socket(const char* path, const struct sockaddr_un* addr) {
+	struct stat st;
+	if(lstat(path, &st) < 0 || !S_ISSOCK(st.st_mode))
+		return true;
+	int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(probe < 0)
+		return true;
+	bool stale = connect(probe, (const struct sockaddr*)addr, sizeof(struct sockaddr_un)) < 0 &&
+		errno == ECONNREFUSED;
+	close(probe);
+	if(!stale) {
+		fprintf(stderr, "Another daemon is listening on '%s'.\n", path);
+		return false;
+	}
+	unlink(path);
+	return true;
+}
+
+static int listen_on(const char* path) {
+	struct sockaddr_un addr;
+	if(!socket_address(path, &addr) || !remove_stale_socket(path, &addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(fd < 0) {
+		perror("Could not create socket");
+		return -1;
+	}
+	// The socket is created with the permissions the umask leaves
+	mode_t mask = umask(0177);
+	int bound = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+	if(bound < 0 || listen(fd, SOMAXCONN) < 0) {
+		perror("Could not listen on socket");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool lzipd_serve(const char* socket_path, unsigned numof_threads, decode_cache* cache) {
+	server s = {-1, -1, -1, cache};
+	server_worker* workers = calloc(numof_threads, sizeof(server_worker));
+	unsigned numof_decoders = 0;
+	unsigned numof_started = 0;
+	bool success = false;
+
+	// Signals are only taken by sigwait() below, the workers never see them. A
+	// client going away mustn't kill the daemon either.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(!workers) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	// The decoders are all set up before the first request arrives
+	for(; numof_decoders < numof_threads; ++numof_decoders) {
+		server_worker* worker = &workers[numof_decoders];
+		worker->server = &s;
+		if(!inflate_init(&worker->state, output_write, NULL) ||
+			!bit_stream_open_file(&worker->state.stream, NULL)) {
+			inflate_end(&worker->state);
+			fprintf(stderr, "Out of memory.\n");
+			goto done;
+		}
+	}
+
+	if((s.listen_fd = listen_on(socket_path)) < 0)
+		goto done;
+	s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	s.stop_fd = eventfd(0, EFD_CLOEXEC);
+	struct epoll_event stop = {EPOLLIN, {.fd = s.stop_fd}};
+	if(s.epoll_fd < 0 || s.stop_fd < 0 || epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.stop_fd, &stop) < 0 ||
+		!watch(&s, s.listen_fd, EPOLL_CTL_ADD)) {
+		perror("Could not set up epoll");
+		goto done;
+	}
+
+	for(; numof_started < numof_threads; ++numof_started) {
+		if(pthread_create(&workers[numof_started].thread, NULL, worker_thread, &workers[numof_started]))
+			break;
+	}
+	if(!numof_started) {
+		fprintf(stderr, "Could not start any threads.\n");
+		goto done;
+	}
+	fprintf(stderr, "Listening on '%s' with %u threads\n", socket_path, numof_started);
+
+	int signal_number;
+	sigwait(&signals, &signal_number);
+	// Requests being decoded are finished first
+	eventfd_write(s.stop_fd, 1);
+	success = true;
+
+done:
+	for(unsigned i = 0; i < numof_started; ++i)
+		pthread_join(workers[i].thread, NULL);
+	for(unsigned i = 0; i < numof_decoders; ++i) {
+		bit_stream_close(&workers[i].state.stream);
+		inflate_end(&workers[i].state);
+	}
+	free(workers);
+	if(s.listen_fd >= 0) {
+		close(s.listen_fd);
+		unlink(socket_path);
+	}
+	if(s.epoll_fd >= 0)
+		close(s.epoll_fd);
+	if(s.stop_fd >= 0)
+		close(s.stop_fd);
+	return success;
+}
+
+int lzipd_connect(const char* socket_path) {
+	struct sockaddr_un addr;
+	if(!socket_address(socket_path, &addr))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0 || connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("Could not connect to lzipd");
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool lzipd_call(int connection, const lzipd_request* request, int in_fd, int out_fd,
+	lzipd_reply* reply) {
+	int fds[2];
+	unsigned numof_fds = 0;
+	if(in_fd >= 0)
+		fds[numof_fds++] = in_fd;
+	if(out_fd >= 0)
+		fds[numof_fds++] = out_fd;
+
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct iovec iov = {(void*)request, sizeof(lzipd_request)};
+	struct msghdr msg;
+	memset(&control, '\0', sizeof(control));
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if(numof_fds) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(numof_fds * sizeof(int));
+		struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(numof_fds * sizeof(int));
+		memcpy(CMSG_DATA(c), fds, numof_fds * sizeof(int));
+	}
+
+	if(sendmsg(connection, &msg, MSG_NOSIGNAL) != sizeof(lzipd_request)) {
+		perror("Could not send request to lzipd");
+		return false;
+	}
+	if(recv(connection, reply, sizeof(lzipd_reply), 0) != sizeof(lzipd_reply) ||
+		reply->version != LZIPD_VERSION) {
+		fprintf(stderr, "No valid reply from lzipd.\n");
+		return false;
+	}
+	reply->fname[sizeof(reply->fname) - 1] = '\0';
+	reply->error[sizeof(reply->error) - 1] = '\0';
+	return true;
+}
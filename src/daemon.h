@@ -0,0 +1,71 @@
+#ifndef LZIP_DAEMON_H
+#define LZIP_DAEMON_H
+
+#include <stdbool.h>
+
+#include "cache.h"
+
+// lzipd decompresses on behalf of other processes on the host. It listens on a
+// Unix domain socket (SOCK_SEQPACKET) and keeps a pool of threads, each with a
+// decoder that is set up once, so short-lived clients neither pay for starting
+// a decoder nor have to bring their own threads.
+//
+// Every request is a single message with an lzipd_request. The compressed input
+// is either a descriptor sent along with SCM_RIGHTS or a path the daemon opens
+// itself. The decompressed data is written to a second descriptor, typically a
+// memfd the client maps afterwards, or any other file or pipe. A connection may
+// carry any number of requests one after another, each answered by an
+// lzipd_reply. Requests of different connections are served in parallel.
+//
+// With a cache, inputs the daemon has decompressed before are copied from there.
+// Their output is only kept if the daemon can read it back from the output
+// descriptor, which is the case for memfds and files opened for reading and
+// writing, but not for pipes.
+
+enum { LZIPD_VERSION = 1, LZIPD_MAX_PATH = 4096, LZIPD_MAX_NAME = 256, LZIPD_MAX_ERROR = 128 };
+
+enum {
+	// The first descriptor sent along is the input, otherwise path is opened
+	LZIPD_INPUT_FD = 1,
+	// Decode and check only, no output descriptor is sent
+	LZIPD_TEST = 2
+};
+
+typedef struct {
+	unsigned version;
+	// A file_format
+	unsigned format;
+	unsigned flags;
+	char path[LZIPD_MAX_PATH];
+} lzipd_request;
+
+typedef struct {
+	unsigned version;
+	bool success;
+	// Copied from the cache, the members weren't counted then
+	bool cached;
+	unsigned numof_members;
+	unsigned long long uncompressed_size;
+	// MTIME and FNAME of the first gzip member, fname is empty if there is none or
+	// it doesn't fit
+	unsigned long mtime;
+	char fname[LZIPD_MAX_NAME];
+	// Why the request failed, details end up on the daemon's stderr
+	char error[LZIPD_MAX_ERROR];
+} lzipd_reply;
+
+// Serve requests on numof_threads threads until SIGINT, SIGTERM or SIGHUP. A
+// stale socket left behind by a daemon that is gone is replaced. The socket is
+// only accessible to the daemon's user, as it reads paths with its permissions.
+// The cache may be NULL.
+bool lzipd_serve(const char* socket_path, unsigned numof_threads, decode_cache* cache);
+
+// A connection to the daemon, -1 on errors
+int lzipd_connect(const char* socket_path);
+// Send a request with its descriptors (-1 where there is none) and wait for the
+// reply. False only if the daemon couldn't be talked to, the outcome of the
+// request itself is in the reply.
+bool lzipd_call(int connection, const lzipd_request* request, int in_fd, int out_fd,
+	lzipd_reply* reply);
+
+#endif
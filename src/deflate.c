@@ -0,0 +1,1190 @@
+#include "deflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	WINDOW_SIZE = 32768,
+	WINDOW_MASK = WINDOW_SIZE - 1,
+	MIN_MATCH = 3,
+	MAX_MATCH = 258,
+	// Keep enough lookahead around to extend any match to MAX_MATCH
+	MIN_LOOKAHEAD = MAX_MATCH + MIN_MATCH + 1,
+	// Matches must not reach into the part of the window that is slid out next
+	MAX_DIST = WINDOW_SIZE - MIN_LOOKAHEAD,
+	// Length 3 matches further away than this usually cost more than the literals
+	TOO_FAR = 4096,
+	HASH_BITS = 15,
+	HASH_SIZE = 1 << HASH_BITS,
+	SYMBOL_BUF_SIZE = 32768,
+	NUMOF_LITLEN_SYMBOLS = 286,
+	NUMOF_DIST_SYMBOLS = 30,
+	NUMOF_CODELEN_SYMBOLS = 19,
+	MAX_CODE_LENGTH = 15,
+	MAX_CODELEN_LENGTH = 7,
+	END_OF_BLOCK = 256,
+	// Block splitting
+	MIN_BLOCK_LENGTH = 10000,
+	OBSERVATIONS_PER_CHECK = 512,
+	// Optimal parsing
+	OPT_MAX_BLOCK_LENGTH = SYMBOL_BUF_SIZE,
+	OPT_CACHE_SIZE = OPT_MAX_BLOCK_LENGTH * 8,
+	// A block ends once there is no room for a piece this long in its symbols
+	OPT_MIN_PIECE_LENGTH = OPT_MAX_BLOCK_LENGTH / 4,
+	UNUSED_SYMBOL_COST = 13,
+};
+
+enum { BLOCK_STORED = 0, BLOCK_FIXED = 1, BLOCK_DYNAMIC = 2 };
+
+static const level_config configs[MAX_LEVEL + 1] = {
+	{STRATEGY_STORED, 0, 0, 0, 0, 0},
+	{STRATEGY_FAST, 0, 0, 0, 0, 0},
+	{STRATEGY_GREEDY, 4, 5, 16, 8, 0},
+	{STRATEGY_GREEDY, 4, 6, 32, 32, 0},
+	{STRATEGY_LAZY, 4, 4, 16, 16, 0},
+	{STRATEGY_LAZY, 8, 16, 32, 32, 0},
+	{STRATEGY_LAZY, 8, 16, 128, 128, 0},
+	{STRATEGY_LAZY, 8, 32, 128, 256, 0},
+	{STRATEGY_LAZY, 32, 128, 258, 1024, 0},
+	{STRATEGY_LAZY, 32, 258, 258, 4096, 0},
+	{STRATEGY_OPTIMAL, 32, 0, 258, 4096, 2},
+	{STRATEGY_OPTIMAL, 64, 0, 258, 4096, 3},
+	{STRATEGY_OPTIMAL, 258, 0, 258, 8192, 3},
+};
+
+// see RFC 1951 section 3.2.5
+static const unsigned short length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15,
+	17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+	2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+	65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193,
+	12289, 16385, 24577};
+static const unsigned char dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+	6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// see RFC 1951 section 3.2.7
+static const unsigned char codelen_order[NUMOF_CODELEN_SYMBOLS] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static unsigned length_symbol(unsigned length) {
+	unsigned x = length - MIN_MATCH;
+	if(x < 8)
+		return 257 + x;
+	if(x == MAX_MATCH - MIN_MATCH)
+		return 285;
+	// Every further group of four symbols doubles the covered range
+	unsigned n = 31 - __builtin_clz(x);
+	return 257 + 4 * (n - 1) + ((x >> (n - 2)) & 3);
+}
+
+static unsigned dist_symbol(unsigned dist) {
+	unsigned x = dist - 1;
+	if(x < 4)
+		return x;
+	unsigned n = 31 - __builtin_clz(x);
+	return 2 * n + ((x >> (n - 1)) & 1);
+}
+
+static bool writer_reserve(bit_writer* w, size_t n) {
+	if(w->cap - w->len >= n)
+		return true;
+
+	size_t cap = w->cap ? w->cap : 4096;
+	while(cap - w->len < n)
+		cap *= 2;
+	unsigned char* buf = realloc(w->buf, cap);
+	if(!buf)
+		return false;
+	w->buf = buf;
+	w->cap = cap;
+	return true;
+}
+
+// The caller has to reserve enough space beforehand. Whole 32-bit words are written
+// out at once, so up to 31 bits may stay pending in the accumulator.
+static inline void put_bits(bit_writer* w, unsigned value, unsigned numof_bits) {
+	w->bits |= (unsigned long long)value << w->numof_bits;
+	w->numof_bits += numof_bits;
+	if(w->numof_bits >= 32) {
+		unsigned char* p = w->buf + w->len;
+		p[0] = w->bits & 0xff;
+		p[1] = (w->bits >> 8) & 0xff;
+		p[2] = (w->bits >> 16) & 0xff;
+		p[3] = (w->bits >> 24) & 0xff;
+		w->len += 4;
+		w->bits >>= 32;
+		w->numof_bits -= 32;
+	}
+}
+
+// Pad to a byte boundary and write out everything that is pending
+static void align_to_byte(bit_writer* w) {
+	w->numof_bits = (w->numof_bits + 7) & ~7u;
+	while(w->numof_bits) {
+		w->buf[w->len++] = w->bits & 0xff;
+		w->bits >>= 8;
+		w->numof_bits -= 8;
+	}
+}
+
+static unsigned reverse_bits(unsigned code, unsigned numof_bits) {
+	unsigned reversed = 0;
+	while(numof_bits--) {
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+static int compare_keys(const void* lhs, const void* rhs) {
+	unsigned long long a = *(const unsigned long long*)lhs;
+	unsigned long long b = *(const unsigned long long*)rhs;
+	return (a > b) - (a < b);
+}
+
+// Compute Huffman code lengths that are no longer than max_length. The resulting code
+// is always complete, which means at least two symbols get a code.
+static void build_code_lengths(const unsigned* freq, unsigned numof_symbols,
+	unsigned max_length, unsigned char* lengths) {
+	unsigned long long keys[NUMOF_LITLEN_SYMBOLS];
+	unsigned weight[2 * NUMOF_LITLEN_SYMBOLS];
+	unsigned parent[2 * NUMOF_LITLEN_SYMBOLS];
+	unsigned depth[2 * NUMOF_LITLEN_SYMBOLS];
+	unsigned numof_codes_per_length[NUMOF_LITLEN_SYMBOLS];
+	unsigned n = 0;
+
+	memset(lengths, '\0', numof_symbols);
+	for(unsigned i = 0; i < numof_symbols; ++i) {
+		if(freq[i])
+			keys[n++] = ((unsigned long long)freq[i] << 16) | i;
+	}
+
+	if(n < 2) {
+		unsigned used = n ? keys[0] & 0xffff : 0;
+		lengths[used] = 1;
+		lengths[used ? 0 : 1] = 1;
+		return;
+	}
+
+	// Leaves are sorted by frequency, internal nodes are created in order of their
+	// weight, so the two lightest nodes are always at the front of either queue
+	qsort(keys, n, sizeof(keys[0]), compare_keys);
+	for(unsigned i = 0; i < n; ++i)
+		weight[i] = keys[i] >> 16;
+
+	unsigned next_leaf = 0;
+	unsigned next_node = n;
+	for(unsigned node = n; node < 2 * n - 1; ++node) {
+		unsigned children[2];
+		for(unsigned c = 0; c < 2; ++c) {
+			if(next_leaf < n && (next_node == node || weight[next_leaf] <= weight[next_node]))
+				children[c] = next_leaf++;
+			else
+				children[c] = next_node++;
+		}
+		weight[node] = weight[children[0]] + weight[children[1]];
+		parent[children[0]] = node;
+		parent[children[1]] = node;
+	}
+
+	// Parents always come after their children, so walk down from the root
+	depth[2 * n - 2] = 0;
+	for(unsigned i = 2 * n - 2; i-- > 0;)
+		depth[i] = depth[parent[i]] + 1;
+
+	memset(numof_codes_per_length, '\0', sizeof(unsigned) * (max_length + 1));
+	for(unsigned i = 0; i < n; ++i)
+		++numof_codes_per_length[depth[i] > max_length ? max_length : depth[i]];
+
+	// Clamping the overlong codes breaks the Kraft inequality. Push the deepest codes
+	// below max_length further down until it holds again and then use up any slack by
+	// pulling codes up again.
+	unsigned long kraft_sum = 0;
+	for(unsigned bits = 1; bits <= max_length; ++bits)
+		kraft_sum += (unsigned long)numof_codes_per_length[bits] << (max_length - bits);
+	while(kraft_sum > (1ul << max_length)) {
+		unsigned bits = max_length - 1;
+		while(!numof_codes_per_length[bits])
+			--bits;
+		--numof_codes_per_length[bits];
+		++numof_codes_per_length[bits + 1];
+		kraft_sum -= 1ul << (max_length - bits - 1);
+	}
+	while(kraft_sum < (1ul << max_length)) {
+		unsigned bits = max_length;
+		while(!numof_codes_per_length[bits] ||
+			(1ul << (max_length - bits)) > (1ul << max_length) - kraft_sum)
+			--bits;
+		--numof_codes_per_length[bits];
+		++numof_codes_per_length[bits - 1];
+		kraft_sum += 1ul << (max_length - bits);
+	}
+
+	// The least frequent symbols get the longest codes
+	unsigned leaf = 0;
+	for(unsigned bits = max_length; bits; --bits) {
+		for(unsigned i = numof_codes_per_length[bits]; i; --i)
+			lengths[keys[leaf++] & 0xffff] = bits;
+	}
+}
+
+// Assign canonical codes (see RFC 1951 section 3.2.2), reversed for LSB-first output
+static void build_codes(
+	const unsigned char* lengths, unsigned numof_symbols, unsigned short* codes) {
+	unsigned numof_codes_per_length[MAX_CODE_LENGTH + 1];
+	unsigned next_code[MAX_CODE_LENGTH + 1];
+
+	memset(numof_codes_per_length, '\0', sizeof(numof_codes_per_length));
+	for(unsigned i = 0; i < numof_symbols; ++i)
+		++numof_codes_per_length[lengths[i]];
+	numof_codes_per_length[0] = 0;
+
+	unsigned code = 0;
+	for(unsigned bits = 1; bits <= MAX_CODE_LENGTH; ++bits) {
+		code = (code + numof_codes_per_length[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+
+	for(unsigned i = 0; i < numof_symbols; ++i) {
+		if(lengths[i])
+			codes[i] = reverse_bits(next_code[lengths[i]]++, lengths[i]);
+	}
+}
+
+static void fixed_code_lengths(unsigned char* litlen_lengths, unsigned char* dist_lengths) {
+	memset(litlen_lengths, 8, 144);
+	memset(litlen_lengths + 144, 9, 256 - 144);
+	memset(litlen_lengths + 256, 7, 280 - 256);
+	memset(litlen_lengths + 280, 8, 288 - 280);
+	memset(dist_lengths, 5, 32);
+}
+
+// Everything needed to write the header of a dynamic block, which is the inverse of
+// what read_dynamic_huffman_tree() consumes
+typedef struct {
+	unsigned char litlen_lengths[NUMOF_LITLEN_SYMBOLS];
+	unsigned char dist_lengths[NUMOF_DIST_SYMBOLS];
+	unsigned hlit;
+	unsigned hdist;
+	unsigned hclen;
+	// Run-length encoded code lengths of both alphabets (see 3.2.7)
+	unsigned char rle_symbols[NUMOF_LITLEN_SYMBOLS + NUMOF_DIST_SYMBOLS];
+	unsigned char rle_extra[NUMOF_LITLEN_SYMBOLS + NUMOF_DIST_SYMBOLS];
+	unsigned numof_rle;
+	unsigned codelen_freq[NUMOF_CODELEN_SYMBOLS];
+	unsigned char codelen_lengths[NUMOF_CODELEN_SYMBOLS];
+} dynamic_header;
+
+static void push_rle(dynamic_header* h, unsigned symbol, unsigned extra) {
+	h->rle_symbols[h->numof_rle] = symbol;
+	h->rle_extra[h->numof_rle] = extra;
+	++h->numof_rle;
+	++h->codelen_freq[symbol];
+}
+
+static void build_dynamic_header(
+	dynamic_header* h, const unsigned* litlen_freq, const unsigned* dist_freq) {
+	unsigned char lengths[NUMOF_LITLEN_SYMBOLS + NUMOF_DIST_SYMBOLS];
+
+	build_code_lengths(litlen_freq, NUMOF_LITLEN_SYMBOLS, MAX_CODE_LENGTH, h->litlen_lengths);
+	build_code_lengths(dist_freq, NUMOF_DIST_SYMBOLS, MAX_CODE_LENGTH, h->dist_lengths);
+
+	for(h->hlit = NUMOF_LITLEN_SYMBOLS; !h->litlen_lengths[h->hlit - 1]; --h->hlit)
+		;
+	for(h->hdist = NUMOF_DIST_SYMBOLS; h->hdist > 1 && !h->dist_lengths[h->hdist - 1];
+		--h->hdist)
+		;
+
+	// Runs may cross from one alphabet into the other
+	unsigned total = h->hlit + h->hdist;
+	memcpy(lengths, h->litlen_lengths, h->hlit);
+	memcpy(lengths + h->hlit, h->dist_lengths, h->hdist);
+
+	h->numof_rle = 0;
+	memset(h->codelen_freq, '\0', sizeof(h->codelen_freq));
+	for(unsigned i = 0; i < total;) {
+		unsigned value = lengths[i];
+		unsigned run = 1;
+		while(i + run < total && lengths[i + run] == value)
+			++run;
+		i += run;
+
+		if(!value) {
+			while(run >= 11) {
+				unsigned repeat = run > 138 ? 138 : run;
+				push_rle(h, 18, repeat - 11);
+				run -= repeat;
+			}
+			if(run >= 3) {
+				push_rle(h, 17, run - 3);
+				run = 0;
+			}
+		} else {
+			push_rle(h, value, 0);
+			--run;
+			while(run >= 3) {
+				unsigned repeat = run > 6 ? 6 : run;
+				push_rle(h, 16, repeat - 3);
+				run -= repeat;
+			}
+		}
+		while(run--)
+			push_rle(h, value, 0);
+	}
+
+	build_code_lengths(
+		h->codelen_freq, NUMOF_CODELEN_SYMBOLS, MAX_CODELEN_LENGTH, h->codelen_lengths);
+	for(h->hclen = NUMOF_CODELEN_SYMBOLS;
+		h->hclen > 4 && !h->codelen_lengths[codelen_order[h->hclen - 1]]; --h->hclen)
+		;
+}
+
+static unsigned long dynamic_header_cost(const dynamic_header* h) {
+	unsigned long cost = 5 + 5 + 4 + 3 * h->hclen;
+	for(unsigned i = 0; i < NUMOF_CODELEN_SYMBOLS; ++i)
+		cost += (unsigned long)h->codelen_freq[i] * h->codelen_lengths[i];
+	cost += 2 * h->codelen_freq[16] + 3 * h->codelen_freq[17] + 7 * h->codelen_freq[18];
+	return cost;
+}
+
+static void write_dynamic_header(bit_writer* w, const dynamic_header* h) {
+	unsigned short codelen_codes[NUMOF_CODELEN_SYMBOLS];
+	static const unsigned char rle_extra_bits[3] = {2, 3, 7};
+
+	build_codes(h->codelen_lengths, NUMOF_CODELEN_SYMBOLS, codelen_codes);
+
+	put_bits(w, h->hlit - 257, 5);
+	put_bits(w, h->hdist - 1, 5);
+	put_bits(w, h->hclen - 4, 4);
+	for(unsigned i = 0; i < h->hclen; ++i)
+		put_bits(w, h->codelen_lengths[codelen_order[i]], 3);
+
+	for(unsigned i = 0; i < h->numof_rle; ++i) {
+		unsigned symbol = h->rle_symbols[i];
+		put_bits(w, codelen_codes[symbol], h->codelen_lengths[symbol]);
+		if(symbol > 15)
+			put_bits(w, h->rle_extra[i], rle_extra_bits[symbol - 16]);
+	}
+}
+
+// Size of the block body in bits when coded with the given code lengths
+static unsigned long block_data_cost(const deflate_state* s,
+	const unsigned char* litlen_lengths, const unsigned char* dist_lengths) {
+	unsigned long cost = 0;
+	for(unsigned i = 0; i < NUMOF_LITLEN_SYMBOLS; ++i)
+		cost += (unsigned long)s->litlen_freq[i] * litlen_lengths[i];
+	for(unsigned i = 257; i < NUMOF_LITLEN_SYMBOLS; ++i)
+		cost += (unsigned long)s->litlen_freq[i] * length_extra[i - 257];
+	for(unsigned i = 0; i < NUMOF_DIST_SYMBOLS; ++i)
+		cost += (unsigned long)s->dist_freq[i] * (dist_lengths[i] + dist_extra[i]);
+	return cost;
+}
+
+static void write_symbols(deflate_state* s, const unsigned char* litlen_lengths,
+	const unsigned short* litlen_codes, const unsigned char* dist_lengths,
+	const unsigned short* dist_codes) {
+	bit_writer* w = &s->out;
+
+	for(unsigned i = 0; i < s->numof_symbols; ++i) {
+		unsigned dist = s->sym_dist[i];
+		if(!dist) {
+			unsigned literal = s->sym_litlen[i];
+			put_bits(w, litlen_codes[literal], litlen_lengths[literal]);
+			continue;
+		}
+
+		unsigned length = s->sym_litlen[i];
+		unsigned symbol = length_symbol(length);
+		put_bits(w, litlen_codes[symbol], litlen_lengths[symbol]);
+		put_bits(w, length - length_base[symbol - 257], length_extra[symbol - 257]);
+
+		symbol = dist_symbol(dist);
+		put_bits(w, dist_codes[symbol], dist_lengths[symbol]);
+		put_bits(w, dist - dist_base[symbol], dist_extra[symbol]);
+	}
+	put_bits(w, litlen_codes[END_OF_BLOCK], litlen_lengths[END_OF_BLOCK]);
+}
+
+static void write_stored_blocks(
+	bit_writer* w, const unsigned char* data, unsigned len, bool last) {
+	do {
+		unsigned chunk = len > 65535 ? 65535 : len;
+		len -= chunk;
+
+		put_bits(w, ((last && !len) ? 1 : 0) | (BLOCK_STORED << 1), 3);
+		align_to_byte(w);
+		put_bits(w, chunk, 16);
+		put_bits(w, ~chunk & 0xffff, 16);
+		if(chunk) {
+			memcpy(w->buf + w->len, data, chunk);
+			w->len += chunk;
+			data += chunk;
+		}
+	} while(len);
+}
+
+// Write the current block in whatever representation is the smallest
+static bool flush_block(deflate_state* s, bool last) {
+	bit_writer* w = &s->out;
+	dynamic_header header;
+	unsigned char fixed_litlen_lengths[288];
+	unsigned char fixed_dist_lengths[32];
+	unsigned short litlen_codes[288];
+	unsigned short dist_codes[32];
+
+	if(!writer_reserve(w, 2 * (size_t)s->block_length + 1024))
+		return false;
+
+	bool can_store = s->block_start >= 0;
+	unsigned long stored_cost = ~0ul;
+	if(can_store)
+		stored_cost = 8 * (5 * (s->block_length / 65535 + 1) + (unsigned long)s->block_length);
+
+	if(s->config.strategy == STRATEGY_STORED) {
+		write_stored_blocks(w, s->window + s->block_start, s->block_length, last);
+	} else {
+		++s->litlen_freq[END_OF_BLOCK];
+
+		fixed_code_lengths(fixed_litlen_lengths, fixed_dist_lengths);
+		unsigned long fixed_cost =
+			3 + block_data_cost(s, fixed_litlen_lengths, fixed_dist_lengths);
+		build_dynamic_header(&header, s->litlen_freq, s->dist_freq);
+		unsigned long dynamic_cost = 3 + dynamic_header_cost(&header) +
+			block_data_cost(s, header.litlen_lengths, header.dist_lengths);
+
+		if(stored_cost < fixed_cost && stored_cost < dynamic_cost) {
+			write_stored_blocks(w, s->window + s->block_start, s->block_length, last);
+		} else if(fixed_cost <= dynamic_cost) {
+			put_bits(w, (last ? 1 : 0) | (BLOCK_FIXED << 1), 3);
+			build_codes(fixed_litlen_lengths, 288, litlen_codes);
+			build_codes(fixed_dist_lengths, 32, dist_codes);
+			write_symbols(
+				s, fixed_litlen_lengths, litlen_codes, fixed_dist_lengths, dist_codes);
+		} else {
+			put_bits(w, (last ? 1 : 0) | (BLOCK_DYNAMIC << 1), 3);
+			write_dynamic_header(w, &header);
+			build_codes(header.litlen_lengths, NUMOF_LITLEN_SYMBOLS, litlen_codes);
+			build_codes(header.dist_lengths, NUMOF_DIST_SYMBOLS, dist_codes);
+			write_symbols(
+				s, header.litlen_lengths, litlen_codes, header.dist_lengths, dist_codes);
+		}
+	}
+
+	s->block_start += s->block_length;
+	s->block_length = 0;
+	s->numof_symbols = 0;
+	memset(s->litlen_freq, '\0', sizeof(s->litlen_freq));
+	memset(s->dist_freq, '\0', sizeof(s->dist_freq));
+	memset(&s->split, '\0', sizeof(s->split));
+	s->opt_numof_matches = 0;
+	s->skip = 0;
+	return true;
+}
+
+static inline void tally_literal(deflate_state* s, unsigned literal) {
+	s->sym_litlen[s->numof_symbols] = literal;
+	s->sym_dist[s->numof_symbols] = 0;
+	++s->numof_symbols;
+	++s->litlen_freq[literal];
+}
+
+static inline void tally_match(deflate_state* s, unsigned length, unsigned dist) {
+	s->sym_litlen[s->numof_symbols] = length;
+	s->sym_dist[s->numof_symbols] = dist;
+	++s->numof_symbols;
+	++s->litlen_freq[length_symbol(length)];
+	++s->dist_freq[dist_symbol(dist)];
+}
+
+static inline void observe_literal(block_split_stats* stats, unsigned literal) {
+	++stats->new_observations[literal >> 5];
+	++stats->numof_new_observations;
+}
+
+static inline void observe_match(block_split_stats* stats, unsigned length) {
+	++stats->new_observations[8 + (length >= 9)];
+	++stats->numof_new_observations;
+}
+
+// Compare the recent observations against the ones of the whole block so far and
+// decide if the data changed enough to be better off with a new set of codes
+static bool block_split_check(block_split_stats* stats, unsigned block_length) {
+	if(stats->numof_new_observations < OBSERVATIONS_PER_CHECK)
+		return false;
+
+	if(stats->numof_observations && block_length >= MIN_BLOCK_LENGTH) {
+		unsigned long long delta = 0;
+		for(unsigned i = 0; i < NUMOF_OBSERVATION_TYPES; ++i) {
+			long long expected =
+				(long long)stats->observations[i] * stats->numof_new_observations;
+			long long actual =
+				(long long)stats->new_observations[i] * stats->numof_observations;
+			delta += actual > expected ? actual - expected : expected - actual;
+		}
+
+		// Long blocks have amortized their header, so lower the bar the longer
+		// the block gets
+		unsigned long long cutoff = (unsigned long long)stats->numof_new_observations *
+			stats->numof_observations * 200 / 512;
+		if(delta + (block_length / 4096) * (unsigned long long)stats->numof_observations >=
+			cutoff)
+			return true;
+	}
+
+	for(unsigned i = 0; i < NUMOF_OBSERVATION_TYPES; ++i) {
+		stats->observations[i] += stats->new_observations[i];
+		stats->new_observations[i] = 0;
+	}
+	stats->numof_observations += stats->numof_new_observations;
+	stats->numof_new_observations = 0;
+	return false;
+}
+
+static inline unsigned hash3(const unsigned char* p) {
+	unsigned v = ((unsigned)p[0] << 16) | ((unsigned)p[1] << 8) | p[2];
+	return (v * 0x9e3779b1u) >> (32 - HASH_BITS);
+}
+
+// Insert the string at pos into the hash chains and return the previous head
+static inline unsigned insert_string(deflate_state* s, unsigned pos) {
+	unsigned h = hash3(s->window + pos);
+	unsigned head = s->head[h];
+	s->prev[pos & WINDOW_MASK] = head;
+	s->head[h] = pos;
+	return head;
+}
+
+static void slide_window(deflate_state* s) {
+	memmove(s->window, s->window + WINDOW_SIZE, WINDOW_SIZE);
+	s->strstart -= WINDOW_SIZE;
+	s->match_start -= WINDOW_SIZE;
+	s->prev_match -= WINDOW_SIZE;
+	s->block_start -= WINDOW_SIZE;
+
+	for(unsigned i = 0; i < HASH_SIZE; ++i)
+		s->head[i] = s->head[i] >= WINDOW_SIZE ? s->head[i] - WINDOW_SIZE : 0;
+	for(unsigned i = 0; i < WINDOW_SIZE; ++i)
+		s->prev[i] = s->prev[i] >= WINDOW_SIZE ? s->prev[i] - WINDOW_SIZE : 0;
+}
+
+static inline unsigned long long load64(const unsigned char* p) {
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned load32(const unsigned char* p) {
+	unsigned v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Compare eight bytes at a time, the first differing byte is found by counting the
+// equal bits of the XORed words
+static inline unsigned common_length(
+	const unsigned char* scan, const unsigned char* match, unsigned max_length) {
+	unsigned len = 0;
+	while(len + 8 <= max_length) {
+		unsigned long long diff = load64(scan + len) ^ load64(match + len);
+		if(diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			return len + (__builtin_clzll(diff) >> 3);
+#else
+			return len + (__builtin_ctzll(diff) >> 3);
+#endif
+		}
+		len += 8;
+	}
+	while(len < max_length && scan[len] == match[len])
+		++len;
+	return len;
+}
+
+// Walk the hash chain starting at cur_match and return the length of the longest
+// match that beats prev_length (or prev_length itself). Sets s->match_start.
+static unsigned longest_match(deflate_state* s, unsigned cur_match, unsigned prev_length) {
+	unsigned chain_length = s->config.max_chain;
+	unsigned max_length = s->lookahead < MAX_MATCH ? s->lookahead : MAX_MATCH;
+	unsigned nice_length =
+		s->config.nice_length < max_length ? s->config.nice_length : max_length;
+	unsigned limit = s->strstart > MAX_DIST ? s->strstart - MAX_DIST : 0;
+	unsigned best_length = prev_length;
+	const unsigned char* scan = s->window + s->strstart;
+
+	if(prev_length >= s->config.good_length)
+		chain_length >>= 2;
+	if(best_length >= max_length)
+		return best_length;
+
+	do {
+		const unsigned char* match = s->window + cur_match;
+		if(match[best_length] != scan[best_length] || match[0] != scan[0] ||
+			match[1] != scan[1])
+			continue;
+
+		unsigned length = common_length(scan, match, max_length);
+		if(length > best_length) {
+			s->match_start = cur_match;
+			best_length = length;
+			if(length >= nice_length)
+				break;
+		}
+	} while((cur_match = s->prev[cur_match & WINDOW_MASK]) > limit && --chain_length);
+
+	return best_length;
+}
+
+// Like longest_match() but remember every match that is longer than the ones
+// before it, which leaves the closest match for every possible length
+static unsigned collect_matches(deflate_state* s, unsigned cur_match, deflate_match* matches) {
+	unsigned chain_length = s->config.max_chain;
+	unsigned max_length = s->lookahead < MAX_MATCH ? s->lookahead : MAX_MATCH;
+	unsigned nice_length =
+		s->config.nice_length < max_length ? s->config.nice_length : max_length;
+	unsigned limit = s->strstart > MAX_DIST ? s->strstart - MAX_DIST : 0;
+	unsigned best_length = MIN_MATCH - 1;
+	unsigned numof_matches = 0;
+	const unsigned char* scan = s->window + s->strstart;
+
+	if(max_length < MIN_MATCH)
+		return 0;
+
+	do {
+		const unsigned char* match = s->window + cur_match;
+		if(match[best_length] != scan[best_length] || match[0] != scan[0] ||
+			match[1] != scan[1])
+			continue;
+
+		unsigned length = common_length(scan, match, max_length);
+		if(length > best_length) {
+			best_length = length;
+			matches[numof_matches].length = length;
+			matches[numof_matches].dist = s->strstart - cur_match;
+			++numof_matches;
+			if(length >= nice_length)
+				break;
+		}
+	} while((cur_match = s->prev[cur_match & WINDOW_MASK]) > limit && --chain_length);
+
+	return numof_matches;
+}
+
+// Insert the strings at [from, to) into the hash chains, as far as the lookahead allows
+static void insert_strings(deflate_state* s, unsigned from, unsigned to) {
+	unsigned end = s->strstart + s->lookahead;
+	for(unsigned pos = from; pos < to && pos + MIN_MATCH <= end; ++pos)
+		insert_string(s, pos);
+}
+
+static bool deflate_stored(deflate_state* s) {
+	s->strstart += s->lookahead;
+	s->block_length += s->lookahead;
+	s->lookahead = 0;
+	if(s->block_length >= MAX_DIST)
+		return flush_block(s, false);
+	return true;
+}
+
+static inline unsigned hash4(const unsigned char* p) {
+	return (load32(p) * 0x9e3779b1u) >> (32 - HASH_BITS);
+}
+
+// Level 1: every hash bucket only remembers the most recent position, so there is a
+// single candidate to verify and no chain to maintain
+static bool deflate_fast(deflate_state* s, bool flush_all) {
+	while(s->lookahead >= MIN_LOOKAHEAD || (flush_all && s->lookahead)) {
+		unsigned length = 0;
+		unsigned dist = 0;
+		if(s->lookahead >= 4) {
+			const unsigned char* scan = s->window + s->strstart;
+			unsigned h = hash4(scan);
+			unsigned candidate = s->head[h];
+			s->head[h] = s->strstart;
+
+			dist = s->strstart - candidate;
+			if(candidate && dist <= MAX_DIST &&
+				load32(s->window + candidate) == load32(scan)) {
+				unsigned max_length = s->lookahead < MAX_MATCH ? s->lookahead : MAX_MATCH;
+				length = 4 + common_length(scan + 4, s->window + candidate + 4, max_length - 4);
+			}
+		}
+
+		if(length) {
+			tally_match(s, length, dist);
+			s->strstart += length;
+			s->lookahead -= length;
+			s->block_length += length;
+			s->misses = 0;
+			// Remember the end of the match, runs often continue right after it
+			if(s->lookahead >= 3)
+				s->head[hash4(s->window + s->strstart - 1)] = s->strstart - 1;
+		} else {
+			// The longer nothing matched the less likely the data is compressible, so
+			// probe less often
+			unsigned step = 1 + (s->misses++ >> 6);
+			if(step > s->lookahead)
+				step = s->lookahead;
+			if(step > SYMBOL_BUF_SIZE - s->numof_symbols)
+				step = SYMBOL_BUF_SIZE - s->numof_symbols;
+			for(unsigned i = 0; i < step; ++i)
+				tally_literal(s, s->window[s->strstart + i]);
+			s->strstart += step;
+			s->lookahead -= step;
+			s->block_length += step;
+		}
+
+		if(s->numof_symbols == SYMBOL_BUF_SIZE && !flush_block(s, false))
+			return false;
+	}
+	return true;
+}
+
+static bool deflate_greedy(deflate_state* s, bool flush_all) {
+	while(s->lookahead >= MIN_LOOKAHEAD || (flush_all && s->lookahead)) {
+		unsigned hash_head = s->lookahead >= MIN_MATCH ? insert_string(s, s->strstart) : 0;
+		unsigned length = MIN_MATCH - 1;
+		if(hash_head && s->strstart - hash_head <= MAX_DIST)
+			length = longest_match(s, hash_head, MIN_MATCH - 1);
+
+		if(length >= MIN_MATCH) {
+			tally_match(s, length, s->strstart - s->match_start);
+			// Skip the hash updates of long matches, they rarely pay off
+			if(length <= s->config.max_lazy)
+				insert_strings(s, s->strstart + 1, s->strstart + length);
+			s->strstart += length;
+			s->lookahead -= length;
+			s->block_length += length;
+		} else {
+			tally_literal(s, s->window[s->strstart]);
+			++s->strstart;
+			--s->lookahead;
+			++s->block_length;
+		}
+
+		if(s->numof_symbols == SYMBOL_BUF_SIZE && !flush_block(s, false))
+			return false;
+	}
+	return true;
+}
+
+// Only emit a match if the match starting at the next byte isn't longer
+static bool deflate_lazy(deflate_state* s, bool flush_all) {
+	while(s->lookahead >= MIN_LOOKAHEAD || (flush_all && s->lookahead)) {
+		unsigned hash_head = s->lookahead >= MIN_MATCH ? insert_string(s, s->strstart) : 0;
+
+		s->prev_length = s->match_length;
+		s->prev_match = s->match_start;
+		s->match_length = MIN_MATCH - 1;
+		if(hash_head && s->prev_length < s->config.max_lazy &&
+			s->strstart - hash_head <= MAX_DIST) {
+			s->match_length = longest_match(s, hash_head, s->prev_length);
+			if(s->match_length == MIN_MATCH && s->strstart - s->match_start > TOO_FAR)
+				s->match_length = MIN_MATCH - 1;
+		}
+
+		bool emitted = true;
+		if(s->prev_length >= MIN_MATCH && s->match_length <= s->prev_length) {
+			// The match at the previous byte wins, strstart already is one byte into it
+			tally_match(s, s->prev_length, s->strstart - 1 - s->prev_match);
+			observe_match(&s->split, s->prev_length);
+			insert_strings(s, s->strstart + 1, s->strstart - 1 + s->prev_length);
+			s->strstart += s->prev_length - 1;
+			s->lookahead -= s->prev_length - 1;
+			s->block_length += s->prev_length;
+			s->match_available = false;
+			s->match_length = MIN_MATCH - 1;
+		} else if(s->match_available) {
+			unsigned literal = s->window[s->strstart - 1];
+			tally_literal(s, literal);
+			observe_literal(&s->split, literal);
+			++s->block_length;
+			++s->strstart;
+			--s->lookahead;
+		} else {
+			// Wait for the next byte to decide
+			s->match_available = true;
+			++s->strstart;
+			--s->lookahead;
+			emitted = false;
+		}
+
+		if(emitted && (s->numof_symbols == SYMBOL_BUF_SIZE ||
+						  block_split_check(&s->split, s->block_length))) {
+			if(!flush_block(s, false))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Find the cheapest way through the cached piece given the bit costs of every
+// symbol. Works backwards so that every position only looks at its own matches.
+static void find_min_cost_path(
+	deflate_state* s, const unsigned* litlen_cost, const unsigned* dist_cost) {
+	unsigned n = s->opt_length;
+	unsigned length_cost[MAX_MATCH + 1];
+
+	for(unsigned length = MIN_MATCH; length <= MAX_MATCH; ++length) {
+		unsigned symbol = length_symbol(length);
+		length_cost[length] = litlen_cost[symbol] + length_extra[symbol - 257];
+	}
+
+	s->opt_cost[n] = 0;
+	for(unsigned i = n; i-- > 0;) {
+		unsigned best_cost = litlen_cost[s->opt_literals[i]] + s->opt_cost[i + 1];
+		unsigned best_length = 1;
+		unsigned best_dist = 0;
+
+		// Matches are sorted by length, each one covers the lengths its predecessor
+		// couldn't reach
+		unsigned length = MIN_MATCH;
+		for(unsigned m = s->opt_match_index[i]; m < s->opt_match_index[i + 1]; ++m) {
+			unsigned dist = s->opt_matches[m].dist;
+			unsigned symbol = dist_symbol(dist);
+			unsigned cost = dist_cost[symbol] + dist_extra[symbol];
+			unsigned max_length = s->opt_matches[m].length;
+			if(max_length > n - i)
+				max_length = n - i;
+
+			for(; length <= max_length; ++length) {
+				unsigned total = length_cost[length] + cost + s->opt_cost[i + length];
+				if(total < best_cost) {
+					best_cost = total;
+					best_length = length;
+					best_dist = dist;
+				}
+			}
+		}
+
+		s->opt_cost[i] = best_cost;
+		s->opt_choice_length[i] = best_length;
+		s->opt_choice_dist[i] = best_dist;
+	}
+}
+
+static void costs_from_lengths(const unsigned char* lengths, unsigned numof_symbols,
+	unsigned* costs) {
+	for(unsigned i = 0; i < numof_symbols; ++i)
+		costs[i] = lengths[i] ? lengths[i] : UNUSED_SYMBOL_COST;
+}
+
+// Iteratively refine the parse of the cached piece: every pass prices the symbols
+// with the Huffman code the previous pass would have produced. That isn't always
+// better, so the refinement stops at the first pass that doesn't pay off.
+static void optimal_parse(deflate_state* s) {
+	unsigned n = s->opt_length;
+	unsigned litlen_cost[288];
+	unsigned dist_cost[32];
+	unsigned best_litlen_cost[288];
+	unsigned best_dist_cost[32];
+	unsigned char litlen_lengths[288];
+	unsigned char dist_lengths[32];
+	unsigned litlen_freq[NUMOF_LITLEN_SYMBOLS];
+	unsigned dist_freq[NUMOF_DIST_SYMBOLS];
+
+	s->opt_match_index[n] = s->opt_numof_matches;
+
+	// The piece ends up in the code of its block, so the symbols of the block so
+	// far are the first guess. The fixed code has to do for the first piece.
+	if(s->numof_symbols) {
+		memcpy(litlen_freq, s->litlen_freq, sizeof(litlen_freq));
+		++litlen_freq[END_OF_BLOCK];
+		build_code_lengths(litlen_freq, NUMOF_LITLEN_SYMBOLS, MAX_CODE_LENGTH, litlen_lengths);
+		build_code_lengths(s->dist_freq, NUMOF_DIST_SYMBOLS, MAX_CODE_LENGTH, dist_lengths);
+		costs_from_lengths(litlen_lengths, NUMOF_LITLEN_SYMBOLS, litlen_cost);
+		costs_from_lengths(dist_lengths, NUMOF_DIST_SYMBOLS, dist_cost);
+	} else {
+		fixed_code_lengths(litlen_lengths, dist_lengths);
+		costs_from_lengths(litlen_lengths, 288, litlen_cost);
+		costs_from_lengths(dist_lengths, 32, dist_cost);
+	}
+
+	unsigned long best_bits = ~0ul;
+	for(unsigned pass = 0; pass < s->config.optimal_passes; ++pass) {
+		find_min_cost_path(s, litlen_cost, dist_cost);
+
+		// Size of the block's symbols with the code it gets with this parse, leaving
+		// out the extra bits of the symbols before the piece, which stay the same
+		unsigned long bits = 0;
+		memcpy(litlen_freq, s->litlen_freq, sizeof(litlen_freq));
+		memcpy(dist_freq, s->dist_freq, sizeof(dist_freq));
+		for(unsigned i = 0; i < n; i += s->opt_choice_length[i]) {
+			if(s->opt_choice_length[i] == 1) {
+				++litlen_freq[s->opt_literals[i]];
+			} else {
+				unsigned length = length_symbol(s->opt_choice_length[i]);
+				unsigned dist = dist_symbol(s->opt_choice_dist[i]);
+				++litlen_freq[length];
+				++dist_freq[dist];
+				bits += length_extra[length - 257] + dist_extra[dist];
+			}
+		}
+		++litlen_freq[END_OF_BLOCK];
+		build_code_lengths(litlen_freq, NUMOF_LITLEN_SYMBOLS, MAX_CODE_LENGTH, litlen_lengths);
+		build_code_lengths(dist_freq, NUMOF_DIST_SYMBOLS, MAX_CODE_LENGTH, dist_lengths);
+		for(unsigned i = 0; i < NUMOF_LITLEN_SYMBOLS; ++i)
+			bits += (unsigned long)litlen_freq[i] * litlen_lengths[i];
+		for(unsigned i = 0; i < NUMOF_DIST_SYMBOLS; ++i)
+			bits += (unsigned long)dist_freq[i] * dist_lengths[i];
+
+		if(bits >= best_bits) {
+			// Back to the parse of the previous pass
+			find_min_cost_path(s, best_litlen_cost, best_dist_cost);
+			break;
+		}
+		best_bits = bits;
+		memcpy(best_litlen_cost, litlen_cost, sizeof(litlen_cost));
+		memcpy(best_dist_cost, dist_cost, sizeof(dist_cost));
+		costs_from_lengths(litlen_lengths, NUMOF_LITLEN_SYMBOLS, litlen_cost);
+		costs_from_lengths(dist_lengths, NUMOF_DIST_SYMBOLS, dist_cost);
+	}
+
+	for(unsigned i = 0; i < n; i += s->opt_choice_length[i]) {
+		if(s->opt_choice_length[i] == 1)
+			tally_literal(s, s->opt_literals[i]);
+		else
+			tally_match(s, s->opt_choice_length[i], s->opt_choice_dist[i]);
+	}
+	// Positions of the next piece are all searched again, the matches of this
+	// one were cut off at its end
+	s->opt_length = 0;
+	s->opt_numof_matches = 0;
+	s->skip = 0;
+}
+
+// Gather all matches of a piece of the block first, then parse it as a whole. A
+// block takes as many pieces as its symbols have room for, so that data that
+// compresses well doesn't pay for a header every OPT_MAX_BLOCK_LENGTH bytes.
+static bool deflate_optimal(deflate_state* s, bool flush_all) {
+	while(s->lookahead >= MIN_LOOKAHEAD || (flush_all && s->lookahead)) {
+		unsigned pos = s->opt_length;
+		s->opt_literals[pos] = s->window[s->strstart];
+		s->opt_match_index[pos] = s->opt_numof_matches;
+
+		unsigned hash_head = s->lookahead >= MIN_MATCH ? insert_string(s, s->strstart) : 0;
+		if(s->skip) {
+			// Inside a very long match, searching here would only waste time
+			--s->skip;
+		} else {
+			unsigned numof_matches = 0;
+			if(hash_head && s->strstart - hash_head <= MAX_DIST)
+				numof_matches =
+					collect_matches(s, hash_head, s->opt_matches + s->opt_numof_matches);
+
+			if(numof_matches) {
+				unsigned longest = s->opt_matches[s->opt_numof_matches + numof_matches - 1].length;
+				observe_match(&s->split, longest);
+				if(longest >= s->config.nice_length)
+					s->skip = longest - 1;
+				s->opt_numof_matches += numof_matches;
+			} else
+				observe_literal(&s->split, s->opt_literals[pos]);
+		}
+
+		++s->strstart;
+		--s->lookahead;
+		++s->block_length;
+		++s->opt_length;
+
+		// Every position of a piece may become a symbol. A piece runs on to the end
+		// of a long match rather than cutting it off.
+		unsigned room = SYMBOL_BUF_SIZE - s->numof_symbols;
+		unsigned limit = (room < OPT_MAX_BLOCK_LENGTH ? room : OPT_MAX_BLOCK_LENGTH) - MAX_MATCH;
+		bool split = false;
+		if((s->opt_length >= limit && !s->skip) ||
+			s->opt_numof_matches + MAX_MATCH > OPT_CACHE_SIZE ||
+			(!s->skip && (split = block_split_check(&s->split, s->block_length)))) {
+			optimal_parse(s);
+			if((split || SYMBOL_BUF_SIZE - s->numof_symbols < OPT_MIN_PIECE_LENGTH) &&
+				!flush_block(s, false))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool deflate_init(deflate_state* s, int level) {
+	memset(s, '\0', sizeof(deflate_state));
+	if(level < MIN_LEVEL)
+		level = MIN_LEVEL;
+	if(level > MAX_LEVEL)
+		level = MAX_LEVEL;
+	s->level = level;
+	s->config = configs[level];
+	s->match_length = MIN_MATCH - 1;
+	s->prev_length = MIN_MATCH - 1;
+
+	s->window = malloc(2 * WINDOW_SIZE);
+	s->head = calloc(HASH_SIZE, sizeof(unsigned short));
+	s->prev = calloc(WINDOW_SIZE, sizeof(unsigned short));
+	s->sym_litlen = malloc(SYMBOL_BUF_SIZE * sizeof(unsigned short));
+	s->sym_dist = malloc(SYMBOL_BUF_SIZE * sizeof(unsigned short));
+	if(!s->window || !s->head || !s->prev || !s->sym_litlen || !s->sym_dist) {
+		deflate_end(s);
+		return false;
+	}
+
+	if(s->config.strategy == STRATEGY_OPTIMAL) {
+		s->opt_literals = malloc(OPT_MAX_BLOCK_LENGTH);
+		s->opt_match_index = malloc((OPT_MAX_BLOCK_LENGTH + 1) * sizeof(unsigned));
+		s->opt_matches = malloc(OPT_CACHE_SIZE * sizeof(deflate_match));
+		s->opt_cost = malloc((OPT_MAX_BLOCK_LENGTH + 1) * sizeof(unsigned));
+		s->opt_choice_length = malloc(OPT_MAX_BLOCK_LENGTH * sizeof(unsigned short));
+		s->opt_choice_dist = malloc(OPT_MAX_BLOCK_LENGTH * sizeof(unsigned short));
+		if(!s->opt_literals || !s->opt_match_index || !s->opt_matches || !s->opt_cost ||
+			!s->opt_choice_length || !s->opt_choice_dist) {
+			deflate_end(s);
+			return false;
+		}
+	}
+	return true;
+}
+
+void deflate_reset(deflate_state* s) {
+	memset(s->head, '\0', HASH_SIZE * sizeof(unsigned short));
+	memset(s->prev, '\0', WINDOW_SIZE * sizeof(unsigned short));
+	s->strstart = 0;
+	s->lookahead = 0;
+	s->block_start = 0;
+	s->block_length = 0;
+	s->match_length = MIN_MATCH - 1;
+	s->match_start = 0;
+	s->prev_length = MIN_MATCH - 1;
+	s->prev_match = 0;
+	s->match_available = false;
+	s->misses = 0;
+	s->numof_symbols = 0;
+	memset(s->litlen_freq, '\0', sizeof(s->litlen_freq));
+	memset(s->dist_freq, '\0', sizeof(s->dist_freq));
+	memset(&s->split, '\0', sizeof(s->split));
+	s->opt_length = 0;
+	s->opt_numof_matches = 0;
+	s->skip = 0;
+	s->out.len = 0;
+	s->out.bits = 0;
+	s->out.numof_bits = 0;
+	s->finished = false;
+}
+
+bool deflate_set_dictionary(deflate_state* s, const unsigned char* dict, size_t len) {
+	if(s->strstart || s->lookahead)
+		return false;
+
+	// Matches can't reach further back than MAX_DIST anyway
+	if(len > MAX_DIST) {
+		dict += len - MAX_DIST;
+		len = MAX_DIST;
+	}
+	memcpy(s->window, dict, len);
+	for(unsigned pos = 0; pos + 4 <= len; ++pos) {
+		if(s->config.strategy == STRATEGY_FAST)
+			s->head[hash4(s->window + pos)] = pos;
+		else
+			insert_string(s, pos);
+	}
+
+	// The dictionary itself is never emitted
+	s->strstart = len;
+	s->block_start = len;
+	return true;
+}
+
+bool deflate_put_bytes(deflate_state* s, const unsigned char* data, size_t len) {
+	if(s->out.numof_bits || !writer_reserve(&s->out, len))
+		return false;
+	memcpy(s->out.buf + s->out.len, data, len);
+	s->out.len += len;
+	return true;
+}
+
+void deflate_end(deflate_state* s) {
+	free(s->window);
+	free(s->head);
+	free(s->prev);
+	free(s->sym_litlen);
+	free(s->sym_dist);
+	free(s->opt_literals);
+	free(s->opt_match_index);
+	free(s->opt_matches);
+	free(s->opt_cost);
+	free(s->opt_choice_length);
+	free(s->opt_choice_dist);
+	free(s->out.buf);
+	memset(s, '\0', sizeof(deflate_state));
+}
+
+static bool run_parser(deflate_state* s, bool flush_all) {
+	switch(s->config.strategy) {
+		case STRATEGY_STORED: return deflate_stored(s);
+		case STRATEGY_FAST: return deflate_fast(s, flush_all);
+		case STRATEGY_GREEDY: return deflate_greedy(s, flush_all);
+		case STRATEGY_LAZY: return deflate_lazy(s, flush_all);
+		case STRATEGY_OPTIMAL: return deflate_optimal(s, flush_all);
+	}
+	return false;
+}
+
+bool deflate_compress(
+	deflate_state* s, const unsigned char* in, size_t len, lzip_flush flush) {
+	if(s->finished)
+		return false;
+
+	for(;;) {
+		// Top up the lookahead, sliding the window once the upper half is used up
+		if(len && s->lookahead < MIN_LOOKAHEAD) {
+			if(s->strstart >= WINDOW_SIZE + MAX_DIST)
+				slide_window(s);
+			size_t space = 2 * WINDOW_SIZE - s->strstart - s->lookahead;
+			size_t n = len < space ? len : space;
+			memcpy(s->window + s->strstart + s->lookahead, in, n);
+			s->lookahead += n;
+			in += n;
+			len -= n;
+		}
+
+		bool flush_all = flush != LZIP_NO_FLUSH && !len;
+		if(s->lookahead >= MIN_LOOKAHEAD || (flush_all && s->lookahead)) {
+			if(!run_parser(s, flush_all))
+				return false;
+		} else if(!len)
+			break;
+	}
+
+	if(flush == LZIP_NO_FLUSH)
+		return true;
+
+	// Everything seen so far has to go into the block that is ended now
+	if(s->match_available) {
+		unsigned literal = s->window[s->strstart - 1];
+		tally_literal(s, literal);
+		++s->block_length;
+		s->match_available = false;
+		s->match_length = MIN_MATCH - 1;
+	}
+	if(s->config.strategy == STRATEGY_OPTIMAL)
+		optimal_parse(s);
+
+	if(flush == LZIP_FINISH) {
+		if(!flush_block(s, true))
+			return false;
+		align_to_byte(&s->out);
+		s->finished = true;
+		return true;
+	}
+
+	if((s->block_length || s->numof_symbols) && !flush_block(s, false))
+		return false;
+
+	// An empty stored block brings the output to a byte boundary (see 3.2.4)
+	if(!writer_reserve(&s->out, 16))
+		return false;
+	write_stored_blocks(&s->out, NULL, 0, false);
+
+	// Forget the history so that decoding can restart from here
+	if(flush == LZIP_FULL_FLUSH) {
+		memset(s->head, '\0', HASH_SIZE * sizeof(unsigned short));
+		memset(s->prev, '\0', WINDOW_SIZE * sizeof(unsigned short));
+	}
+	return true;
+}
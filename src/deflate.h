@@ -0,0 +1,132 @@
+#ifndef LZIP_DEFLATE_H
+#define LZIP_DEFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum { MIN_LEVEL = 0, MAX_LEVEL = 12, DEFAULT_LEVEL = 6 };
+
+typedef enum {
+	// Compress as the window fills up
+	LZIP_NO_FLUSH,
+	// End the current block and align the output to a byte boundary
+	LZIP_SYNC_FLUSH,
+	// Like LZIP_SYNC_FLUSH but later data won't reference anything before this point
+	LZIP_FULL_FLUSH,
+	// End the stream with a final block
+	LZIP_FINISH
+} lzip_flush;
+
+typedef enum {
+	STRATEGY_STORED,
+	STRATEGY_FAST,
+	STRATEGY_GREEDY,
+	STRATEGY_LAZY,
+	STRATEGY_OPTIMAL
+} parse_strategy;
+
+// Tuning knobs of a single compression level
+typedef struct {
+	parse_strategy strategy;
+	// Search less of the chain if the current match is at least this long
+	unsigned good_length;
+	// Lazy: only look for a better match if the current one is shorter than this
+	// Greedy: only insert the strings of matches up to this length into the hash chains
+	unsigned max_lazy;
+	// Stop searching as soon as a match of this length was found
+	unsigned nice_length;
+	unsigned max_chain;
+	// Most cost-model refinements done by the optimal parser, it stops early once
+	// they don't pay off
+	unsigned optimal_passes;
+} level_config;
+
+// Output bits are collected LSB-first (see RFC 1951 section 3.1.1)
+typedef struct {
+	unsigned char* buf;
+	size_t len;
+	size_t cap;
+	unsigned long long bits;
+	unsigned numof_bits;
+} bit_writer;
+
+enum { NUMOF_OBSERVATION_TYPES = 10 };
+// Cheap statistics used to guess when the symbol distribution shifts enough to be
+// worth starting a new dynamic block
+typedef struct {
+	unsigned observations[NUMOF_OBSERVATION_TYPES];
+	unsigned new_observations[NUMOF_OBSERVATION_TYPES];
+	unsigned numof_observations;
+	unsigned numof_new_observations;
+} block_split_stats;
+
+typedef struct {
+	unsigned short length;
+	unsigned short dist;
+} deflate_match;
+
+typedef struct {
+	int level;
+	level_config config;
+
+	// Two windows worth of input, the lower half is the history for the upper one
+	unsigned char* window;
+	unsigned short* head;
+	unsigned short* prev;
+	unsigned strstart;
+	unsigned lookahead;
+
+	// Window index of the first byte of the current block, negative once the data
+	// has been slid out of the window (the block then can't be stored anymore)
+	long block_start;
+	// Number of input bytes covered by the current block
+	unsigned block_length;
+
+	// Lazy matching state carried from one position to the next
+	unsigned match_length;
+	unsigned match_start;
+	unsigned prev_length;
+	unsigned prev_match;
+	bool match_available;
+	// Consecutive positions without a match at level 1
+	unsigned misses;
+
+	// Symbols of the current block
+	unsigned short* sym_litlen;
+	unsigned short* sym_dist;
+	unsigned numof_symbols;
+	unsigned litlen_freq[286];
+	unsigned dist_freq[30];
+	block_split_stats split;
+
+	// Match cache of the optimal parser, it covers the opt_length positions since
+	// the last parsed piece of the block
+	unsigned opt_length;
+	unsigned char* opt_literals;
+	unsigned* opt_match_index;
+	deflate_match* opt_matches;
+	unsigned opt_numof_matches;
+	unsigned* opt_cost;
+	unsigned short* opt_choice_length;
+	unsigned short* opt_choice_dist;
+	unsigned skip;
+
+	bit_writer out;
+	bool finished;
+} deflate_state;
+
+bool deflate_init(deflate_state* s, int level);
+// Start a new stream, keeping all allocations of the previous one
+void deflate_reset(deflate_state* s);
+void deflate_end(deflate_state* s);
+// Prime the window and hash chains, only possible before any input was given
+bool deflate_set_dictionary(deflate_state* s, const unsigned char* dict, size_t len);
+// Append raw bytes like framing headers, the output must be on a byte boundary
+bool deflate_put_bytes(deflate_state* s, const unsigned char* data, size_t len);
+
+// Compress len bytes of input into a raw deflate stream (RFC 1951). The compressed
+// bytes are appended to s->out, the caller drains them by resetting s->out.len.
+bool deflate_compress(
+	deflate_state* s, const unsigned char* in, size_t len, lzip_flush flush);
+
+#endif
@@ -0,0 +1,188 @@
+#include "gzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+
+// Read a null-terminated string from a file
+// Null terminated strings in files suck
+bool read_string(bit_stream* in, char** target) {
+	size_t capacity = 256;
+	size_t len = 0;
+	char* string = malloc(capacity);
+	if(!string) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+
+	for(;;) {
+		unsigned char c;
+		if(!read_bytes(in, &c, 1)) {
+			fprintf(stderr, "Premature end of file in string value.\n");
+			free(string);
+			return false;
+		}
+		if(!c)
+			break;
+
+		if(len + 1 == capacity && capacity < MAX_STRING) {
+			char* grown = realloc(string, 2 * capacity);
+			if(!grown) {
+				fprintf(stderr, "Out of memory.\n");
+				free(string);
+				return false;
+			}
+			string = grown;
+			capacity *= 2;
+		}
+		if(len + 1 < capacity)
+			string[len++] = c;
+	}
+
+	string[len] = '\0';
+	*target = string;
+	return true;
+}
+
+// Read an RFC 1952-compliant gzip member header
+bool read_gzip_header(bit_stream* in, gzip_file* gzip) {
+	if(!read_bytes(in, (unsigned char*)&gzip->header, sizeof(gzip_header))) {
+		fprintf(stderr, "Premature end of file in header.\n");
+		return false;
+	}
+
+	if((gzip->header.id[0] != 31) || (gzip->header.id[1] != 139)) {
+		fprintf(stderr, "Input not in gzip format.\n");
+		return false;
+	}
+
+	if(gzip->header.compression_method != 8) {
+		fprintf(stderr, "Unrecognized compression method.\n");
+		return false;
+	}
+
+	unsigned char bytes[2];
+	if(gzip->header.flags & FEXTRA) {
+		if(!read_bytes(in, bytes, 2)) {
+			fprintf(stderr, "Premature end of file in extras length.\n");
+			return false;
+		}
+		gzip->xlen = load_le16(bytes);
+
+		gzip->extra = malloc(gzip->xlen ? gzip->xlen : 1);
+		if(!gzip->extra || !read_bytes(in, gzip->extra, gzip->xlen)) {
+			fprintf(stderr, "Error reading extras.\n");
+			return false;
+		}
+		// TODO interpret the extra data
+	}
+
+	if(gzip->header.flags & FNAME) {
+		if(!read_string(in, &gzip->fname))
+			return false;
+	}
+
+	if(gzip->header.flags & FCOMMENT) {
+		if(!read_string(in, &gzip->fcomment))
+			return false;
+	}
+
+	if(gzip->header.flags & FHCRC) {
+		if(!read_bytes(in, bytes, 2)) {
+			fprintf(stderr, "Premature end of file in CRC16.\n");
+			return false;
+		}
+		gzip->crc16 = load_le16(bytes);
+	}
+
+	return true;
+}
+
+void free_gzip_file(gzip_file* gzip) {
+	free(gzip->extra);
+	free(gzip->fname);
+	free(gzip->fcomment);
+	memset(gzip, '\0', sizeof(gzip_file));
+}
+
+// Read an RFC 1950 zlib header, streams needing a preset dictionary are rejected
+bool read_zlib_header(bit_stream* in) {
+	unsigned char header[2];
+	if(!read_bytes(in, header, sizeof(header))) {
+		fprintf(stderr, "Premature end of file in header.\n");
+		return false;
+	}
+
+	if((header[0] & 0x0f) != 8 || (header[0] >> 4) > 7 ||
+		(header[0] * 256 + header[1]) % 31) {
+		fprintf(stderr, "Input not in zlib format.\n");
+		return false;
+	}
+
+	if(header[1] & ZLIB_FDICT) {
+		fprintf(stderr, "Input needs a preset dictionary.\n");
+		return false;
+	}
+
+	return true;
+}
+
+members_result decode_members(
+	inflate_state* state, file_format format, gzip_file* gzip, const member_hooks* hooks) {
+	for(unsigned member = 0;; ++member) {
+		if(member > 0) {
+			// Tolerate padding after the last member like gzip does
+			if(*state->stream.next != 31)
+				return MEMBERS_TRAILING_GARBAGE;
+			free_gzip_file(gzip);
+			if(!read_gzip_header(&state->stream, gzip))
+				return MEMBERS_BAD_HEADER;
+		}
+		if(hooks->begin)
+			hooks->begin(hooks->opaque, member);
+
+		unsigned long check = 0;
+		inflate_reset(state);
+		if(!inflate(state) || !hooks->check(hooks->opaque, &check))
+			return MEMBERS_BAD_DATA;
+
+		// The trailer follows the last block on the next byte boundary
+		if(format == FORMAT_GZIP) {
+			unsigned char trailer[8];
+			if(!read_bytes(&state->stream, trailer, sizeof(trailer)))
+				return MEMBERS_NO_TRAILER;
+			gzip->crc32 = load_le32(trailer);
+			gzip->isize = load_le32(trailer + 4);
+			if(gzip->crc32 != check || gzip->isize != (state->total_out & 0xffffffff))
+				return MEMBERS_MISMATCH;
+		} else if(format == FORMAT_ZLIB) {
+			unsigned char trailer[4];
+			if(!read_bytes(&state->stream, trailer, sizeof(trailer)))
+				return MEMBERS_NO_TRAILER;
+			if(load_be32(trailer) != check)
+				return MEMBERS_MISMATCH;
+		}
+
+		if(hooks->end)
+			hooks->end(hooks->opaque, member, gzip, state->total_out);
+		if(format != FORMAT_GZIP || bit_stream_at_end(&state->stream))
+			return MEMBERS_OK;
+	}
+}
+
+const char* members_error(members_result result, file_format format) {
+	switch(result) {
+		case MEMBERS_OK:
+		case MEMBERS_TRAILING_GARBAGE: return NULL;
+		case MEMBERS_BAD_HEADER:
+			return format == FORMAT_GZIP ? "Corrupt gzip header" : "Corrupt zlib header";
+		case MEMBERS_BAD_DATA: return "Corrupt deflate data";
+		case MEMBERS_NO_TRAILER:
+			return format == FORMAT_GZIP ? "Error reading CRC32 and isize" : "Error reading Adler-32";
+		case MEMBERS_MISMATCH:
+			return format == FORMAT_GZIP ? "CRC32 or size mismatch" : "Adler-32 mismatch";
+	}
+	return NULL;
+}
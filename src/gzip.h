@@ -0,0 +1,81 @@
+#ifndef LZIP_GZIP_H
+#define LZIP_GZIP_H
+
+#include <stdbool.h>
+
+#include "inflate.h"
+
+// gzip (RFC 1952) and zlib (RFC 1950) headers in front of the deflate data, and
+// the members they frame
+
+// Framing around the deflate data, raw has none
+typedef enum { FORMAT_GZIP, FORMAT_ZLIB, FORMAT_RAW } file_format;
+
+typedef struct {
+	unsigned char id[2];
+	unsigned char compression_method;
+	unsigned char flags;
+	unsigned char mtime[4];
+	unsigned char extra_flags;
+	unsigned char os;
+} gzip_header;
+
+typedef struct {
+	gzip_header header;
+	unsigned short xlen;
+	unsigned char* extra;
+	char* fname;
+	char* fcomment;
+	unsigned short crc16;
+	unsigned long crc32;
+	unsigned long isize;
+} gzip_file;
+
+enum { FHCRC = 2, FEXTRA = 4, FNAME = 8, FCOMMENT = 16 };
+enum { ZLIB_CMF = 0x78, ZLIB_FDICT = 0x20 };
+// Longer names and comments are cut off, the rest of them is skipped
+enum { MAX_STRING = 65536 };
+
+// Read a null-terminated string from the stream into a new allocation
+bool read_string(bit_stream* in, char** target);
+// Read an RFC 1952-compliant gzip member header
+bool read_gzip_header(bit_stream* in, gzip_file* gzip);
+void free_gzip_file(gzip_file* gzip);
+// Read an RFC 1950 zlib header, streams needing a preset dictionary are rejected
+bool read_zlib_header(bit_stream* in);
+
+typedef enum {
+	MEMBERS_OK,
+	// All members are fine, but something else than a member follows them
+	MEMBERS_TRAILING_GARBAGE,
+	MEMBERS_BAD_HEADER,
+	// inflate() or the check hook failed
+	MEMBERS_BAD_DATA,
+	MEMBERS_NO_TRAILER,
+	MEMBERS_MISMATCH
+} members_result;
+
+// What the caller does around every member of decode_members(), begin and end
+// may be NULL
+typedef struct {
+	// Before the member's data is decoded, the check value starts over then
+	void (*begin)(void* opaque, unsigned member);
+	// The check value of the member's data once it is decoded
+	bool (*check)(void* opaque, unsigned long* check);
+	// After the member matched its trailer, with the header it came with and the
+	// size of its data
+	void (*end)(void* opaque, unsigned member, const gzip_file* gzip, unsigned long long size);
+	void* opaque;
+} member_hooks;
+
+// Decode every member of the stream with the state's sink and check it against
+// its trailer. The header of the first one has to be read already, into gzip for
+// gzip streams, where the headers of the following ones end up too. Only gzip
+// streams have more than one member. Headers and deflate data that don't parse
+// have been reported on stderr.
+members_result decode_members(
+	inflate_state* state, file_format format, gzip_file* gzip, const member_hooks* hooks);
+// What went wrong, NULL if nothing did
+const char* members_error(members_result result, file_format format);
+
+#endif
@@ -0,0 +1,764 @@
+#include "inflate.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bytes.h"
+
+typedef struct {
+	unsigned code;
+	unsigned bit_length;
+} tree_node;
+
+void huffman_pool_reset(huffman_pool* pool) {
+	pool->numof_nodes = 0;
+	pool->invalid.code = INVALID_SYMBOL;
+	pool->invalid.lhs = NULL;
+	pool->invalid.rhs = NULL;
+}
+
+static huffman_node* new_node(huffman_pool* pool) {
+	// The pool is sized for the worst case, see HUFFMAN_POOL_SIZE
+	assert(pool->numof_nodes < HUFFMAN_POOL_SIZE);
+	huffman_node* node = &pool->nodes[pool->numof_nodes++];
+	node->code = -1;
+	node->lhs = NULL;
+	node->rhs = NULL;
+	return node;
+}
+
+// see RFC1951 (https://www.rfc-editor.org/rfc/rfc1951)
+bool build_huffman_tree(
+	huffman_pool* pool, huffman_node* root, unsigned numof_ranges, huffman_range* ranges) {
+	// Determine the maximal bit-length (they are probably unordered)
+	unsigned max_bit_length = 0;
+	for(unsigned i = 0; i < numof_ranges; ++i) {
+		if(ranges[i].bit_length > max_bit_length)
+			max_bit_length = ranges[i].bit_length;
+	}
+
+	unsigned numof_codes_per_length[MAX_CODE_LENGTH + 1];
+	unsigned next_code[MAX_CODE_LENGTH + 1];
+	tree_node tree[MAX_SYMBOLS];
+	assert(max_bit_length <= MAX_CODE_LENGTH && ranges[numof_ranges - 1].end < MAX_SYMBOLS);
+
+	// Determine the number of codes per bit-length
+	memset(numof_codes_per_length, '\0', sizeof(unsigned) * (max_bit_length + 1));
+	for(unsigned i = 0; i < numof_ranges; ++i) {
+		numof_codes_per_length[ranges[i].bit_length] +=
+			ranges[i].end - ((i > 0) ? (int)ranges[i - 1].end : -1);
+	}
+	// Unused symbols don't take up any codes
+	numof_codes_per_length[0] = 0;
+
+	// Over-subscribed codes can't be prefix free, so they are refused. Incomplete
+	// ones are fine, their unused bit sequences lead to the invalid leaf.
+	unsigned bits;
+	int numof_left = 1;
+	for(bits = 1; bits <= max_bit_length; ++bits) {
+		numof_left = 2 * numof_left - numof_codes_per_length[bits];
+		if(numof_left < 0)
+			return false;
+	}
+
+	// Figure out what the first code for each bit-length is
+	memset(next_code, '\0', sizeof(unsigned) * (max_bit_length + 1));
+	bits = 1;
+	unsigned code = 0;
+	for(; bits <= max_bit_length; ++bits) {
+		code = (code + numof_codes_per_length[bits - 1]) << 1;
+		if(numof_codes_per_length[bits])
+			next_code[bits] = code;
+	}
+
+	// Assign a code for each symbol from every range
+	memset(tree, '\0', sizeof(tree_node) * (ranges[numof_ranges - 1].end + 1));
+	unsigned active_range = 0;
+	for(unsigned i = 0; i <= ranges[numof_ranges - 1].end; ++i) {
+		if(i > ranges[active_range].end)
+			++active_range;
+		if(ranges[active_range].bit_length) {
+			tree[i].bit_length = ranges[active_range].bit_length;
+
+			if(tree[i].bit_length != 0) {
+				tree[i].code = next_code[tree[i].bit_length];
+				++next_code[tree[i].bit_length];
+			}
+		}
+	}
+
+	// Transform code table into a Huffman tree
+	unsigned first_node = pool->numof_nodes;
+	root->code = -1;
+	for(unsigned i = 0; i <= ranges[numof_ranges - 1].end; ++i) {
+		huffman_node* node = root;
+		if(tree[i].bit_length) {
+			for(bits = tree[i].bit_length; bits; --bits) {
+				if(tree[i].code & (1 << (bits - 1))) {
+					if(!node->rhs)
+						node->rhs = new_node(pool);
+					node = (huffman_node*)node->rhs;
+				} else {
+					if(!node->lhs)
+						node->lhs = new_node(pool);
+					node = (huffman_node*)node->lhs;
+				}
+			}
+			assert(node->code == -1);
+			node->code = i;
+		}
+	}
+
+	// Decoding never runs into a NULL child, a missing branch is an invalid code
+	for(unsigned i = first_node; i <= pool->numof_nodes; ++i) {
+		huffman_node* node = (i == pool->numof_nodes) ? root : &pool->nodes[i];
+		if(node->code != -1)
+			continue;
+		if(!node->lhs)
+			node->lhs = &pool->invalid;
+		if(!node->rhs)
+			node->rhs = &pool->invalid;
+	}
+	return true;
+}
+
+/**
+ * Build a Huffman tree for the following values:
+ *   0 - 143: 00110000  - 10111111     (8)
+ * 144 - 255: 110010000 - 111111111    (9)
+ * 256 - 279: 0000000   - 0010111      (7)
+ * 280 - 287: 11000000  - 11000111     (8)
+ * See RFC 1951 rules in section 3.2.2
+ * This is used to (de)compress small inputs.
+ */
+void build_fixed_huffman_tree(huffman_pool* pool, huffman_node* root) {
+	huffman_range range[4] = {{143, 8}, {255, 9}, {279, 7}, {287, 8}};
+	// The fixed code is complete
+	build_huffman_tree(pool, root, 4, range);
+}
+
+bool bit_stream_open_file(bit_stream* stream, FILE* source) {
+	memset(stream, '\0', sizeof(bit_stream));
+	stream->source = source;
+	stream->in_buf = malloc(IN_BUF_SIZE);
+	return stream->in_buf != NULL;
+}
+
+bool bit_stream_reopen_file(bit_stream* stream, FILE* source) {
+	if(!stream->in_buf)
+		return bit_stream_open_file(stream, source);
+
+	unsigned char* in_buf = stream->in_buf;
+	memset(stream, '\0', sizeof(bit_stream));
+	stream->source = source;
+	stream->in_buf = in_buf;
+	return true;
+}
+
+void bit_stream_open_memory(bit_stream* stream, const unsigned char* data, size_t len) {
+	memset(stream, '\0', sizeof(bit_stream));
+	stream->next = data;
+	stream->end = data + len;
+	stream->total_in = len;
+}
+
+void bit_stream_open_reader(bit_stream* stream, bit_stream_reader reader, void* opaque) {
+	unsigned char* in_buf = stream->in_buf;
+	memset(stream, '\0', sizeof(bit_stream));
+	stream->reader = reader;
+	stream->reader_opaque = opaque;
+	// Keep a buffer from an earlier file for later reopens
+	stream->in_buf = in_buf;
+}
+
+void bit_stream_close(bit_stream* stream) {
+	free(stream->in_buf);
+	stream->in_buf = NULL;
+}
+
+static bool refill(bit_stream* stream) {
+	if(stream->reader) {
+		const unsigned char* data;
+		size_t len = stream->reader(stream->reader_opaque, &data);
+		if(!len)
+			return false;
+		stream->next = data;
+		stream->end = data + len;
+		stream->total_in += len;
+		return true;
+	}
+	if(!stream->source)
+		return false;
+
+	size_t len = fread(stream->in_buf, 1, IN_BUF_SIZE, stream->source);
+	if(len < 1) {
+		if(ferror(stream->source))
+			perror("Error reading compressed input");
+		return false;
+	}
+	stream->next = stream->in_buf;
+	stream->end = stream->in_buf + len;
+	stream->total_in += len;
+	return true;
+}
+
+unsigned long long bit_stream_position(const bit_stream* stream) {
+	unsigned long long bytes = stream->total_in - (stream->end - stream->next);
+	if(!stream->mask)
+		return 8 * bytes;
+
+	// The current byte was already counted, only the bits below mask were used
+	unsigned used = 0;
+	while((1u << used) < stream->mask)
+		++used;
+	return 8 * (bytes - 1) + used;
+}
+
+bool bit_stream_at_end(bit_stream* stream) {
+	return stream->next == stream->end && !refill(stream);
+}
+
+// Read a single bit from the stream
+unsigned next_bit(bit_stream* stream) {
+	unsigned bit = 0;
+
+	if(!stream->mask) {
+		if(stream->next == stream->end && !refill(stream)) {
+			stream->eof = true;
+			return 0;
+		}
+		stream->buf = *(stream->next++);
+		stream->mask = 1;
+	}
+
+	bit = (stream->buf & stream->mask) ? 1 : 0;
+	// gzip's bit-orderung is absolutely fucked!
+	// bytes should be read sequentially,  interpreting the bits within them is done
+	// right-to-left, but then reversed for interpretation???
+	stream->mask <<= 1;
+
+	return bit;
+}
+
+// Read multiple bits from the stream
+unsigned read_bits(bit_stream* stream, unsigned numof_bits) {
+	unsigned bits_value = 0;
+
+	while(numof_bits--)
+		bits_value = (bits_value << 1) | next_bit(stream);
+
+	return bits_value;
+}
+
+// Values are stored LSB-first, so all bits left in the current byte can be taken
+// at once
+unsigned read_bits_and_invert(bit_stream* stream, unsigned numof_bits) {
+	unsigned bits_value = 0;
+	unsigned shift = 0;
+
+	while(shift < numof_bits) {
+		if(!stream->mask) {
+			if(stream->next == stream->end && !refill(stream)) {
+				stream->eof = true;
+				return bits_value;
+			}
+			stream->buf = *(stream->next++);
+			stream->mask = 1;
+		}
+
+		unsigned used = __builtin_ctz(stream->mask);
+		unsigned n = numof_bits - shift;
+		if(n > 8 - used)
+			n = 8 - used;
+		bits_value |= ((stream->buf >> used) & ((1u << n) - 1)) << shift;
+		shift += n;
+		stream->mask = (used + n == 8) ? 0 : stream->mask << n;
+	}
+
+	return bits_value;
+}
+
+bool read_bytes(bit_stream* stream, unsigned char* target, size_t len) {
+	stream->mask = 0;
+	while(len) {
+		if(stream->next == stream->end && !refill(stream)) {
+			stream->eof = true;
+			return false;
+		}
+		size_t n = stream->end - stream->next;
+		if(n > len)
+			n = len;
+		memcpy(target, stream->next, n);
+		stream->next += n;
+		target += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Build a Huffman tree from input (see 3.2.7)
+bool read_dynamic_huffman_tree(bit_stream* stream, huffman_pool* pool,
+	huffman_node* literals_root, huffman_node* distances_root) {
+	unsigned i, j;
+
+	unsigned code_length_offsets[] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	unsigned hlit = read_bits_and_invert(stream, 5);
+	unsigned hdist = read_bits_and_invert(stream, 5);
+	unsigned hclen = read_bits_and_invert(stream, 4);
+	// Literal/length codes 286 and 287 and distance codes 30 and 31 never occur
+	if(hlit > 29 || hdist > 29) {
+		fprintf(stderr, "Too many literal/length or distance codes.\n");
+		return false;
+	}
+
+	unsigned code_lengths[19];
+	huffman_range code_length_ranges[19];
+	memset(code_lengths, '\0', sizeof(code_lengths));
+	for(i = 0; i < (hclen + 4); ++i)
+		code_lengths[code_length_offsets[i]] = read_bits_and_invert(stream, 3);
+
+	j = 0;
+	for(i = 0; i < 19; ++i) {
+		if((i > 0) && (code_lengths[i] != code_lengths[i - 1]))
+			++j;
+		code_length_ranges[j].end = i;
+		code_length_ranges[j].bit_length = code_lengths[i];
+	}
+
+	huffman_node code_lengths_root;
+	memset(&code_lengths_root, '\0', sizeof(huffman_node));
+	if(!build_huffman_tree(pool, &code_lengths_root, j + 1, code_length_ranges))
+		goto corrupt;
+
+	// Read the literal/length alphabet
+	// This is encoded using the Huffman tree from the previous step. HLIT and
+	// HDIST are 5 bits, so both alphabets take at most 288 + 32 lengths.
+	i = 0;
+	int alphabet[MAX_SYMBOLS + 32];
+	huffman_range alphabet_ranges[MAX_SYMBOLS + 32];
+	unsigned numof_lengths = hlit + hdist + 258;
+	huffman_node* code_lengths_node = &code_lengths_root;
+	while(i < numof_lengths) {
+		if(stream->eof) {
+			fprintf(stderr, "Premature end of file.\n");
+			return false;
+		}
+		if(next_bit(stream))
+			code_lengths_node = code_lengths_node->rhs;
+		else
+			code_lengths_node = code_lengths_node->lhs;
+
+		if(code_lengths_node->code != -1) {
+			if(code_lengths_node->code > 15) {
+				unsigned repeat_length;
+				int repeated = 0;
+
+				switch(code_lengths_node->code) {
+					case 16:
+						// There must be a previous length to repeat
+						if(!i)
+							goto corrupt;
+						repeat_length = read_bits_and_invert(stream, 2) + 3;
+						repeated = alphabet[i - 1];
+						break;
+					case 17: repeat_length = read_bits_and_invert(stream, 3) + 3; break;
+					case 18:
+						repeat_length = read_bits_and_invert(stream, 7) + 11;
+						break;
+					default: goto corrupt;
+				}
+
+				// Repeats must not run past the alphabets
+				if(repeat_length > numof_lengths - i)
+					goto corrupt;
+				while(repeat_length--)
+					alphabet[i++] = repeated;
+			} else {
+				alphabet[i] = code_lengths_node->code;
+				++i;
+			}
+
+			code_lengths_node = &code_lengths_root;
+		}
+	}
+
+	// Without a code for the end of block the block could never end
+	if(!alphabet[256])
+		goto corrupt;
+
+	// Turn alphabet lengths into a valid range declaration and build the final Huffman
+	// code from it
+	j = 0;
+	for(i = 0; i < (hlit + 257); ++i) {
+		if((i > 0) && (alphabet[i] != alphabet[i - 1]))
+			++j;
+		alphabet_ranges[j].end = i;
+		alphabet_ranges[j].bit_length = alphabet[i];
+	}
+
+	if(!build_huffman_tree(pool, literals_root, j + 1, alphabet_ranges))
+		goto corrupt;
+
+	// The distance code lengths directly follow the literal/length ones
+	int* dist_alphabet = alphabet + hlit + 257;
+	j = 0;
+	for(i = 0; i < (hdist + 1); ++i) {
+		if((i > 0) && (dist_alphabet[i] != dist_alphabet[i - 1]))
+			++j;
+		alphabet_ranges[j].end = i;
+		alphabet_ranges[j].bit_length = dist_alphabet[i];
+	}
+
+	if(!build_huffman_tree(pool, distances_root, j + 1, alphabet_ranges))
+		goto corrupt;
+	return true;
+
+corrupt:
+	fprintf(stderr, "Corrupt dynamic Huffman code.\n");
+	return false;
+}
+
+bool inflate_init(inflate_state* state, inflate_sink sink, void* opaque) {
+	memset(state, '\0', sizeof(inflate_state));
+	state->sink = sink;
+	state->opaque = opaque;
+	state->copy_match = match_copy_select()->copy;
+	state->window = malloc(INFLATE_WINDOW_SIZE + MATCH_COPY_SLACK);
+	state->own_window = state->window;
+	state->pool = malloc(sizeof(huffman_pool));
+	return state->window && state->pool;
+}
+
+void inflate_end(inflate_state* state) {
+	free(state->own_window);
+	state->own_window = NULL;
+	free(state->pool);
+	state->window = NULL;
+	state->pool = NULL;
+}
+
+size_t inflate_footprint(void) {
+	return INFLATE_WINDOW_SIZE + MATCH_COPY_SLACK + sizeof(huffman_pool) + IN_BUF_SIZE;
+}
+
+void inflate_reset(inflate_state* state) {
+	state->window = state->next_window ? state->next_window(state->window_opaque) : state->own_window;
+	state->pos = 0;
+	state->flushed = 0;
+	state->total_out = 0;
+}
+
+void inflate_set_dictionary(inflate_state* state, const unsigned char* dict, size_t len) {
+	// Only the last 32K can ever be referenced
+	if(len > MAX_DISTANCE) {
+		dict += len - MAX_DISTANCE;
+		len = MAX_DISTANCE;
+	}
+	memcpy(state->window, dict, len);
+	state->pos = len;
+	state->flushed = len;
+}
+
+// Hand everything that wasn't flushed yet to the sink
+static bool flush_window(inflate_state* state) {
+	size_t len = state->pos - state->flushed;
+	if(len && !state->sink(state->opaque, state->window + state->flushed, len))
+		return false;
+	state->total_out += len;
+	state->flushed = state->pos;
+	return true;
+}
+
+// Flush the window and keep only the last 32K of history
+static bool slide_window(inflate_state* state) {
+	if(!flush_window(state))
+		return false;
+	// The next window may be the same memory again
+	unsigned char* history = state->window + state->pos - MAX_DISTANCE;
+	if(state->next_window)
+		state->window = state->next_window(state->window_opaque);
+	memmove(state->window, history, MAX_DISTANCE);
+	state->pos = MAX_DISTANCE;
+	state->flushed = MAX_DISTANCE;
+	return true;
+}
+
+// A symbol takes at most a 15 bit literal/length code with 5 extra bits and a 15
+// bit distance code with 13 extra bits, and produces at most 258 bytes
+enum { MAX_SYMBOL_BYTES = (15 + 5 + 15 + 13 + 7) / 8, MAX_SYMBOL_OUTPUT = 258 };
+
+// Bit readers for the fast loop, which only runs while the input holds a whole
+// symbol, so they never need to refill
+static inline unsigned next_bit_unchecked(bit_stream* stream) {
+	if(!stream->mask) {
+		stream->buf = *(stream->next++);
+		stream->mask = 1;
+	}
+	unsigned bit = (stream->buf & stream->mask) ? 1 : 0;
+	stream->mask <<= 1;
+	return bit;
+}
+
+static inline unsigned read_bits_and_invert_unchecked(bit_stream* stream, unsigned numof_bits) {
+	unsigned bits_value = 0;
+	for(unsigned shift = 0; shift < numof_bits; ++shift)
+		bits_value |= next_bit_unchecked(stream) << shift;
+	return bits_value;
+}
+
+static inline unsigned take_bit(bit_stream* stream, bool checked) {
+	return checked ? next_bit(stream) : next_bit_unchecked(stream);
+}
+
+static inline unsigned take_bits_and_invert(
+	bit_stream* stream, unsigned numof_bits, bool checked) {
+	return checked ? read_bits_and_invert(stream, numof_bits)
+				   : read_bits_and_invert_unchecked(stream, numof_bits);
+}
+
+enum { SYMBOL_DECODED, SYMBOL_END_OF_BLOCK, SYMBOL_FAILED };
+
+// Decode a single symbol into the window. Unless checked, the caller made sure
+// that the input holds a whole symbol and the window has room for its output, so
+// only what the data itself could get wrong is checked. Inlined into both loops
+// so that checked is a constant.
+static inline __attribute__((always_inline)) int decode_symbol(inflate_state* state,
+	huffman_node* literals_root, huffman_node* distances_root, bool checked) {
+	static const unsigned extra_length_addend[] = {11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
+		51, 59, 67, 83, 99, 115, 131, 163, 195, 227};
+	static const unsigned extra_dist_addend[] = {4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128,
+		192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+		24576};
+
+	bit_stream* stream = &state->stream;
+	inflate_block_stats* stats = state->block_stats;
+	if(checked && stream->eof) {
+		fprintf(stderr, "Premature end of file.\n");
+		return SYMBOL_FAILED;
+	}
+
+	// Bit sequences without a code end at the invalid leaf, so this stops
+	huffman_node* node = literals_root;
+	while(node->code == -1)
+		node = take_bit(stream, checked) ? node->rhs : node->lhs;
+
+	if(node->code > 285) {
+		fprintf(stderr, "Invalid literal/length code.\n");
+		return SYMBOL_FAILED;
+	}
+	if(node->code == 256)
+		return SYMBOL_END_OF_BLOCK;
+
+	// Every symbol produces at most 258 bytes
+	if(checked && state->pos + MAX_SYMBOL_OUTPUT > INFLATE_WINDOW_SIZE && !slide_window(state))
+		return SYMBOL_FAILED;
+
+	if(node->code < 256) {
+		state->window[state->pos++] = node->code;
+		if(stats)
+			++stats->numof_literals;
+		return SYMBOL_DECODED;
+	}
+
+	// This is a back-pointer to a position in the stream
+	// Interpret the length here as specified in 3.2.5
+	unsigned length;
+	if(node->code < 265)
+		length = node->code - 254;
+	else if(node->code < 285) {
+		unsigned extra_bits = take_bits_and_invert(stream, (node->code - 261) / 4, checked);
+		length = extra_bits + extra_length_addend[node->code - 265];
+	} else
+		length = 258;
+
+	// The length is followed by the distance
+	// The distance is coded in 5 bits and may be followed by extra bits
+	// (see 3.2.5)
+	unsigned dist;
+	if(distances_root == NULL) {
+		// Hardcoded distances
+		dist = 0;
+		for(unsigned i = 0; i < 5; ++i)
+			dist = (dist << 1) | take_bit(stream, checked);
+	} else {
+		// Dynamic distances
+		node = distances_root;
+		while(node->code == -1)
+			node = take_bit(stream, checked) ? node->rhs : node->lhs;
+		dist = node->code;
+	}
+
+	if(dist > 29) {
+		fprintf(stderr, "Invalid distance code %u.\n", dist);
+		return SYMBOL_FAILED;
+	}
+	unsigned dist_code = dist;
+	if(dist > 3) {
+		unsigned extra_dist = take_bits_and_invert(stream, (dist - 2) / 2, checked);
+		// Embed the logic in the table at the end of 3.2.5
+		dist = extra_dist + extra_dist_addend[dist - 4];
+	}
+
+	if(dist >= state->pos) {
+		fprintf(stderr, "Back-pointer reaches before the start of the data.\n");
+		return SYMBOL_FAILED;
+	}
+
+	if(stats) {
+		++stats->numof_matches;
+		stats->total_match_length += length;
+		stats->total_match_dist += dist + 1;
+		++stats->dist_histogram[dist_code];
+	}
+
+	state->copy_match(state->window + state->pos, dist + 1, length);
+	state->pos += length;
+	return SYMBOL_DECODED;
+}
+
+bool inflate_huffman_codes(
+	inflate_state* state, huffman_node* literals_root, huffman_node* distances_root) {
+	bit_stream* stream = &state->stream;
+	for(;;) {
+		// Nothing but the data needs checking while a whole symbol's input and output
+		// fit (like libdeflate's fast loop)
+		int result = SYMBOL_DECODED;
+		while(result == SYMBOL_DECODED &&
+			state->pos <= INFLATE_WINDOW_SIZE - MAX_SYMBOL_OUTPUT &&
+			stream->end - stream->next >= MAX_SYMBOL_BYTES)
+			result = decode_symbol(state, literals_root, distances_root, false);
+
+		// Near the end of the input or the window every bit is checked
+		if(result == SYMBOL_DECODED)
+			result = decode_symbol(state, literals_root, distances_root, true);
+		if(result != SYMBOL_DECODED)
+			return result == SYMBOL_END_OF_BLOCK;
+	}
+}
+
+// Stored blocks are copied through the window, they may be referenced later on
+// (see 3.2.4)
+bool inflate_stored(inflate_state* state) {
+	unsigned char header[4];
+	if(!read_bytes(&state->stream, header, sizeof(header))) {
+		fprintf(stderr, "Premature end of file.\n");
+		return false;
+	}
+
+	unsigned len = load_le16(header);
+	unsigned nlen = load_le16(header + 2);
+	if(len != (~nlen & 0xffff)) {
+		fprintf(stderr, "Corrupt length of uncompressed block.\n");
+		return false;
+	}
+
+	while(len) {
+		if(state->pos == INFLATE_WINDOW_SIZE && !slide_window(state))
+			return false;
+		size_t n = INFLATE_WINDOW_SIZE - state->pos;
+		if(n > len)
+			n = len;
+		if(!read_bytes(&state->stream, state->window + state->pos, n)) {
+			fprintf(stderr, "Premature end of file.\n");
+			return false;
+		}
+		state->pos += n;
+		len -= n;
+	}
+	return true;
+}
+
+static double stats_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Bytes decompressed so far, including the ones still in the window
+static unsigned long long output_position(const inflate_state* state) {
+	return state->total_out + state->pos - state->flushed;
+}
+
+// Decompress a deflated input stream compliant
+bool inflate(inflate_state* state) {
+	// Bit 8 indicates if this is the last block
+	// Bits 7 and 6 indicate compression type
+	bit_stream* stream = &state->stream;
+
+	huffman_node literals_root;
+	huffman_node distances_root;
+	inflate_block_stats block;
+	unsigned last_block;
+	do {
+		double start_seconds = 0;
+		double body_start_seconds = 0;
+		unsigned long long start_bits = 0;
+		unsigned long long start_out = 0;
+		if(state->stats_sink) {
+			memset(&block, '\0', sizeof(block));
+			state->block_stats = &block;
+			start_seconds = stats_clock();
+			start_bits = bit_stream_position(stream);
+			start_out = output_position(state);
+		}
+
+		last_block = next_bit(stream);
+		unsigned block_format = read_bits_and_invert(stream, 2);
+		if(stream->eof) {
+			fprintf(stderr, "Premature end of file.\n");
+			return false;
+		}
+
+		// Build the trees of the block, stored blocks just have LEN and NLEN. The
+		// nodes of the previous block's trees are reused.
+		memset(&literals_root, '\0', sizeof(huffman_node));
+		memset(&distances_root, '\0', sizeof(huffman_node));
+		huffman_pool_reset(state->pool);
+		switch(block_format) {
+			case 0: break;
+			// Note, backwards from the spec, since the bits are being read
+			// right-to-left
+			case 1: build_fixed_huffman_tree(state->pool, &literals_root); break;
+			case 2:
+				if(!read_dynamic_huffman_tree(stream, state->pool, &literals_root, &distances_root))
+					return false;
+				break;
+			default:
+				fprintf(stderr, "Error, unsupported block type %x.\n", block_format);
+				return false;
+		}
+
+		if(state->block_stats) {
+			body_start_seconds = stats_clock();
+			block.type = block_format;
+			block.last = last_block;
+			block.header_seconds = body_start_seconds - start_seconds;
+			block.header_bits = bit_stream_position(stream) - start_bits;
+		}
+
+		bool success;
+		switch(block_format) {
+			case 0: success = inflate_stored(state); break;
+			case 1: success = inflate_huffman_codes(state, &literals_root, NULL); break;
+			default:
+				success = inflate_huffman_codes(state, &literals_root, &distances_root);
+				break;
+		}
+		if(!success)
+			return false;
+
+		if(state->block_stats) {
+			block.body_seconds = stats_clock() - body_start_seconds;
+			block.compressed_bits = bit_stream_position(stream) - start_bits;
+			block.uncompressed_size = output_position(state) - start_out;
+			state->block_stats = NULL;
+			state->stats_sink(state->stats_opaque, &block);
+		}
+	} while(!last_block);
+
+	return flush_window(state);
+}
@@ -0,0 +1,159 @@
+#ifndef LZIP_INFLATE_H
+#define LZIP_INFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "match_copy.h"
+
+typedef struct huffman_node {
+	int code;
+	struct huffman_node* lhs;
+	struct huffman_node* rhs;
+} huffman_node;
+
+typedef struct {
+	unsigned end;
+	unsigned bit_length;
+} huffman_range;
+
+// Codes are at most 15 bits long for an alphabet of at most 288 literal/length
+// symbols (see 3.2.7)
+enum { MAX_CODE_LENGTH = 15, MAX_SYMBOLS = 288 };
+// Code of the leaf that bit sequences without a code lead to
+enum { INVALID_SYMBOL = MAX_SYMBOLS };
+// Every code adds at most one node per bit to its tree, so the literal/length,
+// distance and code length trees of a block never take more nodes than this,
+// however the input is crafted
+enum { HUFFMAN_POOL_SIZE = (MAX_SYMBOLS + 32) * MAX_CODE_LENGTH + 19 * 7 };
+
+// Nodes of the trees of one block, handed out in order and all dropped at once
+typedef struct {
+	huffman_node nodes[HUFFMAN_POOL_SIZE];
+	unsigned numof_nodes;
+	huffman_node invalid;
+} huffman_pool;
+
+// Hands out the next chunk of input, which stays valid until the following call.
+// Returns 0 at the end of the input.
+typedef size_t (*bit_stream_reader)(void* opaque, const unsigned char** data);
+
+enum { IN_BUF_SIZE = 65536 };
+typedef struct {
+	// Refills in_buf once the input in memory is used up, NULL for memory input
+	FILE* source;
+	// Pulls the input chunk by chunk instead if set
+	bit_stream_reader reader;
+	void* reader_opaque;
+	unsigned char* in_buf;
+	const unsigned char* next;
+	const unsigned char* end;
+	unsigned char buf;
+	// current bit position within buffer
+	// 128 is MSB, 0 means all bits of buf were used
+	unsigned char mask;
+	bool eof;
+	// Bytes brought into memory so far, used to tell positions in the stream
+	unsigned long long total_in;
+} bit_stream;
+
+bool bit_stream_open_file(bit_stream* stream, FILE* source);
+// Continue with another file, keeping the input buffer of the previous one
+bool bit_stream_reopen_file(bit_stream* stream, FILE* source);
+void bit_stream_open_memory(bit_stream* stream, const unsigned char* data, size_t len);
+void bit_stream_open_reader(bit_stream* stream, bit_stream_reader reader, void* opaque);
+void bit_stream_close(bit_stream* stream);
+// Number of bits consumed since the stream was opened
+unsigned long long bit_stream_position(const bit_stream* stream);
+// Whether there is no more input after the current byte
+bool bit_stream_at_end(bit_stream* stream);
+
+unsigned next_bit(bit_stream* stream);
+unsigned read_bits(bit_stream* stream, unsigned numof_bits);
+unsigned read_bits_and_invert(bit_stream* stream, unsigned numof_bits);
+// Drop the rest of the current byte and read len whole bytes
+bool read_bytes(bit_stream* stream, unsigned char* target, size_t len);
+
+// Drop all trees built from the pool, their roots belong to the callers
+void huffman_pool_reset(huffman_pool* pool);
+// Missing branches of the tree lead to pool->invalid, so walking it always ends at
+// a leaf. False for over-subscribed codes.
+bool build_huffman_tree(
+	huffman_pool* pool, huffman_node* root, unsigned numof_ranges, huffman_range* ranges);
+void build_fixed_huffman_tree(huffman_pool* pool, huffman_node* root);
+// False if the header is truncated or describes no valid code
+bool read_dynamic_huffman_tree(bit_stream* stream, huffman_pool* pool,
+	huffman_node* literals_root, huffman_node* distances_root);
+
+// Receives the decompressed data every time the window is flushed
+typedef bool (*inflate_sink)(void* opaque, const unsigned char* data, size_t len);
+
+// What a single block consisted of, only gathered while a stats sink is set
+typedef struct {
+	// BTYPE, 0 stored, 1 fixed, 2 dynamic Huffman codes
+	unsigned type;
+	bool last;
+	unsigned long long compressed_bits;
+	unsigned long long header_bits;
+	unsigned long long uncompressed_size;
+	unsigned long long numof_literals;
+	unsigned long long numof_matches;
+	unsigned long long total_match_length;
+	unsigned long long total_match_dist;
+	// Matches per distance code (see 3.2.5)
+	unsigned long long dist_histogram[30];
+	double header_seconds;
+	double body_seconds;
+} inflate_block_stats;
+
+typedef void (*inflate_stats_sink)(void* opaque, const inflate_block_stats* stats);
+
+// Memory for the next window (INFLATE_WINDOW_SIZE + MATCH_COPY_SLACK bytes). With
+// it the window may move on to other memory when it slides and for every new
+// stream, so data handed to the sink stays untouched until the caller gives its
+// memory out again.
+typedef unsigned char* (*inflate_window_fn)(void* opaque);
+
+enum { MAX_DISTANCE = 32768, INFLATE_WINDOW_SIZE = 4 * MAX_DISTANCE };
+typedef struct {
+	bit_stream stream;
+	// Sliding window, everything before pos may be referenced by back-pointers
+	unsigned char* window;
+	size_t pos;
+	// Bytes before this offset were already handed to the sink (or belong to the
+	// dictionary)
+	size_t flushed;
+	inflate_sink sink;
+	void* opaque;
+	unsigned long total_out;
+	// Nodes of the current block's trees
+	huffman_pool* pool;
+	// Back-reference copy kernel for this CPU
+	match_copy_fn copy_match;
+	// Takes the window through caller-provided memory if set, the allocated one is
+	// kept in own_window meanwhile
+	inflate_window_fn next_window;
+	void* window_opaque;
+	unsigned char* own_window;
+	// Called after every block if set, statistics are only gathered then
+	inflate_stats_sink stats_sink;
+	void* stats_opaque;
+	inflate_block_stats* block_stats;
+} inflate_state;
+
+bool inflate_init(inflate_state* state, inflate_sink sink, void* opaque);
+void inflate_end(inflate_state* state);
+// Bytes a decoder reading from a file allocates, the same for any input
+size_t inflate_footprint(void);
+// Forget all history, the stream is left alone
+void inflate_reset(inflate_state* state);
+// Preload the window so that back-pointers can reach into the dictionary
+void inflate_set_dictionary(inflate_state* state, const unsigned char* dict, size_t len);
+
+bool inflate_huffman_codes(
+	inflate_state* state, huffman_node* literals_root, huffman_node* distances_root);
+// Decompress a raw deflate stream from state->stream into the sink
+bool inflate(inflate_state* state);
+
+#endif
@@ -0,0 +1,249 @@
+#include "lzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adler32.h"
+#include "bytes.h"
+
+enum {
+	// Deflate with a 32K window (see RFC 1950 section 2.2)
+	ZLIB_CMF = 0x78,
+	ZLIB_FDICT = 0x20
+};
+
+static bool out_buffer_sink(void* opaque, const unsigned char* data, size_t len) {
+	lzip_context* ctx = opaque;
+	lzip_out_buffer* out = ctx->inflate_out;
+	if(len > out->size - out->pos) {
+		ctx->inflate_out_fits = false;
+		return false;
+	}
+	memcpy(out->data + out->pos, data, len);
+	out->pos += len;
+	return true;
+}
+
+bool lzip_context_init(lzip_context* ctx, int level, lzip_format format) {
+	memset(ctx, '\0', sizeof(lzip_context));
+	ctx->format = format;
+	ctx->adler = 1;
+	if(!deflate_init(&ctx->deflate, level))
+		return false;
+	if(!inflate_init(&ctx->inflate, out_buffer_sink, ctx)) {
+		deflate_end(&ctx->deflate);
+		return false;
+	}
+	return true;
+}
+
+void lzip_context_free(lzip_context* ctx) {
+	deflate_end(&ctx->deflate);
+	inflate_end(&ctx->inflate);
+	free(ctx->dict);
+}
+
+bool lzip_set_dictionary(lzip_context* ctx, const unsigned char* dict, size_t len) {
+	// The window already holds the old dictionary and the stream's data
+	if(ctx->started)
+		return false;
+
+	// Only the last 32K can ever be referenced
+	if(len > MAX_DISTANCE) {
+		dict += len - MAX_DISTANCE;
+		len = MAX_DISTANCE;
+	}
+
+	unsigned char* copy = malloc(len ? len : 1);
+	if(!copy)
+		return false;
+	if(len)
+		memcpy(copy, dict, len);
+	free(ctx->dict);
+	ctx->dict = copy;
+	ctx->dict_len = len;
+	ctx->dict_id = adler32_update(1, dict, len);
+	return true;
+}
+
+void lzip_deflate_reset(lzip_context* ctx) {
+	deflate_reset(&ctx->deflate);
+	ctx->started = false;
+	ctx->out_drained = 0;
+	ctx->flushed = false;
+	ctx->adler = 1;
+	ctx->header_written = false;
+	ctx->total_in = 0;
+	ctx->total_out = 0;
+}
+
+static bool write_zlib_header(lzip_context* ctx) {
+	unsigned char header[6];
+	size_t len = 2;
+
+	// FLEVEL is informational only
+	int level = ctx->deflate.level;
+	unsigned flevel = level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3;
+	unsigned flg = flevel << 6;
+	if(ctx->dict) {
+		flg |= ZLIB_FDICT;
+		store_be32(header + 2, ctx->dict_id);
+		len += 4;
+	}
+	flg += (31 - (ZLIB_CMF * 256 + flg) % 31) % 31;
+
+	header[0] = ZLIB_CMF;
+	header[1] = flg;
+	return deflate_put_bytes(&ctx->deflate, header, len);
+}
+
+// Copy pending compressed bytes to out, returns true if nothing is left over
+static bool drain(lzip_context* ctx, lzip_out_buffer* out) {
+	bit_writer* w = &ctx->deflate.out;
+	size_t n = w->len - ctx->out_drained;
+	if(n > out->size - out->pos)
+		n = out->size - out->pos;
+
+	// The bit writer has no buffer before its first output
+	if(n)
+		memcpy(out->data + out->pos, w->buf + ctx->out_drained, n);
+	out->pos += n;
+	ctx->out_drained += n;
+	ctx->total_out += n;
+
+	if(ctx->out_drained < w->len)
+		return false;
+	w->len = 0;
+	ctx->out_drained = 0;
+	return true;
+}
+
+lzip_status lzip_deflate(
+	lzip_context* ctx, lzip_in_buffer* in, lzip_out_buffer* out, lzip_flush flush) {
+	deflate_state* s = &ctx->deflate;
+
+	// Don't take more input while older output is still waiting
+	if(!drain(ctx, out))
+		return LZIP_OK;
+	if(s->finished)
+		return LZIP_STREAM_END;
+
+	// Prime the window before the header names the dictionary
+	if(!ctx->started) {
+		if(ctx->dict && !deflate_set_dictionary(s, ctx->dict, ctx->dict_len))
+			return LZIP_ERROR;
+		ctx->started = true;
+	}
+	if(ctx->format == LZIP_FORMAT_ZLIB && !ctx->header_written) {
+		if(!write_zlib_header(ctx))
+			return LZIP_ERROR;
+		ctx->header_written = true;
+	}
+
+	// Input is taken a chunk at a time while out has room, so what is held back for
+	// the caller stays around the compressed size of one chunk. The flush applies
+	// to the chunk that ends the input.
+	do {
+		size_t len = in->size - in->pos;
+		if(len > LZIP_DEFLATE_CHUNK)
+			len = LZIP_DEFLATE_CHUNK;
+		bool last = len == in->size - in->pos;
+		if(!len && ctx->flushed && (flush == LZIP_SYNC_FLUSH || flush == LZIP_FULL_FLUSH))
+			break;
+
+		if(!deflate_compress(s, in->data + in->pos, len, last ? flush : LZIP_NO_FLUSH))
+			return LZIP_ERROR;
+		if(ctx->format == LZIP_FORMAT_ZLIB)
+			ctx->adler = adler32_update(ctx->adler, in->data + in->pos, len);
+		in->pos += len;
+		ctx->total_in += len;
+		if(len)
+			ctx->flushed = false;
+		if(last && (flush == LZIP_SYNC_FLUSH || flush == LZIP_FULL_FLUSH))
+			ctx->flushed = true;
+
+		if(s->finished && ctx->format == LZIP_FORMAT_ZLIB) {
+			unsigned char trailer[4];
+			store_be32(trailer, ctx->adler);
+			if(!deflate_put_bytes(s, trailer, sizeof(trailer)))
+				return LZIP_ERROR;
+		}
+		if(last)
+			break;
+	} while(drain(ctx, out) && out->pos < out->size);
+
+	if(drain(ctx, out) && s->finished)
+		return LZIP_STREAM_END;
+	return LZIP_OK;
+}
+
+// Parse the zlib header, returns false if it is broken or asks for a dictionary
+// other than ours
+static bool read_zlib_header(lzip_context* ctx, bit_stream* stream, bool* has_dict) {
+	unsigned char header[2];
+	if(!read_bytes(stream, header, sizeof(header))) {
+		fprintf(stderr, "Premature end of zlib header\n");
+		return false;
+	}
+	if((header[0] & 0x0f) != 8 || (header[0] >> 4) > 7 ||
+		(header[0] * 256 + header[1]) % 31) {
+		fprintf(stderr, "Invalid zlib header\n");
+		return false;
+	}
+
+	*has_dict = header[1] & ZLIB_FDICT;
+	if(!*has_dict)
+		return true;
+
+	unsigned char dict_id[4];
+	if(!read_bytes(stream, dict_id, sizeof(dict_id))) {
+		fprintf(stderr, "Premature end of zlib header\n");
+		return false;
+	}
+	if(!ctx->dict || load_be32(dict_id) != ctx->dict_id) {
+		fprintf(stderr, "Stream needs a different dictionary (id %08lx)\n",
+			load_be32(dict_id));
+		return false;
+	}
+	return true;
+}
+
+lzip_status lzip_inflate(lzip_context* ctx, lzip_in_buffer* in, lzip_out_buffer* out) {
+	inflate_state* s = &ctx->inflate;
+	const unsigned char* start = in->data + in->pos;
+	size_t out_start = out->pos;
+
+	bit_stream_open_memory(&s->stream, start, in->size - in->pos);
+	inflate_reset(s);
+	ctx->inflate_out = out;
+	ctx->inflate_out_fits = true;
+
+	bool has_dict = ctx->dict != NULL;
+	if(ctx->format == LZIP_FORMAT_ZLIB && !read_zlib_header(ctx, &s->stream, &has_dict))
+		return LZIP_ERROR;
+	if(has_dict)
+		inflate_set_dictionary(s, ctx->dict, ctx->dict_len);
+
+	if(!inflate(s)) {
+		if(!ctx->inflate_out_fits)
+			fprintf(stderr, "Output buffer too small\n");
+		return LZIP_ERROR;
+	}
+
+	if(ctx->format == LZIP_FORMAT_ZLIB) {
+		unsigned char trailer[4];
+		if(!read_bytes(&s->stream, trailer, sizeof(trailer))) {
+			fprintf(stderr, "Premature end of zlib trailer\n");
+			return LZIP_ERROR;
+		}
+		unsigned long adler = adler32_update(1, out->data + out_start, out->pos - out_start);
+		if(load_be32(trailer) != adler) {
+			fprintf(stderr, "Adler-32 mismatch\n");
+			return LZIP_ERROR;
+		}
+	}
+
+	in->pos += s->stream.next - start;
+	return LZIP_STREAM_END;
+}
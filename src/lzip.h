@@ -0,0 +1,88 @@
+#ifndef LZIP_LZIP_H
+#define LZIP_LZIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "deflate.h"
+#include "inflate.h"
+
+typedef enum { LZIP_OK, LZIP_STREAM_END, LZIP_ERROR } lzip_status;
+
+// Input lzip_deflate() compresses before it hands out the output again
+enum { LZIP_DEFLATE_CHUNK = 64 * 1024 };
+
+typedef enum {
+	// Bare deflate data (RFC 1951), a dictionary has to be agreed upon out of band
+	LZIP_FORMAT_RAW,
+	// zlib framing (RFC 1950) with the Adler-32 of a preset dictionary in the header
+	LZIP_FORMAT_ZLIB
+} lzip_format;
+
+typedef struct {
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+} lzip_in_buffer;
+
+typedef struct {
+	unsigned char* data;
+	size_t size;
+	size_t pos;
+} lzip_out_buffer;
+
+// Long-lived state for incremental (de)compression. All buffers are allocated once
+// in lzip_context_init(), resetting the context between messages keeps them.
+typedef struct {
+	lzip_format format;
+	deflate_state deflate;
+	inflate_state inflate;
+	// Preset dictionary shared by both directions, NULL if none was set
+	unsigned char* dict;
+	size_t dict_len;
+	unsigned long dict_id;
+	// lzip_deflate() was called since the last reset, the window is primed with
+	// the dictionary then
+	bool started;
+	// Running Adler-32 of the uncompressed data for zlib framing
+	unsigned long adler;
+	bool header_written;
+	// Target of lzip_inflate(), false if the output didn't fit
+	lzip_out_buffer* inflate_out;
+	bool inflate_out_fits;
+	// Bytes of deflate.out already handed to the caller
+	size_t out_drained;
+	// No input arrived since the last sync or full flush
+	bool flushed;
+	unsigned long total_in;
+	unsigned long total_out;
+} lzip_context;
+
+bool lzip_context_init(lzip_context* ctx, int level, lzip_format format);
+void lzip_context_free(lzip_context* ctx);
+
+// Use dict as the preset dictionary for all following streams in both directions.
+// Call after lzip_context_init() or lzip_deflate_reset(), before the stream's
+// first lzip_deflate(). Fails once that was called or if out of memory, the
+// dictionary in use is kept then. Small messages compress much better if the
+// dictionary contains strings they are likely to share (see RFC 1950 section
+// 2.2, FDICT).
+bool lzip_set_dictionary(lzip_context* ctx, const unsigned char* dict, size_t len);
+
+// Start a new stream on an existing context, the dictionary is kept and primed
+// again by the stream's first lzip_deflate()
+void lzip_deflate_reset(lzip_context* ctx);
+
+// Compress from in into out, taking input in chunks of LZIP_DEFLATE_CHUNK bytes
+// for as long as out has room. in->pos is advanced past what was consumed. Call
+// again with the rest of the input and the same flush while input is left or out
+// is full, the flush takes effect once all input is consumed. Returns
+// LZIP_STREAM_END once LZIP_FINISH wrote everything.
+lzip_status lzip_deflate(
+	lzip_context* ctx, lzip_in_buffer* in, lzip_out_buffer* out, lzip_flush flush);
+
+// Decompress one complete stream from in, which must fit into out. Returns
+// LZIP_STREAM_END with in->pos right after the stream or LZIP_ERROR.
+lzip_status lzip_inflate(lzip_context* ctx, lzip_in_buffer* in, lzip_out_buffer* out);
+
+#endif
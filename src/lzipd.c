@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "args.h"
+#include "cache.h"
+#include "daemon.h"
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-p threads] [-c cache_dir [-s cache_size]] <socket>\n", name);
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	long numof_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* cache_dir = NULL;
+	size_t cache_size = CACHE_DEFAULT_SIZE;
+	decode_cache cache;
+	int opt;
+	while((opt = getopt(argc, argv, "p:c:s:")) != -1) {
+		if(opt == 'p') {
+			numof_threads = atol(optarg);
+			if(numof_threads < 1)
+				usage(argv[0]);
+		} else if(opt == 'c')
+			cache_dir = optarg;
+		else if(opt == 's') {
+			if(!parse_size(optarg, &cache_size) || !cache_size)
+				usage(argv[0]);
+		} else
+			usage(argv[0]);
+	}
+	if(optind + 1 != argc)
+		usage(argv[0]);
+
+	if(cache_dir && !cache_open(&cache, cache_dir, cache_size))
+		exit(1);
+	bool success = lzipd_serve(
+		argv[optind], numof_threads > 0 ? numof_threads : 1, cache_dir ? &cache : NULL);
+	if(cache_dir)
+		cache_close(&cache);
+	exit(success ? 0 : 1);
+}
@@ -1,580 +1,1458 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
-typedef struct {
-	unsigned char id[2];
-	unsigned char compression_method;
-	unsigned char flags;
-	unsigned char mtime[4];
-	unsigned char extra_flags;
-	unsigned char os;
-} gzip_header;
+#include "adler32.h"
+#include "args.h"
+#include "bytes.h"
+#include "cache.h"
+#include "count.h"
+#include "crc32.h"
+#include "daemon.h"
+#include "deflate.h"
+#include "gzip.h"
+#include "inflate.h"
+#include "paths.h"
+#include "pipeline.h"
+#include "search.h"
+#include "splice.h"
+#include "tar.h"
+#include "zip.h"
+
+bool write_all(int fd, const unsigned char* buf, size_t len) {
+	while(len) {
+		ssize_t written = write(fd, buf, len);
+		if(written < 0) {
+			perror("Error writing output");
+			return false;
+		}
+		buf += written;
+		len -= written;
+	}
+	return true;
+}
 
 typedef struct {
-	gzip_header header;
-	unsigned short xlen;
-	unsigned char* extra;
-	char* fname;
-	char* fcomment;
-	unsigned short crc16;
-	unsigned long crc32;
-	unsigned long isize;
-} gzip_file;
-
+	const char* name;
+	// Appended when compressing, stripped when decompressing
+	const char* suffix;
+} format_info;
+
+static const format_info formats[] = {
+	[FORMAT_GZIP] = {"gzip", ".gz"},
+	[FORMAT_ZLIB] = {"zlib", ".zz"},
+	[FORMAT_RAW] = {"raw", ".deflate"},
+};
+
+// Decompressed data goes to the output file while the check value of the format
+// is computed on the way
 typedef struct {
-	unsigned code;
-	unsigned bit_length;
-} tree_node;
+	file_format format;
+	int fd;
+	unsigned long check;
+	// Extracts the data as a tarball instead of writing it if set
+	tar_extractor* tar;
+	// Prints matching lines instead of writing the data if set
+	searcher* search;
+	// Counts records instead of writing the data if set
+	record_counter* counter;
+	// Splices the data into the pipe fd refers to instead of writing it if set
+	splice_writer* splice;
+} output_file;
+
+bool output_sink(void* opaque, const unsigned char* data, size_t len) {
+	output_file* out = opaque;
+	if(out->format == FORMAT_GZIP)
+		out->check = crc32_update(out->check, data, len);
+	else if(out->format == FORMAT_ZLIB)
+		out->check = adler32_update(out->check, data, len);
+	if(out->tar)
+		return tar_write(out->tar, data, len);
+	if(out->search)
+		return search_write(out->search, data, len);
+	if(out->counter)
+		return record_counter_write(out->counter, data, len);
+	if(out->splice)
+		return splice_write(out->splice, data, len);
+	// Nothing is written when only testing
+	return out->fd < 0 || write_all(out->fd, data, len);
+}
 
-typedef struct huffman_node {
-	int code;
-	struct huffman_node* lhs;
-	struct huffman_node* rhs;
-} huffman_node;
+// Name of the decompressed file if the header doesn't store one
+char* strip_suffix(const char* path, file_format format) {
+	const char* suffix = formats[format].suffix;
+	size_t len = strlen(path);
+	size_t suffix_len = strlen(suffix);
+	char* target = malloc(len + 5);
+	if(!target)
+		return NULL;
+
+	if(len > suffix_len && !strcmp(path + len - suffix_len, suffix)) {
+		memcpy(target, path, len - suffix_len);
+		target[len - suffix_len] = '\0';
+	} else
+		sprintf(target, "%s.out", path);
+	return target;
+}
 
+// Per-block statistics printed by --stats, summed up per member and overall
 typedef struct {
-	unsigned end;
-	unsigned bit_length;
-} huffman_range;
-
-// see RFC1951 (https://www.rfc-editor.org/rfc/rfc1951)
-void build_huffman_tree(
-	huffman_node* root, unsigned numof_ranges, huffman_range* ranges) {
-	// Determine the maximal bit-length (they are probably unordered)
-	unsigned max_bit_length = 0;
-	for(unsigned i = 0; i < numof_ranges; ++i) {
-		if(ranges[i].bit_length > max_bit_length)
-			max_bit_length = ranges[i].bit_length;
-	}
-
-	unsigned* numof_codes_per_length = malloc(sizeof(unsigned) * (max_bit_length + 1));
-	unsigned* next_code = malloc(sizeof(unsigned) * (max_bit_length + 1));
-	tree_node* tree = malloc(sizeof(tree_node) * (ranges[numof_ranges - 1].end + 1));
-
-	// Determine the number of codes per bit-length
-	memset(numof_codes_per_length, '\0', sizeof(unsigned) * (max_bit_length + 1));
-	for(unsigned i = 0; i < numof_ranges; ++i) {
-		numof_codes_per_length[ranges[i].bit_length] +=
-			ranges[i].end - ((i > 0) ? (int)ranges[i - 1].end : -1);
-	}
-
-	// Figure out what the first code for each bit-length is
-	memset(next_code, '\0', sizeof(unsigned) * (max_bit_length + 1));
-	unsigned bits = 1;
-	unsigned code = 0;
-	for(; bits <= max_bit_length; ++bits) {
-		code = (code + numof_codes_per_length[bits - 1]) << 1;
-		if(numof_codes_per_length[bits])
-			next_code[bits] = code;
-	}
-
-	// Assign a code for each symbol from every range
-	memset(tree, '\0', sizeof(tree_node) * (ranges[numof_ranges - 1].end + 1));
-	unsigned active_range = 0;
-	for(unsigned i = 0; i <= ranges[numof_ranges - 1].end; ++i) {
-		if(i > ranges[active_range].end)
-			++active_range;
-		if(ranges[active_range].bit_length) {
-			tree[i].bit_length = ranges[active_range].bit_length;
-
-			if(tree[i].bit_length != 0) {
-				tree[i].code = next_code[tree[i].bit_length];
-				++next_code[tree[i].bit_length];
-			}
-		}
-	}
+	unsigned numof_blocks;
+	unsigned numof_members;
+	inflate_block_stats member;
+	inflate_block_stats overall;
+} decode_stats;
+
+static const char* const block_types[] = {"stored", "fixed", "dynamic"};
+
+static double wall_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	// Transform code table into a Huffman tree
-	root->code = -1;
-	for(unsigned i = 0; i <= ranges[numof_ranges - 1].end; ++i) {
-		huffman_node* node = root;
-		if(tree[i].bit_length) {
-			for(bits = tree[i].bit_length; bits; --bits) {
-				if(tree[i].code & (1 << (bits - 1))) {
-					if(!node->rhs) {
-						node->rhs = malloc(sizeof(huffman_node));
-						memset(node->rhs, '\0', sizeof(huffman_node));
-						node->rhs->code = -1;
-					}
-					node = (huffman_node*)node->rhs;
-				} else {
-					if(!node->lhs) {
-						node->lhs = malloc(sizeof(huffman_node));
-						memset(node->lhs, '\0', sizeof(huffman_node));
-						node->lhs->code = -1;
-					}
-					node = (huffman_node*)node->lhs;
-				}
-			}
-			assert(node->code == -1);
-			node->code = i;
-		}
-	}
+static void add_block_stats(inflate_block_stats* total, const inflate_block_stats* block) {
+	total->compressed_bits += block->compressed_bits;
+	total->header_bits += block->header_bits;
+	total->uncompressed_size += block->uncompressed_size;
+	total->numof_literals += block->numof_literals;
+	total->numof_matches += block->numof_matches;
+	total->total_match_length += block->total_match_length;
+	total->total_match_dist += block->total_match_dist;
+	for(unsigned i = 0; i < 30; ++i)
+		total->dist_histogram[i] += block->dist_histogram[i];
+	total->header_seconds += block->header_seconds;
+	total->body_seconds += block->body_seconds;
+}
+
+static double average(unsigned long long total, unsigned long long count) {
+	return count ? (double)total / count : 0;
+}
+
+static double mb_per_s(const inflate_block_stats* stats, double seconds) {
+	return seconds > 0 ? stats->uncompressed_size / seconds / 1e6 : 0;
+}
+
+void print_block_stats(void* opaque, const inflate_block_stats* block) {
+	decode_stats* stats = opaque;
+	if(!stats->numof_blocks)
+		printf("  %5s %-7s %10s %10s %10s %9s %8s %9s %10s %10s\n", "block", "type",
+			"in bytes", "out bytes", "literals", "matches", "avg len", "avg dist",
+			"header us", "body us");
+
+	printf("  %5u %-7s %10llu %10llu %10llu %9llu %8.1f %9.1f %10.1f %10.1f\n",
+		stats->numof_blocks, block_types[block->type], (block->compressed_bits + 7) / 8,
+		block->uncompressed_size, block->numof_literals, block->numof_matches,
+		average(block->total_match_length, block->numof_matches),
+		average(block->total_match_dist, block->numof_matches), block->header_seconds * 1e6,
+		block->body_seconds * 1e6);
+
+	++stats->numof_blocks;
+	add_block_stats(&stats->member, block);
+}
 
-	free(numof_codes_per_length);
-	free(next_code);
-	free(tree);
+static void print_totals(const inflate_block_stats* total, double seconds) {
+	printf("  %llu -> %llu bytes, %llu literals, %llu matches, avg len %.1f, avg dist %.1f\n",
+		(total->compressed_bits + 7) / 8, total->uncompressed_size, total->numof_literals,
+		total->numof_matches, average(total->total_match_length, total->numof_matches),
+		average(total->total_match_dist, total->numof_matches));
+	printf("  headers %.3f ms (%llu bytes), bodies %.3f ms, %.2f MB/s\n",
+		total->header_seconds * 1e3, (total->header_bits + 7) / 8, total->body_seconds * 1e3,
+		mb_per_s(total, seconds));
+
+	if(!total->numof_matches)
+		return;
+	// Two distance codes cover each power of two (see 3.2.5)
+	printf("  distances:");
+	for(unsigned bucket = 0; bucket < 14; ++bucket) {
+		unsigned long long count = bucket ? total->dist_histogram[2 * bucket + 2] +
+				total->dist_histogram[2 * bucket + 3]
+										  : total->dist_histogram[0] + total->dist_histogram[1] +
+				total->dist_histogram[2] + total->dist_histogram[3];
+		if(count)
+			printf(" %u-%u: %llu", bucket ? (1u << (bucket + 1)) + 1 : 1, 1u << (bucket + 2),
+				count);
+	}
+	printf("\n");
 }
 
-/**
- * Build a Huffman tree for the following values:
- *   0 - 143: 00110000  - 10111111     (8)
- * 144 - 255: 110010000 - 111111111    (9)
- * 256 - 279: 0000000   - 0010111      (7)
- * 280 - 287: 11000000  - 11000111     (8)
- * See RFC 1951 rules in section 3.2.2
- * This is used to (de)compress small inputs.
- */
-void build_fixed_huffman_tree(huffman_node* root) {
-	huffman_range range[4] = {{143, 8}, {255, 9}, {279, 7}, {287, 8}};
-	build_huffman_tree(root, 4, range);
+void print_member_stats(decode_stats* stats) {
+	printf("  member total, %u blocks:\n", stats->numof_blocks);
+	print_totals(&stats->member, stats->member.header_seconds + stats->member.body_seconds);
+
+	add_block_stats(&stats->overall, &stats->member);
+	memset(&stats->member, '\0', sizeof(inflate_block_stats));
+	stats->numof_blocks = 0;
+	++stats->numof_members;
 }
 
+// One line of -l output, sizes are summed over all members
+typedef struct {
+	unsigned long long compressed_size;
+	unsigned long long uncompressed_size;
+	unsigned numof_members;
+	// MTIME and FNAME of the first member, fname may be NULL
+	unsigned long mtime;
+	char* fname;
+} file_listing;
+
 typedef struct {
-	FILE* source;
-	unsigned char buf;
-	// current bit position within buffer
-	// 8 is MSB
-	unsigned char mask;
-} bit_stream;
+	file_format format;
+	// Decode and check every member but create no output file
+	bool test;
+	bool print_stats;
+	// Read, decode, check and write on separate threads
+	bool pipeline;
+	// Chunks in flight per direction and whether the pipeline may use io_uring
+	unsigned queue_depth;
+	bool use_uring;
+	// Extract the decompressed data as a tarball, test only parses it
+	bool untar;
+	bool preallocate;
+	// Print the lines matching any of these instead of writing the data
+	search_patterns* search;
+	// Print the number of records ending in the delimiter and of bytes instead of
+	// writing the data, for every member too if count_members is set
+	bool count_records;
+	unsigned char delimiter;
+	bool count_members;
+	// Filled in while decoding if set, only used together with test
+	file_listing* listing;
+	// Socket of an lzipd doing the decoding instead of this process if set
+	const char* daemon;
+	// Outputs of earlier runs, only for plain decompression into files
+	decode_cache* cache;
+	// Write the data of all files to stdout one after another, spliced into it if
+	// splice is set
+	bool to_stdout;
+	splice_writer* splice;
+} decompress_options;
+
+// Decoding buffers are set up once and reused for every file of a batch
+bool decoder_init(inflate_state* state) {
+	bool success = inflate_init(state, output_sink, NULL) &&
+		bit_stream_open_file(&state->stream, NULL);
+	if(!success)
+		fprintf(stderr, "Out of memory.\n");
+	return success;
+}
 
-// Read a single bit from the stream
-unsigned next_bit(bit_stream* stream) {
-	unsigned bit = 0;
+void decoder_end(inflate_state* state) {
+	bit_stream_close(&state->stream);
+	inflate_end(state);
+}
 
-	bit = (stream->buf & stream->mask) ? 1 : 0;
-	// gzip's bit-orderung is absolutely fucked!
-	// bytes should be read sequentially,  interpreting the bits within them is done
-	// right-to-left, but then reversed for interpretation???
-	stream->mask <<= 1;
+// The stored name comes from the input, so like gzip -N only its last component
+// is used and the output stays in the current directory. NULL if nothing usable is
+// left.
+static char* stored_name(const char* fname) {
+	const char* name = strrchr(fname, '/') ? strrchr(fname, '/') + 1 : fname;
+	if(!*name || !strcmp(name, ".") || !strcmp(name, ".."))
+		return NULL;
+	return strdup(name);
+}
 
-	if(!stream->mask) {
-		stream->mask = 1;
-		if(fread(&stream->buf, 1, 1, stream->source) < 1)
-			perror("Error reading compressed input");
+// Have lzipd decompress or test the file. The output is named like by
+// decompress_file(), so the header is read here as well, the daemon then reads
+// the input again from the start.
+static bool decompress_remote(const char* path, const decompress_options* options) {
+	lzipd_request request;
+	lzipd_reply reply;
+	bool success = false;
+	char* target = NULL;
+	int out_fd = -1;
+	int connection = -1;
+	FILE* in = fopen(path, "r");
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
 	}
 
-	return bit;
-}
+	memset(&request, '\0', sizeof(request));
+	request.version = LZIPD_VERSION;
+	request.format = options->format;
+	request.flags = LZIPD_INPUT_FD | (options->test ? LZIPD_TEST : 0);
+	if(!options->test) {
+		if(options->format == FORMAT_GZIP) {
+			bit_stream stream;
+			gzip_file gzip;
+			memset(&gzip, '\0', sizeof(gzip));
+			bool header_read =
+				bit_stream_open_file(&stream, in) && read_gzip_header(&stream, &gzip);
+			target = (header_read && gzip.fname) ? stored_name(gzip.fname) : NULL;
+			free_gzip_file(&gzip);
+			bit_stream_close(&stream);
+			if(!header_read || lseek(fileno(in), 0, SEEK_SET) < 0)
+				goto done;
+		}
+		if(!target && !(target = strip_suffix(path, options->format))) {
+			fprintf(stderr, "Out of memory.\n");
+			goto done;
+		}
+		// Readable so that the daemon can keep the output in its cache
+		out_fd = open(target, O_RDWR | O_CREAT | O_EXCL, 0744);
+		if(out_fd < 0) {
+			perror("Target already exists");
+			goto done;
+		}
+	}
 
-// Read multiple bits from the stream
-unsigned read_bits(bit_stream* stream, unsigned numof_bits) {
-	unsigned bits_value = 0;
+	if((connection = lzipd_connect(options->daemon)) < 0 ||
+		!lzipd_call(connection, &request, fileno(in), out_fd, &reply))
+		goto done;
+	if(!reply.success) {
+		fprintf(stderr, "%s: %s.\n", path, reply.error);
+		goto done;
+	}
 
-	while(numof_bits--)
-		bits_value = (bits_value << 1) | next_bit(stream);
+	struct timespec times[2] = {{reply.mtime, 0}, {reply.mtime, 0}};
+	if(out_fd >= 0 && options->format == FORMAT_GZIP && futimens(out_fd, times) < 0) {
+		perror("Could not set mtime");
+		goto done;
+	}
+	success = true;
 
-	return bits_value;
+done:
+	if(connection >= 0)
+		close(connection);
+	if(out_fd >= 0 && close(out_fd) < 0) {
+		perror("Could not close output file");
+		success = false;
+	}
+	free(target);
+	fclose(in);
+	return success;
 }
 
-unsigned read_bits_and_invert(bit_stream* stream, unsigned numof_bits) {
-	unsigned bits_value = 0;
+// What decompress_file() does around every member
+typedef struct {
+	const char* path;
+	const decompress_options* options;
+	inflate_state* state;
+	output_file* out;
+	unsigned long initial_check;
+	// The check value comes from the pipeline's check thread if set
+	pipeline* pipe;
+	decode_stats* stats;
+	record_counter* counter;
+	unsigned long long member_records;
+	unsigned long long total_size;
+} file_members;
+
+static void member_begin(void* opaque, unsigned member) {
+	file_members* members = opaque;
+	if(members->options->print_stats)
+		printf("%s member %u\n", members->path, member);
+	members->out->check = members->initial_check;
+	members->member_records = members->counter->numof_records;
+}
 
-	for(unsigned i = 0; i < numof_bits; ++i)
-		bits_value |= (next_bit(stream) << i);
+static bool member_check(void* opaque, unsigned long* check) {
+	file_members* members = opaque;
+	// The check thread may still be behind the decoder
+	if(members->pipe && !pipeline_member_check(members->pipe, &members->out->check))
+		return false;
+	*check = members->out->check;
+	return true;
+}
 
-	return bits_value;
+static void member_end(
+	void* opaque, unsigned member, const gzip_file* gzip, unsigned long long size) {
+	file_members* members = opaque;
+	const decompress_options* options = members->options;
+	if(options->print_stats)
+		print_member_stats(members->stats);
+	if(options->count_members) {
+		printf("%12llu %12llu %s member %u\n",
+			members->counter->numof_records - members->member_records, size, members->path,
+			member);
+	}
+	file_listing* listing = options->listing;
+	if(listing) {
+		if(!listing->numof_members++) {
+			listing->mtime = load_le32(gzip->header.mtime);
+			listing->fname = gzip->fname ? strdup(gzip->fname) : NULL;
+		}
+		listing->uncompressed_size += size;
+		// Trailing garbage doesn't count
+		listing->compressed_size = bit_stream_position(&members->state->stream) / 8;
+	}
+	members->total_size += size;
 }
 
-// Build a Huffman tree from input (see 3.2.7)
-void read_dynamic_huffman_tree(
-	bit_stream* stream, huffman_node* literals_root, huffman_node* distances_root) {
-	unsigned i, j;
+// Strip off the header of the given format and decompress the contents using a
+// decoder set up by decoder_init. When testing, every member is decoded and
+// checked but no output file is created.
+bool decompress_file(
+	const char* path, const decompress_options* options, inflate_state* state) {
+	if(options->daemon)
+		return decompress_remote(path, options);
+
+	file_format format = options->format;
+	bool test = options->test;
+	bool print_stats = options->print_stats;
+	FILE* in;
+	gzip_file gzip;
+	decode_stats stats;
+	bool success = false;
+	char* target = NULL;
+	double start_seconds = wall_clock();
+	output_file out = {format, -1, 0, NULL, NULL, NULL, NULL};
+	tar_extractor tar;
+	searcher search;
+	record_counter counter;
+	pipeline pipe;
+	bool piped = false;
+	unsigned long initial_check = (format == FORMAT_ZLIB) ? 1 : 0;
+	cache_key key;
+	bool cached = false;
+
+	memset(&gzip, '\0', sizeof(gzip));
+	memset(&stats, '\0', sizeof(stats));
+	memset(&search, '\0', sizeof(search));
+	tar_init(&tar, test, options->preallocate);
+	if(options->untar)
+		out.tar = &tar;
+	record_counter_init(&counter, options->delimiter);
+	if(options->count_records)
+		out.counter = &counter;
+
+	in = fopen(path, "r");
+
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+
+	posix_fadvise(fileno(in), 0, 0, POSIX_FADV_SEQUENTIAL);
+	if(options->search) {
+		if(!search_init(&search, options->search, path))
+			goto done;
+		out.search = &search;
+	}
+	if(options->pipeline) {
+		pipeline_check_fn check_fn = NULL;
+		if(format == FORMAT_GZIP)
+			check_fn = crc32_update;
+		else if(format == FORMAT_ZLIB)
+			check_fn = adler32_update;
+		if(!pipeline_start(&pipe, fileno(in), check_fn, initial_check, options->queue_depth,
+			   options->use_uring)) {
+			fprintf(stderr, "Could not start the pipeline.\n");
+			goto done;
+		}
+		piped = true;
+		bit_stream_open_reader(&state->stream, pipeline_read, &pipe);
+		state->sink = pipeline_write;
+		state->opaque = &pipe;
+	} else {
+		if(!bit_stream_reopen_file(&state->stream, in)) {
+			fprintf(stderr, "Out of memory.\n");
+			goto done;
+		}
+		state->sink = output_sink;
+		state->opaque = &out;
+		if(options->splice) {
+			out.splice = options->splice;
+			splice_attach(options->splice, state);
+		}
+	}
+	state->stats_sink = print_stats ? print_block_stats : NULL;
+	state->stats_opaque = &stats;
 
-	unsigned code_length_offsets[] = {
-		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+	if(format == FORMAT_GZIP && !read_gzip_header(&state->stream, &gzip))
+		goto done;
+	if(format == FORMAT_ZLIB && !read_zlib_header(&state->stream))
+		goto done;
 
-	unsigned hlit = read_bits_and_invert(stream, 5);
-	unsigned hdist = read_bits_and_invert(stream, 5);
-	unsigned hclen = read_bits_and_invert(stream, 4);
+	struct timespec times[2];
+	times[0].tv_sec = load_le32(gzip.header.mtime);
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
 
-	unsigned code_lengths[19];
-	huffman_range code_length_ranges[19];
-	memset(code_lengths, '\0', sizeof(code_lengths));
-	for(i = 0; i < (hclen + 4); ++i)
-		code_lengths[code_length_offsets[i]] = read_bits_and_invert(stream, 3);
+	// Tarballs are extracted on the fly, searches and counts only print their
+	// results, none of them writes the data as a whole
+	if(options->to_stdout)
+		out.fd = STDOUT_FILENO;
+	else if(!test && !options->untar && !options->search && !options->count_records) {
+		target = gzip.fname ? stored_name(gzip.fname) : NULL;
+		if(!target && !(target = strip_suffix(path, format))) {
+			fprintf(stderr, "Out of memory.\n");
+			goto done;
+		}
 
-	j = 0;
-	for(i = 0; i < 19; ++i) {
-		if((i > 0) && (code_lengths[i] != code_lengths[i - 1]))
-			++j;
-		code_length_ranges[j].end = i;
-		code_length_ranges[j].bit_length = code_lengths[i];
+		// The file is new, so the pipeline may write chunks at their offsets. The
+		// cache copies it once it is complete.
+		out.fd = open(target, (options->cache ? O_RDWR : O_WRONLY) | O_CREAT | O_EXCL, 0744);
+		if(out.fd < 0) {
+			perror("Target already exists");
+			goto done;
+		}
+		if(piped)
+			pipe.out_fd = out.fd;
 	}
 
-	huffman_node code_lengths_root;
-	memset(&code_lengths_root, '\0', sizeof(huffman_node));
-	build_huffman_tree(&code_lengths_root, j + 1, code_length_ranges);
-
-	// Read the literal/length alphabet
-	// This is encoded using the Huffman tree from the previous step
-	i = 0;
-	int* alphabet = malloc((hlit + hdist + 258) * sizeof(int));
-	huffman_range* alphabet_ranges =
-		malloc((hlit + hdist + 258) * sizeof(huffman_range));
-	huffman_node* code_lengths_node = &code_lengths_root;
-	while(i < (hlit + hdist + 258)) {
-		if(next_bit(stream))
-			code_lengths_node = code_lengths_node->rhs;
-		else
-			code_lengths_node = code_lengths_node->lhs;
-
-		if(code_lengths_node->code != -1) {
-			if(code_lengths_node->code > 15) {
-				unsigned repeat_length;
-
-				switch(code_lengths_node->code) {
-					case 16: repeat_length = read_bits_and_invert(stream, 2) + 3; break;
-					case 17: repeat_length = read_bits_and_invert(stream, 3) + 3; break;
-					case 18:
-						repeat_length = read_bits_and_invert(stream, 7) + 11;
-						break;
-				}
-
-				while(repeat_length--) {
-					if(code_lengths_node->code == 16)
-						alphabet[i] = alphabet[i - 1];
-					else
-						alphabet[i] = 0;
-					++i;
-				}
-			} else {
-				alphabet[i] = code_lengths_node->code;
-				++i;
-			}
+	// An input decompressed before is copied from the cache instead
+	bool use_cache = out.fd >= 0 && options->cache && cache_key_of(fileno(in), format, &key);
+	if(use_cache) {
+		unsigned long long size;
+		cache_result result = cache_fetch(options->cache, &key, out.fd, &size);
+		if(result == CACHE_ERROR)
+			goto done;
+		cached = result == CACHE_HIT;
+	}
 
-			code_lengths_node = &code_lengths_root;
+	// A gzip file may consist of several members, their contents are concatenated
+	file_members members = {path, options, state, &out, initial_check, piped ? &pipe : NULL,
+		&stats, &counter, 0, 0};
+	member_hooks hooks = {member_begin, member_check, member_end, &members};
+	if(!cached) {
+		members_result result = decode_members(state, format, &gzip, &hooks);
+		if(result == MEMBERS_TRAILING_GARBAGE)
+			fprintf(stderr, "Ignoring trailing garbage in '%s'.\n", path);
+		else if(result != MEMBERS_OK) {
+			// Headers and deflate data that don't parse have been reported already
+			if(result == MEMBERS_NO_TRAILER || result == MEMBERS_MISMATCH)
+				fprintf(stderr, "%s, '%s' is corrupt.\n", members_error(result, format), path);
+			goto done;
 		}
 	}
 
-	// Turn alphabet lengths into a valid range declaration and build the final Huffman
-	// code from it
-	j = 0;
-	for(i = 0; i <= (hlit + 257); ++i) {
-		if((i > 0) && (alphabet[i] != alphabet[i - 1]))
-			++j;
-		alphabet_ranges[j].end = i;
-		alphabet_ranges[j].bit_length = alphabet[i];
+	// All output must be written before the mtime is set
+	if(piped) {
+		piped = false;
+		if(!pipeline_finish(&pipe))
+			goto done;
+	}
+	if(use_cache && !cached)
+		cache_store(options->cache, &key, out.fd, 0, members.total_size);
+	if(out.fd >= 0 && !options->to_stdout && format == FORMAT_GZIP &&
+		futimens(out.fd, times) < 0) {
+		perror("Could not set mtime");
+		goto done;
 	}
 
-	build_huffman_tree(literals_root, j, alphabet_ranges);
+	if(options->untar && !tar_finish(&tar))
+		goto done;
+	if(options->search)
+		search_finish(&search);
+	if(options->count_records)
+		printf("%12llu %12llu %s\n", counter.numof_records, counter.numof_bytes, path);
+
+	if(print_stats) {
+		printf("%s total, %u members:\n", path, stats.numof_members);
+		print_totals(&stats.overall, wall_clock() - start_seconds);
+	}
+	success = true;
 
-	--i;
-	j = 0;
-	for(; i <= (hdist + hlit + 258); ++i) {
-		if((i > (257 + hlit)) && (alphabet[i] != alphabet[i - 1]))
-			++j;
-		alphabet_ranges[j].end = i - (257 + hlit);
-		alphabet_ranges[j].bit_length = alphabet[i];
+done:
+	if(piped && !pipeline_finish(&pipe))
+		success = false;
+	if(out.splice)
+		splice_detach(state);
+	if(out.fd >= 0 && !options->to_stdout && close(out.fd) < 0) {
+		perror("Could not close output file");
+		success = false;
 	}
+	free(target);
+	free_gzip_file(&gzip);
+	tar_end(&tar);
+	search_end(&search);
 
-	build_huffman_tree(distances_root, j, alphabet_ranges);
+	if(fclose(in)) {
+		perror("Unable to close input file.\n");
+		return false;
+	}
 
-	free(alphabet);
-	free(alphabet_ranges);
+	return success;
 }
 
-enum { MAX_DISTANCE = 32768 };
-bool inflate_huffman_codes(bit_stream* stream, huffman_node* literals_root,
-	huffman_node* distances_root, int fd) {
-	unsigned extra_length_addend[] = {11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
-		67, 83, 99, 115, 131, 163, 195, 227};
-	unsigned extra_dist_addend[] = {4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256,
-		384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576};
+// Write the header of the given format, gzip headers store the original name and
+// mtime
+bool write_header(int fd, file_format format, const char* path, unsigned mtime, int level) {
+	if(format == FORMAT_GZIP) {
+		const char* fname = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+		unsigned char header[sizeof(gzip_header)] = {31, 139, 8, FNAME, mtime & 0xff,
+			(mtime >> 8) & 0xff, (mtime >> 16) & 0xff, (mtime >> 24) & 0xff,
+			(level >= 9) ? 2 : (level == 1) ? 4 : 0, 3};
+		return write_all(fd, header, sizeof(header)) &&
+			write_all(fd, (const unsigned char*)fname, strlen(fname) + 1);
+	}
+
+	if(format == FORMAT_ZLIB) {
+		// FLEVEL is informational only
+		unsigned flg = (level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3) << 6;
+		flg += (31 - (ZLIB_CMF * 256 + flg) % 31) % 31;
+		unsigned char header[2] = {ZLIB_CMF, flg};
+		return write_all(fd, header, sizeof(header));
+	}
 
-	unsigned char buf[MAX_DISTANCE];
-	unsigned byte_count = 0;
-	unsigned char* ptr = buf;
-	huffman_node* node = literals_root;
+	return true;
+}
 
-	bool stop_code = false;
-	while(!stop_code) {
-		if(feof(stream->source)) {
-			fprintf(stderr, "Premature end of file.\n");
-			return false;
-		}
+// Compress a file into <file> plus the suffix of the format
+bool compress_file(const char* path, int level, file_format format) {
+	FILE* in;
+	struct stat st;
+	bool success = false;
+	int fd = -1;
+	char* target = NULL;
+	deflate_state state;
 
-		if(next_bit(stream))
-			node = node->rhs;
-		else
-			node = node->lhs;
+	in = fopen(path, "r");
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
 
-		// Found a leaf in the tree
-		// Decode a symbol
-		if(node->code != -1) {
-			// should never happen
-			assert(node->code < 286);
+	if(!deflate_init(&state, level)) {
+		fprintf(stderr, "Out of memory.\n");
+		fclose(in);
+		return false;
+	}
 
-			if(node->code < 256) {
-				*(ptr++) = node->code;
-				++byte_count;
-			}
-			if(node->code == 256) {
-				stop_code = true;
-				break;
-			}
-			if(node->code > 256) {
-				// This is a back-pointer to a position in the stream
-				// Interpret the length here as specified in 3.2.5
-				unsigned length;
-				if(node->code < 265)
-					length = node->code - 254;
-				else {
-					if(node->code < 285) {
-						unsigned extra_bits =
-							read_bits_and_invert(stream, (node->code - 261) / 4);
-
-						length = extra_bits + extra_length_addend[node->code - 265];
-					} else
-						length = 258;
-				}
-
-				// The length is followed by the distance
-				// The distance is coded in 5 bits and may be followed by extra bits
-				// (see 3.2.5)
-				unsigned dist;
-				if(distances_root == NULL)
-					// Hardcoded distances
-					dist = read_bits(stream, 5);
-				else {
-					// Dynamic distances
-					node = distances_root;
-					while(node->code == -1) {
-						if(next_bit(stream))
-							node = node->rhs;
-						else
-							node = node->lhs;
-					}
-					dist = node->code;
-				}
-
-				if(dist > 3) {
-					unsigned extra_dist = read_bits_and_invert(stream, (dist - 2) / 2);
-					// Embed the logic in the table at the end of 3.2.5
-					dist = extra_dist + extra_dist_addend[dist - 4];
-				}
-
-				unsigned char* backptr = ptr - dist - 1;
-				while(length--) {
-					*(ptr++) = *(backptr++);
-					++byte_count;
-				}
-			}
-			node = literals_root;
-		}
+	if(fstat(fileno(in), &st) < 0) {
+		perror("Could not stat input file");
+		goto done;
 	}
 
-	unsigned bytes_written = 0;
-	while((bytes_written +=
-			  write(fd, buf + bytes_written, byte_count - bytes_written)) < byte_count)
-		;
-	return true;
-}
+	target = malloc(strlen(path) + strlen(formats[format].suffix) + 1);
+	if(!target) {
+		fprintf(stderr, "Out of memory.\n");
+		goto done;
+	}
+	sprintf(target, "%s%s", path, formats[format].suffix);
+	fd = open(target, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+	if(fd < 0) {
+		perror("Target already exists");
+		goto done;
+	}
 
-// Decompress a deflated input stream compliant
-bool inflate(FILE* compressed_input, int fd) {
-	// Bit 8 indicates if this is the last block
-	// Bits 7 and 6 indicate compression type
-	bit_stream stream;
-	stream.source = compressed_input;
-	fread(&stream.buf, 1, 1, compressed_input);
-	stream.mask = 1;
+	if(!write_header(fd, format, path, st.st_mtime, level))
+		goto done;
 
-	huffman_node literals_root;
-	huffman_node distances_root;
-	unsigned last_block;
+	unsigned char buf[1 << 16];
+	unsigned long crc = 0;
+	unsigned long adler = 1;
+	unsigned long isize = 0;
+	size_t len;
 	do {
-		last_block = next_bit(&stream);
-		unsigned block_format = read_bits_and_invert(&stream, 2);
-
-		switch(block_format) {
-			case 0:
-				printf("Uncompressed block.\n");
-				fprintf(stderr, "uncompressed block type not supported.\n");
-				return false;
-				break;
-			// Note, backwards from the spec, since the bits are being read
-			// right-to-left
-			case 1:
-				memset(&literals_root, '\0', sizeof(huffman_node));
-				build_fixed_huffman_tree(&literals_root);
-				inflate_huffman_codes(&stream, &literals_root, NULL, fd);
-				break;
-			case 2:
-				memset(&literals_root, '\0', sizeof(huffman_node));
-				memset(&distances_root, '\0', sizeof(huffman_node));
-				read_dynamic_huffman_tree(&stream, &literals_root, &distances_root);
-				inflate_huffman_codes(&stream, &literals_root, &distances_root, fd);
-				break;
-			default:
-				fprintf(stderr, "Error, unsupported block type %x.\n", block_format);
-				return false;
-				break;
+		len = fread(buf, 1, sizeof(buf), in);
+		if(ferror(in)) {
+			perror("Error reading input");
+			goto done;
+		}
+		if(format == FORMAT_GZIP)
+			crc = crc32_update(crc, buf, len);
+		else if(format == FORMAT_ZLIB)
+			adler = adler32_update(adler, buf, len);
+		isize += len;
+
+		if(!deflate_compress(&state, buf, len, len < sizeof(buf) ? LZIP_FINISH : LZIP_NO_FLUSH)) {
+			fprintf(stderr, "Compression failed.\n");
+			goto done;
 		}
-	} while(!last_block);
+		if(!write_all(fd, state.out.buf, state.out.len))
+			goto done;
+		state.out.len = 0;
+	} while(len == sizeof(buf));
+
+	unsigned char trailer[8];
+	size_t trailer_len = 0;
+	if(format == FORMAT_GZIP) {
+		store_le32(trailer, crc);
+		store_le32(trailer + 4, isize);
+		trailer_len = 8;
+	} else if(format == FORMAT_ZLIB) {
+		store_be32(trailer, adler);
+		trailer_len = 4;
+	}
+	if(!write_all(fd, trailer, trailer_len))
+		goto done;
 
-	return true;
+	success = true;
+
+done:
+	if(fd >= 0 && close(fd) < 0) {
+		perror("Could not close output file");
+		success = false;
+	}
+	free(target);
+	deflate_end(&state);
+	fclose(in);
+	return success;
 }
 
-enum { MAX_BUF = 255 };
-// Read a null-terminated string from a file
-// Null terminated strings in files suck
-bool read_string(FILE* in, char** target) {
-	char buffer[MAX_BUF];
-	char* buf_ptr;
+// Files handed out to the batch workers. Every worker claims the next unprocessed
+// file as soon as it is done with the previous one, so a few large files don't
+// hold up the rest of the batch.
+typedef struct {
+	char** paths;
+	unsigned numof_paths;
+	decompress_options options;
+	atomic_uint next;
+	atomic_uint numof_failed;
+} batch_job;
+
+void* batch_worker(void* opaque) {
+	batch_job* job = opaque;
+	inflate_state state;
+	if(!decoder_init(&state)) {
+		decoder_end(&state);
+		atomic_fetch_add(&job->numof_failed, 1);
+		return NULL;
+	}
 
-	buf_ptr = buffer;
+	for(;;) {
+		unsigned i = atomic_fetch_add(&job->next, 1);
+		if(i >= job->numof_paths)
+			break;
+		if(!decompress_file(job->paths[i], &job->options, &state)) {
+			fprintf(stderr, "%s: %s failed\n", job->paths[i],
+				job->options.search ? "search" : job->options.test ? "test" : "decompression");
+			atomic_fetch_add(&job->numof_failed, 1);
+		}
+	}
 
-	// TODO deal with strings > MAX_BUF
-	do {
-		if(fread(buf_ptr, 1, 1, in) < 1) {
-			perror("Error reading string value");
-			return false;
+	decoder_end(&state);
+	return NULL;
+}
+
+// Run worker on numof_threads threads and wait for all of them
+void run_workers(void* (*worker)(void*), void* job, unsigned numof_threads) {
+	pthread_t* threads = malloc(numof_threads * sizeof(pthread_t));
+	unsigned numof_started = 0;
+	if(threads) {
+		for(; numof_started < numof_threads; ++numof_started) {
+			if(pthread_create(&threads[numof_started], NULL, worker, job))
+				break;
 		}
-	} while(*(buf_ptr++));
+	}
+	// Without any threads the work is done right here
+	if(!numof_started)
+		worker(job);
+	for(unsigned i = 0; i < numof_started; ++i)
+		pthread_join(threads[i], NULL);
 
-	*target = malloc(buf_ptr - buffer);
-	strncpy(*target, buffer, buf_ptr - buffer);
+	free(threads);
+}
 
-	return true;
+// Decompress or test all files, numof_threads of them at a time
+bool decompress_files(char** paths, unsigned numof_paths, const decompress_options* options,
+	unsigned numof_threads) {
+	batch_job job = {paths, numof_paths, *options, 0, 0};
+	run_workers(batch_worker, &job, numof_threads < numof_paths ? numof_threads : numof_paths);
+	return !atomic_load(&job.numof_failed);
 }
 
-enum { FHCRC = 2, FEXTRA = 4, FNAME = 8, FCOMMENT = 16 };
-// Strip off an RFC 1952-compliant gzip file header and decompress to stdout
-int main(int argc, char* argv[]) {
-	FILE* in;
-	gzip_file gzip;
+// Entries of one archive handed out to the extraction workers
+typedef struct {
+	const zip_archive* zip;
+	bool test;
+	atomic_size_t next;
+	atomic_uint numof_failed;
+} zip_job;
+
+// Inflate or copy one entry into a file of its name and check its CRC-32 (or only
+// check it when testing)
+bool extract_zip_entry(const zip_archive* zip, const zip_entry* entry, bool test,
+	inflate_state* state) {
+	const char* name = entry->name;
+	size_t name_len = strlen(name);
+	if(!is_safe_path(name)) {
+		fprintf(stderr, "Refusing to extract '%s' outside the current directory.\n", name);
+		return false;
+	}
+	if(entry->flags & ZIP_ENCRYPTED) {
+		fprintf(stderr, "'%s' is encrypted.\n", name);
+		return false;
+	}
+	if(entry->method != ZIP_STORED && entry->method != ZIP_DEFLATED) {
+		fprintf(stderr, "Unsupported compression method %u for '%s'.\n", entry->method, name);
+		return false;
+	}
 
-	gzip.extra = NULL;
-	gzip.fname = NULL;
-	gzip.fcomment = NULL;
+	// Directories only need to exist
+	if(name[name_len - 1] == '/')
+		return test || make_parents(name);
 
-	if(argc != 2) {
-		fprintf(stderr, "Usage: %s <file>\n", argv[0]);
-		exit(1);
+	const unsigned char* data = zip_entry_data(zip, entry);
+	if(!data) {
+		fprintf(stderr, "Corrupt local header of '%s'.\n", name);
+		return false;
 	}
 
-	in = fopen(argv[1], "r");
+	// The check value is the same CRC-32 gzip uses
+	output_file out = {FORMAT_GZIP, -1, 0, NULL, NULL, NULL, NULL};
+	if(!test) {
+		if(!make_parents(name))
+			return false;
+		out.fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if(out.fd < 0) {
+			perror("Target already exists");
+			return false;
+		}
+	}
 
-	if(!in) {
-		fprintf(stderr, "Unable to open file '%s' for reading.\n", argv[1]);
-		exit(1);
+	bool success;
+	unsigned long long size;
+	if(entry->method == ZIP_STORED) {
+		success = output_sink(&out, data, entry->compressed_size);
+		size = entry->compressed_size;
+	} else {
+		bit_stream_open_memory(&state->stream, data, entry->compressed_size);
+		state->opaque = &out;
+		inflate_reset(state);
+		success = inflate(state);
+		size = state->total_out;
 	}
 
-	if(fread(&gzip.header, sizeof(gzip_header), 1, in) < 1) {
-		perror("Error reading header");
-		goto done;
+	if(success && (out.check != entry->crc32 || size != entry->uncompressed_size)) {
+		fprintf(stderr, "CRC32 or size mismatch, '%s' is corrupt.\n", name);
+		success = false;
 	}
 
-	if((gzip.header.id[0] != 31) || (gzip.header.id[1] != 139)) {
-		fprintf(stderr, "Input not in gzip format.\n");
-		goto done;
+	if(out.fd >= 0) {
+		struct timespec times[2] = {{entry->mtime, 0}, {entry->mtime, 0}};
+		if(success && futimens(out.fd, times) < 0) {
+			perror("Could not set mtime");
+			success = false;
+		}
+		if(close(out.fd) < 0) {
+			perror("Could not close output file");
+			success = false;
+		}
 	}
+	return success;
+}
 
-	if(gzip.header.compression_method != 8) {
-		fprintf(stderr, "Unrecognized compression method.\n");
-		goto done;
+void* zip_worker(void* opaque) {
+	zip_job* job = opaque;
+	inflate_state state;
+	if(!inflate_init(&state, output_sink, NULL)) {
+		fprintf(stderr, "Out of memory.\n");
+		inflate_end(&state);
+		atomic_fetch_add(&job->numof_failed, 1);
+		return NULL;
 	}
 
-	if(gzip.header.flags & FEXTRA) {
-		if(fread(&gzip.xlen, 2, 1, in) < 1) {
-			perror("Error reading extras length");
-			goto done;
+	for(;;) {
+		size_t i = atomic_fetch_add(&job->next, 1);
+		if(i >= job->zip->numof_entries)
+			break;
+		if(!extract_zip_entry(job->zip, &job->zip->entries[i], job->test, &state)) {
+			fprintf(stderr, "%s: %s failed\n", job->zip->entries[i].name,
+				job->test ? "test" : "extraction");
+			atomic_fetch_add(&job->numof_failed, 1);
 		}
+	}
 
-		gzip.extra = malloc(gzip.xlen);
-		if(fread(gzip.extra, gzip.xlen, 1, in) < 1) {
-			perror("Error reading extras");
-			goto done;
-		}
-		// TODO interpret the extra data
+	inflate_end(&state);
+	return NULL;
+}
+
+// Extract (or test) all entries of a ZIP archive into the current directory,
+// entries are independent and spread over numof_threads threads
+bool extract_zip(const char* path, bool test, unsigned numof_threads) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
 	}
 
-	if(gzip.header.flags & FNAME) {
-		if(!read_string(in, &gzip.fname))
-			goto done;
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		perror("Could not stat input file");
+		close(fd);
+		return false;
 	}
 
-	if(gzip.header.flags & FCOMMENT) {
-		if(!read_string(in, &gzip.fcomment))
-			goto done;
+	if(!st.st_size) {
+		fprintf(stderr, "Input not in ZIP format.\n");
+		close(fd);
+		return false;
+	}
+	// The workers read the entries straight from the page cache
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		perror("Could not map input file");
+		return false;
 	}
 
-	if(gzip.header.flags & FHCRC) {
-		if(fread(&gzip.crc16, 2, 1, in) < 1) {
-			perror("Error reading CRC16");
-			goto done;
+	zip_archive zip;
+	bool success = false;
+	if(zip_open(&zip, data, st.st_size)) {
+		zip_job job = {&zip, test, 0, 0};
+		run_workers(zip_worker, &job,
+			numof_threads < zip.numof_entries ? numof_threads : zip.numof_entries);
+		success = !atomic_load(&job.numof_failed);
+		zip_close(&zip);
+	}
+
+	munmap(data, st.st_size);
+	return success;
+}
+
+// Paths from the command line followed by those of a --files-from list
+typedef struct {
+	char** paths;
+	unsigned numof_paths;
+	unsigned cap;
+} path_list;
+
+bool add_path(path_list* list, const char* path) {
+	if(list->numof_paths == list->cap) {
+		unsigned cap = list->cap ? 2 * list->cap : 64;
+		char** paths = realloc(list->paths, cap * sizeof(char*));
+		if(!paths)
+			return false;
+		list->paths = paths;
+		list->cap = cap;
+	}
+	if(!(list->paths[list->numof_paths] = strdup(path)))
+		return false;
+	++list->numof_paths;
+	return true;
+}
+
+// Add one path per line of the given file, - reads them from stdin
+bool read_path_list(path_list* list, const char* path) {
+	FILE* in = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+
+	bool success = true;
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while((len = getline(&line, &cap, in)) >= 0) {
+		if(len && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if(len && !add_path(list, line)) {
+			fprintf(stderr, "Out of memory.\n");
+			success = false;
+			break;
 		}
 	}
+	if(ferror(in)) {
+		perror("Error reading file list");
+		success = false;
+	}
+
+	free(line);
+	if(in != stdin)
+		fclose(in);
+	return success;
+}
+
+void free_path_list(path_list* list) {
+	for(unsigned i = 0; i < list->numof_paths; ++i)
+		free(list->paths[i]);
+	free(list->paths);
+	memset(list, '\0', sizeof(path_list));
+}
+
+enum { LIST_READ_SIZE = 4096 };
+// Headers are tiny unless they carry large extra fields or names, so they are
+// read in small pieces
+typedef struct {
+	int fd;
+	off_t offset;
+	unsigned char buf[LIST_READ_SIZE];
+} header_reader;
+
+// bit_stream_reader handing read_gzip_header the file piece by piece
+static size_t read_header_piece(void* opaque, const unsigned char** data) {
+	header_reader* reader = opaque;
+	ssize_t got = pread(reader->fd, reader->buf, sizeof(reader->buf), reader->offset);
+	if(got < 0) {
+		perror("Error reading input");
+		return 0;
+	}
+	reader->offset += got;
+	*data = reader->buf;
+	return got;
+}
 
-	int fd = open(gzip.fname, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0744);
+// Fill in the listing of a gzip file from its header and the trailer of the last
+// member (see 2.3.1) without decompressing anything. Like gzip -l this is only
+// exact for single-member files smaller than 4 GB.
+bool list_gzip_file(const char* path, file_listing* listing) {
+	bool success = false;
+	gzip_file gzip;
+	struct stat st;
+
+	memset(&gzip, '\0', sizeof(gzip));
+
+	int fd = open(path, O_RDONLY);
 	if(fd < 0) {
-		perror("Target already exists");
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
+	}
+	if(fstat(fd, &st) < 0) {
+		perror("Could not stat input file");
 		goto done;
 	}
 
-	// compressed blocks follow
-	if(!inflate(in, fd))
+	header_reader reader = {fd, 0, {0}};
+	bit_stream stream;
+	bit_stream_open_reader(&stream, read_header_piece, &reader);
+	if(!read_gzip_header(&stream, &gzip))
 		goto done;
+	size_t header_len = bit_stream_position(&stream) / 8;
 
-	union {
-		unsigned ui;
-		unsigned char little_endian;
-	} u = {1};
-	unsigned mtime = 0;
-	if(u.little_endian) {
-		mtime |= ((unsigned)gzip.header.mtime[0] << 0);
-		mtime |= ((unsigned)gzip.header.mtime[1] << 8);
-		mtime |= ((unsigned)gzip.header.mtime[2] << 16);
-		mtime |= ((unsigned)gzip.header.mtime[3] << 24);
-	} else {
-		mtime |= ((unsigned)gzip.header.mtime[0] << 24);
-		mtime |= ((unsigned)gzip.header.mtime[1] << 16);
-		mtime |= ((unsigned)gzip.header.mtime[2] << 8);
-		mtime |= ((unsigned)gzip.header.mtime[3] << 0);
-	}
-	struct timespec times[2];
-	times[0].tv_sec = mtime;
-	times[0].tv_nsec = 0;
-	times[1] = times[0];
-	if(futimens(fd, times) < 0) {
-		perror("Could not set mtime");
+	unsigned char trailer[8];
+	if(st.st_size < (off_t)(header_len + sizeof(trailer)) ||
+		pread(fd, trailer, sizeof(trailer), st.st_size - sizeof(trailer)) != sizeof(trailer)) {
+		fprintf(stderr, "Error reading CRC32 and isize.\n");
 		goto done;
 	}
 
-	if(close(fd) < 0) {
-		perror("Could not close output file");
-		goto done;
+	listing->compressed_size = st.st_size;
+	listing->uncompressed_size = load_le32(trailer + 4);
+	listing->numof_members = 1;
+	listing->mtime = load_le32(gzip.header.mtime);
+	listing->fname = gzip.fname;
+	gzip.fname = NULL;
+	success = true;
+
+done:
+	free_gzip_file(&gzip);
+	close(fd);
+	return success;
+}
+
+static void print_listing(const file_listing* listing, const char* name) {
+	double ratio = listing->uncompressed_size
+		? 100.0 * (1.0 - (double)listing->compressed_size / listing->uncompressed_size)
+		: 0.0;
+	char modified[32] = "-";
+	time_t mtime = listing->mtime;
+	struct tm tm;
+	if(mtime && localtime_r(&mtime, &tm))
+		strftime(modified, sizeof(modified), "%Y-%m-%d %H:%M", &tm);
+
+	printf("%12llu %13llu %6.1f%% %-16s %s\n", listing->compressed_size,
+		listing->uncompressed_size, ratio, modified, name);
+}
+
+// Print a gzip -l style line per file. gzip files are listed from their header and
+// trailer alone unless walk_members asks for decoding them to sum up every member,
+// the other formats have no size in the trailer and are always decoded.
+bool list_files(char** paths, unsigned numof_paths, file_format format, bool walk_members) {
+	file_listing total;
+	inflate_state state;
+	bool success = true;
+
+	memset(&total, '\0', sizeof(total));
+	bool decoding = format != FORMAT_GZIP || walk_members;
+	if(decoding && !decoder_init(&state)) {
+		decoder_end(&state);
+		return false;
 	}
+	printf("%12s %13s %7s %-16s %s\n", "compressed", "uncompressed", "ratio", "modified",
+		"name");
+
+	for(unsigned i = 0; i < numof_paths; ++i) {
+		file_listing listing;
+		bool listed;
+
+		memset(&listing, '\0', sizeof(listing));
+		if(!decoding)
+			listed = list_gzip_file(paths[i], &listing);
+		else {
+			decompress_options options = {.format = format, .test = true, .listing = &listing};
+			listed = decompress_file(paths[i], &options, &state);
+		}
 
-	if(fread(&gzip.crc32, 2, 1, in) < 1) {
-		perror("Error reading CRC32");
-		goto done;
+		if(listed) {
+			char* stripped = listing.fname ? NULL : strip_suffix(paths[i], format);
+			print_listing(&listing,
+				listing.fname ? listing.fname : stripped ? stripped : paths[i]);
+			free(stripped);
+
+			total.compressed_size += listing.compressed_size;
+			total.uncompressed_size += listing.uncompressed_size;
+			total.numof_members += listing.numof_members;
+		} else {
+			fprintf(stderr, "%s: listing failed\n", paths[i]);
+			success = false;
+		}
+		free(listing.fname);
 	}
 
-	if(fread(&gzip.isize, 2, 1, in) < 1) {
-		perror("Error reading isize");
-		goto done;
+	if(numof_paths > 1)
+		print_listing(&total, "(totals)");
+	if(decoding)
+		decoder_end(&state);
+	return success;
+}
+
+// -x takes ZIP archives and gzip-compressed tarballs, told apart by their magic
+bool extract_archive(const char* path, bool test, unsigned numof_threads, bool preallocate) {
+	unsigned char magic[2] = {0, 0};
+	FILE* in = fopen(path, "r");
+	if(!in) {
+		fprintf(stderr, "Unable to open file '%s' for reading.\n", path);
+		return false;
 	}
+	size_t len = fread(magic, 1, sizeof(magic), in);
+	fclose(in);
+
+	if(len < sizeof(magic) || magic[0] != 31 || magic[1] != 139)
+		return extract_zip(path, test, numof_threads);
+
+	// Tarballs are one stream, so they are decoded on this thread
+	inflate_state state;
+	decompress_options options = {
+		.format = FORMAT_GZIP, .test = test, .untar = true, .preallocate = preallocate};
+	bool success = decoder_init(&state) && decompress_file(path, &options, &state);
+	decoder_end(&state);
+	return success;
+}
 
-	// TODO check the CRC32
+static void usage(const char* name) {
+	fprintf(stderr,
+		"Usage: %s -z [-F gzip|zlib|raw] [-0 .. -12] <file>\n"
+		"       %s [-t] [-p threads] [-F gzip|zlib|raw] [--stats] [--pipeline]\n"
+		"          [--io sync|uring] [--queue-depth 1..32] [--max-memory size]\n"
+		"          [--cache dir [--cache-size size]] [--files-from list] <file>...\n"
+		"       %s -c [-d] [-p threads] [-F gzip|zlib|raw] [--max-memory size]\n"
+		"          [--files-from list] <file>...\n"
+		"       %s --daemon socket [-t] [-p threads] [-F gzip|zlib|raw]\n"
+		"          [--files-from list] <file>...\n"
+		"       %s -g pattern [-g pattern]... [-p threads] [-F gzip|zlib|raw]\n"
+		"          [--files-from list] <file>...\n"
+		"       %s --count-lines [--delimiter c] [--members] [-p threads] [-F gzip|zlib|raw]\n"
+		"          [--files-from list] <file>...\n"
+		"       %s -l [--members] [-F gzip|zlib|raw] [--files-from list] <file>...\n"
+		"       %s -x [-t] [-p threads] [--preallocate] <archive.zip|archive.tar.gz>...\n",
+		name, name, name, name, name, name, name, name);
+	exit(1);
+}
 
-done:
-	free(gzip.extra);
-	free(gzip.fname);
-	free(gzip.fcomment);
+enum {
+	OPTION_STATS = 256,
+	OPTION_MEMBERS,
+	OPTION_FILES_FROM,
+	OPTION_PIPELINE,
+	OPTION_IO,
+	OPTION_QUEUE_DEPTH,
+	OPTION_PREALLOCATE,
+	OPTION_COUNT_LINES,
+	OPTION_DELIMITER,
+	OPTION_MAX_MEMORY,
+	OPTION_DAEMON,
+	OPTION_CACHE,
+	OPTION_CACHE_SIZE
+};
+
+// A single character or one of the escapes \n, \t, \r and \0
+static bool parse_delimiter(const char* arg, unsigned char* delimiter) {
+	if(arg[0] && !arg[1]) {
+		*delimiter = arg[0];
+		return true;
+	}
+	if(arg[0] != '\\' || !arg[1] || arg[2])
+		return false;
+	switch(arg[1]) {
+	case 'n':
+		*delimiter = '\n';
+		return true;
+	case 't':
+		*delimiter = '\t';
+		return true;
+	case 'r':
+		*delimiter = '\r';
+		return true;
+	case '0':
+		*delimiter = '\0';
+		return true;
+	}
+	return false;
+}
 
-	if(fclose(in)) {
-		perror("Unable to close input file.\n");
+// Split a memory budget between the decoders, which allocate the same for any
+// input, after the shared memory of the output. Fewer threads and a shallower
+// pipeline are used where the budget is too small for the requested ones.
+static bool fit_memory_budget(
+	size_t budget, size_t shared, bool use_pipeline, long* numof_threads, long* queue_depth) {
+	if(budget < shared) {
+		fprintf(stderr, "The output needs %zu KiB, more than --max-memory allows.\n", shared / 1024);
+		return false;
+	}
+	budget -= shared;
+	size_t decoder = inflate_footprint();
+	if(use_pipeline) {
+		long depth = budget > decoder ? (budget - decoder) / pipeline_footprint(1) : 0;
+		if(depth < *queue_depth)
+			*queue_depth = depth;
+		decoder += pipeline_footprint(*queue_depth);
+	}
+	if(budget < decoder || (use_pipeline && !*queue_depth)) {
+		fprintf(stderr, "A decoder needs %zu KiB%s, more than --max-memory allows.\n",
+			(inflate_footprint() + (use_pipeline ? pipeline_footprint(1) : 0)) / 1024,
+			use_pipeline ? " with the pipeline" : "");
+		return false;
+	}
+	if((size_t)*numof_threads > budget / decoder)
+		*numof_threads = budget / decoder;
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	bool compress = false;
+	bool test = false;
+	bool list = false;
+	bool unzip = false;
+	bool decompress = false;
+	bool to_stdout = false;
+	bool walk_members = false;
+	long numof_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	file_format format = FORMAT_GZIP;
+	// Archives bring their own framing, -F doesn't go with -x
+	bool format_given = false;
+	int level = DEFAULT_LEVEL;
+	int digits_arg = -1;
+	bool print_stats = false;
+	bool use_pipeline = false;
+	bool use_uring = false;
+	bool preallocate = false;
+	bool count_lines = false;
+	unsigned char delimiter = '\n';
+	size_t max_memory = 0;
+	const char* daemon = NULL;
+	const char* cache_dir = NULL;
+	size_t cache_size = CACHE_DEFAULT_SIZE;
+	decode_cache cache;
+	long queue_depth = PIPELINE_DEFAULT_DEPTH;
+	const char* files_from = NULL;
+	path_list inputs = {NULL, 0, 0};
+	search_patterns patterns = {NULL, NULL, 0, 0};
+	int opt;
+
+	static const struct option long_options[] = {
+		{"stats", no_argument, NULL, OPTION_STATS},
+		{"members", no_argument, NULL, OPTION_MEMBERS},
+		{"files-from", required_argument, NULL, OPTION_FILES_FROM},
+		{"pipeline", no_argument, NULL, OPTION_PIPELINE},
+		{"io", required_argument, NULL, OPTION_IO},
+		{"queue-depth", required_argument, NULL, OPTION_QUEUE_DEPTH},
+		{"preallocate", no_argument, NULL, OPTION_PREALLOCATE},
+		{"count-lines", no_argument, NULL, OPTION_COUNT_LINES},
+		{"delimiter", required_argument, NULL, OPTION_DELIMITER},
+		{"max-memory", required_argument, NULL, OPTION_MAX_MEMORY},
+		{"daemon", required_argument, NULL, OPTION_DAEMON},
+		{"cache", required_argument, NULL, OPTION_CACHE},
+		{"cache-size", required_argument, NULL, OPTION_CACHE_SIZE},
+		{NULL, 0, NULL, 0},
+	};
+
+	for(;;) {
+		// Levels are given gzip-style as -1, -9 or -12, so digits of the same
+		// argument add up to a single level
+		int arg = optind;
+		if((opt = getopt_long(argc, argv, "zdctlxg:p:F:0123456789", long_options, NULL)) == -1)
+			break;
+
+		if(opt >= '0' && opt <= '9') {
+			level = (digits_arg == arg) ? level * 10 + (opt - '0') : opt - '0';
+			digits_arg = arg;
+		} else if(opt == 'z')
+			compress = true;
+		else if(opt == 'd')
+			decompress = true;
+		else if(opt == 'c')
+			to_stdout = true;
+		else if(opt == 't')
+			test = true;
+		else if(opt == 'l')
+			list = true;
+		else if(opt == 'x')
+			unzip = true;
+		else if(opt == 'g') {
+			if(!search_patterns_add(&patterns, optarg))
+				exit(1);
+		}
+		else if(opt == 'p') {
+			numof_threads = atol(optarg);
+			if(numof_threads < 1)
+				usage(argv[0]);
+		} else if(opt == 'F') {
+			unsigned i;
+			for(i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+				if(!strcmp(optarg, formats[i].name))
+					break;
+			}
+			if(i == sizeof(formats) / sizeof(formats[0])) {
+				fprintf(stderr, "Unknown format '%s', use gzip, zlib or raw.\n", optarg);
+				exit(1);
+			}
+			format = i;
+			format_given = true;
+		} else if(opt == OPTION_STATS)
+			print_stats = true;
+		else if(opt == OPTION_MEMBERS)
+			walk_members = true;
+		else if(opt == OPTION_FILES_FROM)
+			files_from = optarg;
+		else if(opt == OPTION_PIPELINE)
+			use_pipeline = true;
+		else if(opt == OPTION_IO) {
+			// Both backends need the pipeline's reader and writer threads
+			if(!strcmp(optarg, "uring"))
+				use_uring = true;
+			else if(strcmp(optarg, "sync"))
+				usage(argv[0]);
+			use_pipeline = true;
+		} else if(opt == OPTION_PREALLOCATE)
+			preallocate = true;
+		else if(opt == OPTION_COUNT_LINES)
+			count_lines = true;
+		else if(opt == OPTION_DELIMITER) {
+			// Counting records of other delimiters is the same thing
+			if(!parse_delimiter(optarg, &delimiter))
+				usage(argv[0]);
+			count_lines = true;
+		} else if(opt == OPTION_MAX_MEMORY) {
+			if(!parse_size(optarg, &max_memory) || !max_memory)
+				usage(argv[0]);
+		} else if(opt == OPTION_DAEMON)
+			daemon = optarg;
+		else if(opt == OPTION_CACHE)
+			cache_dir = optarg;
+		else if(opt == OPTION_CACHE_SIZE) {
+			if(!parse_size(optarg, &cache_size) || !cache_size)
+				usage(argv[0]);
+		}
+		else if(opt == OPTION_QUEUE_DEPTH) {
+			queue_depth = atol(optarg);
+			if(queue_depth < 1 || queue_depth > PIPELINE_RING_SIZE)
+				usage(argv[0]);
+		}
+		else
+			usage(argv[0]);
+	}
+
+	if(level > MAX_LEVEL ||
+		(compress && (print_stats || test || list || files_from || use_pipeline)) ||
+		(list && (test || print_stats || use_pipeline || unzip)) ||
+		(walk_members && !list && !count_lines) ||
+		(preallocate && !unzip) ||
+		(unzip && (compress || print_stats || use_pipeline || format_given)) ||
+		(patterns.numof_patterns &&
+			(compress || test || list || unzip || print_stats || use_pipeline)) ||
+		(count_lines &&
+			(compress || test || list || unzip || print_stats || use_pipeline ||
+				patterns.numof_patterns)) ||
+		(max_memory && (compress || list || unzip || patterns.numof_patterns)) ||
+		(daemon &&
+			(compress || list || unzip || print_stats || use_pipeline || max_memory ||
+				patterns.numof_patterns || count_lines)) ||
+		(cache_dir &&
+			(compress || test || list || unzip || print_stats || use_pipeline || daemon ||
+				patterns.numof_patterns || count_lines)) ||
+		(cache_size != CACHE_DEFAULT_SIZE && !cache_dir) ||
+		(decompress && compress) ||
+		(to_stdout &&
+			(compress || test || list || unzip || print_stats || use_pipeline || daemon ||
+				cache_dir || patterns.numof_patterns || count_lines)))
+		usage(argv[0]);
+
+	for(int i = optind; i < argc; ++i) {
+		if(!add_path(&inputs, argv[i])) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+	if(files_from && !read_path_list(&inputs, files_from))
 		exit(1);
+	if(!inputs.numof_paths)
+		usage(argv[0]);
+
+	bool success;
+	if(list)
+		success = list_files(inputs.paths, inputs.numof_paths, format, walk_members);
+	else if(unzip) {
+		success = true;
+		for(unsigned i = 0; i < inputs.numof_paths; ++i) {
+			success &= extract_archive(
+				inputs.paths[i], test, numof_threads > 0 ? numof_threads : 1, preallocate);
+		}
+	} else if(compress) {
+		if(inputs.numof_paths != 1)
+			usage(argv[0]);
+		success = compress_file(inputs.paths[0], level, format);
+	} else {
+		// Interleaved statistics of several files would be unreadable, the data of
+		// files written to stdout has to follow in order
+		if(print_stats || to_stdout)
+			numof_threads = 1;
+		// The splice ring is shared by all files
+		size_t shared = to_stdout ? splice_footprint(STDOUT_FILENO) : 0;
+		if(max_memory &&
+			!fit_memory_budget(max_memory, shared, use_pipeline, &numof_threads, &queue_depth))
+			exit(1);
+		if(cache_dir && !cache_open(&cache, cache_dir, cache_size))
+			exit(1);
+		// Pipes get the data spliced, anything else has it written
+		splice_writer splice;
+		bool use_splice = to_stdout && splice_writer_open(&splice, STDOUT_FILENO);
+		decompress_options options = {.format = format,
+			.test = test,
+			.print_stats = print_stats,
+			.pipeline = use_pipeline,
+			.queue_depth = queue_depth,
+			.use_uring = use_uring,
+			.search = patterns.numof_patterns ? &patterns : NULL,
+			.count_records = count_lines,
+			.delimiter = delimiter,
+			.count_members = count_lines && walk_members,
+			.daemon = daemon,
+			.cache = cache_dir ? &cache : NULL,
+			.to_stdout = to_stdout,
+			.splice = use_splice ? &splice : NULL};
+		success = decompress_files(inputs.paths, inputs.numof_paths, &options,
+			numof_threads > 0 ? numof_threads : 1);
+
+		if(max_memory) {
+			unsigned decoders =
+				(unsigned)numof_threads < inputs.numof_paths ? numof_threads : inputs.numof_paths;
+			size_t decoder =
+				inflate_footprint() + (use_pipeline ? pipeline_footprint(queue_depth) : 0);
+			struct rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			fprintf(stderr, "Decoder memory %zu KiB x %u, output %zu KiB, peak RSS %ld KiB\n",
+				decoder / 1024, decoders, shared / 1024, usage.ru_maxrss);
+		}
+		if(cache_dir)
+			cache_close(&cache);
+		if(use_splice)
+			splice_writer_close(&splice);
 	}
 
-	exit(0);
+	// Searches exit like grep: 0 if some line matched, 1 if none did, 2 on errors
+	bool matched = atomic_load(&patterns.numof_matches) > 0;
+	bool searched = patterns.numof_patterns > 0;
+	free_path_list(&inputs);
+	search_patterns_free(&patterns);
+	if(searched)
+		exit(!success ? 2 : matched ? 0 : 1);
+	exit(success ? 0 : 1);
 }
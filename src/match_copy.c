@@ -0,0 +1,98 @@
+#include "match_copy.h"
+
+#include <string.h>
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Distances below the word size overlap within a single word, those are done
+// byte by byte except for runs of a single byte
+static void copy_bytes(unsigned char* dst, unsigned dist, unsigned length) {
+	const unsigned char* src = dst - dist;
+	if(dist == 1) {
+		memset(dst, *src, length);
+		return;
+	}
+	while(length--)
+		*(dst++) = *(src++);
+}
+
+static void copy_generic(unsigned char* dst, unsigned dist, unsigned length) {
+	if(dist < 8) {
+		copy_bytes(dst, dist, length);
+		return;
+	}
+
+	// Every word is read after the bytes it depends on were written
+	const unsigned char* src = dst - dist;
+	unsigned char* end = dst + length;
+	do {
+		memcpy(dst, src, 8);
+		dst += 8;
+		src += 8;
+	} while(dst < end);
+}
+
+#if defined(__SSE2__)
+static void copy_sse2(unsigned char* dst, unsigned dist, unsigned length) {
+	if(dist < 16) {
+		copy_generic(dst, dist, length);
+		return;
+	}
+
+	const unsigned char* src = dst - dist;
+	unsigned char* end = dst + length;
+	do {
+		_mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+		dst += 16;
+		src += 16;
+	} while(dst < end);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void copy_avx2(
+	unsigned char* dst, unsigned dist, unsigned length) {
+	if(dist < 32) {
+		if(dist < 16) {
+			copy_generic(dst, dist, length);
+			return;
+		}
+		const unsigned char* src = dst - dist;
+		unsigned char* end = dst + length;
+		do {
+			_mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+			dst += 16;
+			src += 16;
+		} while(dst < end);
+		return;
+	}
+
+	const unsigned char* src = dst - dist;
+	unsigned char* end = dst + length;
+	do {
+		_mm256_storeu_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+		dst += 32;
+		src += 32;
+	} while(dst < end);
+}
+#endif
+
+const match_copy_kernel* match_copy_select(void) {
+	static const match_copy_kernel generic = {"generic", copy_generic};
+	unsigned features = cpu_features();
+	(void)features;
+#if defined(__x86_64__) || defined(__i386__)
+	static const match_copy_kernel avx2 = {"avx2", copy_avx2};
+	if(features & CPU_AVX2)
+		return &avx2;
+#endif
+#if defined(__SSE2__)
+	static const match_copy_kernel sse2 = {"sse2", copy_sse2};
+	return &sse2;
+#endif
+	return &generic;
+}
@@ -0,0 +1,20 @@
+#ifndef LZIP_MATCH_COPY_H
+#define LZIP_MATCH_COPY_H
+
+// Copying whole vectors is faster than stopping at the exact end, so kernels may
+// write up to this many bytes past dst + length
+enum { MATCH_COPY_SLACK = 64 };
+
+// Copy a back-reference of length bytes from dist bytes before dst to dst, the
+// regions overlap if dist < length (see RFC 1951 section 3.2.3)
+typedef void (*match_copy_fn)(unsigned char* dst, unsigned dist, unsigned length);
+
+typedef struct {
+	const char* name;
+	match_copy_fn copy;
+} match_copy_kernel;
+
+// Pick the kernel for this CPU, the result should be kept by the caller
+const match_copy_kernel* match_copy_select(void);
+
+#endif
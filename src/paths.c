@@ -0,0 +1,41 @@
+#include "paths.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+bool is_safe_path(const char* name) {
+	if(!*name || *name == '/')
+		return false;
+	for(const char* component = name; component; component = strchr(component, '/')) {
+		if(*component == '/')
+			++component;
+		if(!strncmp(component, "..", 2) && (component[2] == '/' || !component[2]))
+			return false;
+	}
+	return true;
+}
+
+bool make_parents(const char* path) {
+	char* dir = strdup(path);
+	if(!dir) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+
+	bool success = true;
+	for(char* slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		// Other workers may be creating the same directory
+		if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+			perror("Could not create directory");
+			success = false;
+			break;
+		}
+		*slash = '/';
+	}
+	free(dir);
+	return success;
+}
@@ -0,0 +1,13 @@
+#ifndef LZIP_PATHS_H
+#define LZIP_PATHS_H
+
+#include <stdbool.h>
+
+// Archive member names must stay below the current directory: no absolute paths
+// and no .. components
+bool is_safe_path(const char* name);
+// Create the directories leading up to the last slash of path, existing ones are
+// fine since several workers may create the same directory
+bool make_parents(const char* path);
+
+#endif
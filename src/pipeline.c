@@ -0,0 +1,470 @@
+#include "pipeline.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+// Spin briefly before giving up the CPU since the other stage usually catches up
+// quickly, but sleep once it's clearly stalled (e.g. on I/O)
+static bool wait_turn(pipeline* p, unsigned* spins) {
+	if(atomic_load_explicit(&p->abort, memory_order_relaxed))
+		return false;
+	if(++*spins > 1024) {
+		struct timespec pause = {0, 20000};
+		nanosleep(&pause, NULL);
+	} else if(*spins > 64)
+		sched_yield();
+	return true;
+}
+
+static bool ring_push(pipeline* p, spsc_ring* ring, pipeline_chunk* chunk) {
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned spins = 0;
+	while(tail - atomic_load_explicit(&ring->head, memory_order_acquire) == PIPELINE_RING_SIZE) {
+		if(!wait_turn(p, &spins))
+			return false;
+	}
+	ring->slots[tail % PIPELINE_RING_SIZE] = chunk;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static pipeline_chunk* ring_pop(pipeline* p, spsc_ring* ring) {
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned spins = 0;
+	while(atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+		if(!wait_turn(p, &spins))
+			return NULL;
+	}
+	pipeline_chunk* chunk = ring->slots[head % PIPELINE_RING_SIZE];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return chunk;
+}
+
+static pipeline_chunk* ring_try_pop(spsc_ring* ring) {
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+		return NULL;
+	pipeline_chunk* chunk = ring->slots[head % PIPELINE_RING_SIZE];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return chunk;
+}
+
+// Set up a ring with the chunks of one direction registered. Registration may
+// fail on tight RLIMIT_MEMLOCK, the plain opcodes are used then.
+static bool start_uring(pipeline* p, uring* ring, pipeline_chunk* chunks) {
+	// The ring takes depth requests, as many as a stage ever has queued
+	if(!p->use_uring || !uring_init(ring, p->depth))
+		return false;
+
+	struct iovec iov[PIPELINE_RING_SIZE];
+	for(unsigned i = 0; i < p->depth; ++i) {
+		iov[i].iov_base = chunks[i].data;
+		iov[i].iov_len = PIPELINE_CHUNK_SIZE;
+	}
+	uring_register_buffers(ring, iov, p->depth);
+	return true;
+}
+
+// Mark finished requests, returns false if waiting failed
+static bool reap(uring* ring, pipeline_chunk* chunks, unsigned numof_completions) {
+	if(!uring_submit(ring, numof_completions))
+		return false;
+
+	unsigned long long index;
+	int res;
+	while(uring_complete(ring, &index, &res)) {
+		chunks[index].completed = true;
+		chunks[index].result = res;
+	}
+	return true;
+}
+
+// A read is queued for every free chunk at increasing offsets, the chunks are
+// handed on in file order as their reads complete
+static void uring_reader(pipeline* p, uring* ring) {
+	pipeline_chunk* queued[PIPELINE_RING_SIZE];
+	unsigned first = 0;
+	unsigned numof_queued = 0;
+	off_t offset = lseek(p->in_fd, 0, SEEK_CUR);
+	// A short read was handed on, only an empty last chunk follows
+	bool end_seen = false;
+	bool done = false;
+
+	while(!done) {
+		// Block for a free chunk only if there is nothing else to wait for
+		while(numof_queued < p->depth && !(end_seen && numof_queued)) {
+			pipeline_chunk* chunk =
+				numof_queued ? ring_try_pop(&p->in_free) : ring_pop(p, &p->in_free);
+			if(!chunk)
+				break;
+			chunk->completed = end_seen;
+			chunk->result = 0;
+			if(!end_seen) {
+				if(!uring_queue_read(ring, p->in_fd, chunk->data, PIPELINE_CHUNK_SIZE, offset,
+						chunk - p->in_chunks, chunk - p->in_chunks)) {
+					perror("Error queueing input");
+					p->read_failed = true;
+					atomic_store(&p->abort, true);
+					done = true;
+					break;
+				}
+				offset += PIPELINE_CHUNK_SIZE;
+			}
+			queued[(first + numof_queued++) % PIPELINE_RING_SIZE] = chunk;
+		}
+		if(!numof_queued)
+			return;
+		// Only the reads already queued are waited for
+		if(done)
+			break;
+
+		if(!reap(ring, p->in_chunks, !queued[first]->completed)) {
+			perror("Error waiting for input");
+			p->read_failed = true;
+			atomic_store(&p->abort, true);
+			break;
+		}
+
+		while(numof_queued && queued[first]->completed) {
+			pipeline_chunk* chunk = queued[first];
+			first = (first + 1) % PIPELINE_RING_SIZE;
+			--numof_queued;
+
+			if(chunk->result < 0) {
+				errno = -chunk->result;
+				perror("Error reading compressed input");
+				p->read_failed = true;
+				chunk->result = 0;
+			}
+			chunk->len = end_seen ? 0 : chunk->result;
+			chunk->last = !chunk->len;
+			end_seen = chunk->len < PIPELINE_CHUNK_SIZE;
+
+			if(!ring_push(p, &p->in_full, chunk) || chunk->last) {
+				done = true;
+				break;
+			}
+		}
+	}
+
+	// The kernel may still be writing into chunks that are about to be freed
+	while(numof_queued) {
+		if(!queued[first]->completed && !reap(ring, p->in_chunks, 1))
+			break;
+		if(queued[first]->completed) {
+			first = (first + 1) % PIPELINE_RING_SIZE;
+			--numof_queued;
+		}
+	}
+}
+
+static void* reader_thread(void* opaque) {
+	pipeline* p = opaque;
+	struct stat st;
+	uring ring;
+	// Offsets only make sense for regular files
+	if(!fstat(p->in_fd, &st) && S_ISREG(st.st_mode) && start_uring(p, &ring, p->in_chunks)) {
+		uring_reader(p, &ring);
+		uring_end(&ring);
+		return NULL;
+	}
+
+	for(;;) {
+		pipeline_chunk* chunk = ring_pop(p, &p->in_free);
+		if(!chunk)
+			return NULL;
+
+		ssize_t len;
+		do
+			len = read(p->in_fd, chunk->data, PIPELINE_CHUNK_SIZE);
+		while(len < 0 && errno == EINTR);
+		if(len < 0) {
+			perror("Error reading compressed input");
+			p->read_failed = true;
+			len = 0;
+		}
+
+		chunk->len = len;
+		chunk->last = !len;
+		if(!ring_push(p, &p->in_full, chunk) || !len)
+			return NULL;
+	}
+}
+
+static void* check_thread(void* opaque) {
+	pipeline* p = opaque;
+	unsigned long check = p->initial_check;
+	for(;;) {
+		pipeline_chunk* chunk = ring_pop(p, &p->to_check);
+		if(!chunk)
+			return NULL;
+
+		if(p->check_fn)
+			check = p->check_fn(check, chunk->data, chunk->len);
+		if(chunk->member_end) {
+			p->member_check = check;
+			atomic_fetch_add_explicit(&p->numof_checked_members, 1, memory_order_release);
+			check = p->initial_check;
+		}
+
+		// The chunk belongs to the writer once it's pushed
+		bool last = chunk->last;
+		if(!ring_push(p, &p->to_write, chunk) || last)
+			return NULL;
+	}
+}
+
+// Writes of up to depth chunks are queued at their offsets in the output, which
+// is always a new file. Chunks go back to the decoder once written completely.
+static void uring_writer(pipeline* p, uring* ring) {
+	unsigned numof_in_flight = 0;
+	unsigned long long offset = 0;
+	bool last_seen = false;
+
+	for(;;) {
+		pipeline_chunk* chunk = NULL;
+		if(!last_seen && numof_in_flight < p->depth && !p->write_failed) {
+			chunk = numof_in_flight ? ring_try_pop(&p->to_write) : ring_pop(p, &p->to_write);
+			if(!chunk && !numof_in_flight)
+				return;
+		}
+
+		if(chunk) {
+			last_seen = chunk->last;
+			if(p->out_fd >= 0 && chunk->len) {
+				chunk->offset = offset;
+				chunk->written = 0;
+				chunk->completed = false;
+				if(!uring_queue_write(ring, p->out_fd, chunk->data, chunk->len, offset,
+						chunk - p->out_chunks, chunk - p->out_chunks)) {
+					perror("Error queueing output");
+					p->write_failed = true;
+					atomic_store(&p->abort, true);
+					continue;
+				}
+				offset += chunk->len;
+				++numof_in_flight;
+			} else if(!last_seen && !ring_push(p, &p->out_free, chunk))
+				return;
+			// Queue everything that is ready before waiting
+			continue;
+		}
+		if(!numof_in_flight)
+			return;
+
+		if(!reap(ring, p->out_chunks, 1)) {
+			perror("Error waiting for output");
+			p->write_failed = true;
+			atomic_store(&p->abort, true);
+			return;
+		}
+		for(unsigned i = 0; i < p->depth; ++i) {
+			chunk = &p->out_chunks[i];
+			if(!chunk->completed)
+				continue;
+			chunk->completed = false;
+
+			if(chunk->result <= 0) {
+				if(!p->write_failed) {
+					errno = chunk->result ? -chunk->result : ENOSPC;
+					perror("Error writing output");
+					p->write_failed = true;
+					atomic_store(&p->abort, true);
+				}
+				--numof_in_flight;
+				continue;
+			}
+
+			chunk->written += chunk->result;
+			if(chunk->written < chunk->len && !p->write_failed) {
+				if(uring_queue_write(ring, p->out_fd, chunk->data + chunk->written,
+						chunk->len - chunk->written, chunk->offset + chunk->written,
+						chunk - p->out_chunks, chunk - p->out_chunks))
+					continue;
+				perror("Error queueing output");
+				p->write_failed = true;
+				atomic_store(&p->abort, true);
+			}
+			--numof_in_flight;
+			if(!chunk->last && !p->write_failed && !ring_push(p, &p->out_free, chunk))
+				p->write_failed = true;
+		}
+	}
+}
+
+static void* writer_thread(void* opaque) {
+	pipeline* p = opaque;
+	uring ring;
+	if(start_uring(p, &ring, p->out_chunks)) {
+		uring_writer(p, &ring);
+		uring_end(&ring);
+		return NULL;
+	}
+
+	for(;;) {
+		pipeline_chunk* chunk = ring_pop(p, &p->to_write);
+		if(!chunk)
+			return NULL;
+
+		const unsigned char* data = chunk->data;
+		size_t len = p->out_fd >= 0 ? chunk->len : 0;
+		while(len) {
+			ssize_t written = write(p->out_fd, data, len);
+			if(written < 0) {
+				if(errno == EINTR)
+					continue;
+				perror("Error writing output");
+				p->write_failed = true;
+				atomic_store(&p->abort, true);
+				return NULL;
+			}
+			data += written;
+			len -= written;
+		}
+
+		bool last = chunk->last;
+		if(!ring_push(p, &p->out_free, chunk) || last)
+			return NULL;
+	}
+}
+
+static void free_chunks(pipeline* p) {
+	for(unsigned i = 0; i < PIPELINE_RING_SIZE; ++i) {
+		free(p->in_chunks[i].data);
+		free(p->out_chunks[i].data);
+	}
+}
+
+bool pipeline_start(pipeline* p, int in_fd, pipeline_check_fn check_fn, unsigned long initial_check,
+	unsigned depth, bool use_uring) {
+	memset(p, '\0', sizeof(pipeline));
+	p->in_fd = in_fd;
+	p->out_fd = -1;
+	p->check_fn = check_fn;
+	p->initial_check = initial_check;
+	p->depth = (depth < 1) ? 1 : (depth > PIPELINE_RING_SIZE) ? PIPELINE_RING_SIZE : depth;
+	p->use_uring = use_uring;
+
+	// Every chunk starts out free
+	for(unsigned i = 0; i < p->depth; ++i) {
+		p->in_chunks[i].data = malloc(PIPELINE_CHUNK_SIZE);
+		p->out_chunks[i].data = malloc(PIPELINE_CHUNK_SIZE);
+		if(!p->in_chunks[i].data || !p->out_chunks[i].data) {
+			free_chunks(p);
+			return false;
+		}
+		p->in_free.slots[i] = &p->in_chunks[i];
+		p->out_free.slots[i] = &p->out_chunks[i];
+	}
+	atomic_store(&p->in_free.tail, p->depth);
+	atomic_store(&p->out_free.tail, p->depth);
+
+	void* (*const stages[3])(void*) = {reader_thread, check_thread, writer_thread};
+	for(; p->numof_threads < 3; ++p->numof_threads) {
+		if(pthread_create(&p->threads[p->numof_threads], NULL, stages[p->numof_threads], p)) {
+			atomic_store(&p->abort, true);
+			for(unsigned i = 0; i < p->numof_threads; ++i)
+				pthread_join(p->threads[i], NULL);
+			free_chunks(p);
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t pipeline_read(void* opaque, const unsigned char** data) {
+	pipeline* p = opaque;
+	if(p->in_current) {
+		// Don't wait for anything past the end of the input
+		if(p->in_current->last)
+			return 0;
+		if(!ring_push(p, &p->in_free, p->in_current))
+			return 0;
+		p->in_current = NULL;
+	}
+
+	pipeline_chunk* chunk = ring_pop(p, &p->in_full);
+	if(!chunk)
+		return 0;
+	p->in_current = chunk;
+	*data = chunk->data;
+	return chunk->len;
+}
+
+// Queue the chunk being filled, an empty one is taken if there is none so that
+// the flags get through
+static bool push_output(pipeline* p, bool member_end, bool last) {
+	pipeline_chunk* chunk = p->out_current;
+	if(!chunk) {
+		if(!(chunk = ring_pop(p, &p->out_free)))
+			return false;
+		chunk->len = 0;
+	}
+	chunk->member_end = member_end;
+	chunk->last = last;
+	p->out_current = NULL;
+	return ring_push(p, &p->to_check, chunk);
+}
+
+bool pipeline_write(void* opaque, const unsigned char* data, size_t len) {
+	pipeline* p = opaque;
+	while(len) {
+		if(!p->out_current) {
+			if(!(p->out_current = ring_pop(p, &p->out_free)))
+				return false;
+			p->out_current->len = 0;
+		}
+
+		pipeline_chunk* chunk = p->out_current;
+		size_t n = PIPELINE_CHUNK_SIZE - chunk->len < len ? PIPELINE_CHUNK_SIZE - chunk->len : len;
+		memcpy(chunk->data + chunk->len, data, n);
+		chunk->len += n;
+		data += n;
+		len -= n;
+
+		if(chunk->len == PIPELINE_CHUNK_SIZE && !push_output(p, false, false))
+			return false;
+	}
+	return true;
+}
+
+bool pipeline_member_check(pipeline* p, unsigned long* check) {
+	if(!push_output(p, true, false))
+		return false;
+
+	++p->numof_members;
+	unsigned spins = 0;
+	while(atomic_load_explicit(&p->numof_checked_members, memory_order_acquire) !=
+		p->numof_members) {
+		if(!wait_turn(p, &spins))
+			return false;
+	}
+	*check = p->member_check;
+	return true;
+}
+
+bool pipeline_finish(pipeline* p) {
+	// Let the check and write stages drain everything queued so far
+	bool success = push_output(p, false, true);
+	pthread_join(p->threads[1], NULL);
+	pthread_join(p->threads[2], NULL);
+
+	// The reader may still be prefetching input nobody needs
+	atomic_store(&p->abort, true);
+	pthread_join(p->threads[0], NULL);
+
+	free_chunks(p);
+	return success && !p->read_failed && !p->write_failed;
+}
+
+size_t pipeline_footprint(unsigned depth) {
+	return 2 * (size_t)depth * PIPELINE_CHUNK_SIZE;
+}
@@ -0,0 +1,104 @@
+#ifndef LZIP_PIPELINE_H
+#define LZIP_PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Decompression split into four threads: a reader prefetching compressed input,
+// the decoder (the caller), a thread computing the check value and a writer. The
+// stages hand chunks to each other through single-producer single-consumer rings
+// and the chunks travel back to their producer through rings of free ones. The
+// reader and writer may queue their requests with io_uring, keeping up to one
+// request per chunk in flight.
+
+enum {
+	PIPELINE_CHUNK_SIZE = 1 << 17,
+	// Upper bound of the queue depth
+	PIPELINE_RING_SIZE = 32,
+	PIPELINE_DEFAULT_DEPTH = 8
+};
+
+typedef struct {
+	unsigned char* data;
+	size_t len;
+	// The check value covers everything up to the end of this chunk
+	bool member_end;
+	// No more chunks follow
+	bool last;
+
+	// Outstanding io_uring request
+	bool completed;
+	int result;
+	unsigned long long offset;
+	size_t written;
+} pipeline_chunk;
+
+// Capacity is a power of two so that the free running indices may wrap around
+typedef struct {
+	pipeline_chunk* slots[PIPELINE_RING_SIZE];
+	// Only advanced by the consumer
+	atomic_uint head;
+	// Only advanced by the producer
+	atomic_uint tail;
+} spsc_ring;
+
+typedef unsigned long (*pipeline_check_fn)(
+	unsigned long check, const unsigned char* data, size_t len);
+
+typedef struct {
+	int in_fd;
+	// Set by the decoder before the first output, negative to discard the output
+	int out_fd;
+	pipeline_check_fn check_fn;
+	unsigned long initial_check;
+	// Chunks per direction
+	unsigned depth;
+	// Falls back to read() and write() where io_uring can't be set up
+	bool use_uring;
+
+	pipeline_chunk in_chunks[PIPELINE_RING_SIZE];
+	pipeline_chunk out_chunks[PIPELINE_RING_SIZE];
+	// reader -> decoder -> reader
+	spsc_ring in_full;
+	spsc_ring in_free;
+	// decoder -> check -> writer -> decoder
+	spsc_ring to_check;
+	spsc_ring to_write;
+	spsc_ring out_free;
+
+	// Input chunk the decoder is reading from and output chunk it is filling
+	pipeline_chunk* in_current;
+	pipeline_chunk* out_current;
+
+	// Check values of finished members, published by the check thread
+	unsigned long member_check;
+	atomic_uint numof_checked_members;
+	unsigned numof_members;
+
+	// Set on any error so that every stage stops waiting
+	atomic_bool abort;
+	bool read_failed;
+	bool write_failed;
+
+	// Reader, check and writer threads in this order
+	pthread_t threads[3];
+	unsigned numof_threads;
+} pipeline;
+
+bool pipeline_start(pipeline* p, int in_fd, pipeline_check_fn check_fn, unsigned long initial_check,
+	unsigned depth, bool use_uring);
+// Wait for the writer and release everything, false if any stage failed
+bool pipeline_finish(pipeline* p);
+// Bytes of chunk buffers a pipeline of the given depth allocates
+size_t pipeline_footprint(unsigned depth);
+
+// bit_stream_reader handing out the prefetched input
+size_t pipeline_read(void* opaque, const unsigned char** data);
+// inflate_sink queuing the decompressed data for checking and writing
+bool pipeline_write(void* opaque, const unsigned char* data, size_t len);
+// Wait for the check value of everything written since the last member ended
+bool pipeline_member_check(pipeline* p, unsigned long* check);
+
+#endif
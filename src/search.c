@@ -0,0 +1,167 @@
+// memmem and memrchr are GNU extensions
+#define _GNU_SOURCE
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool search_patterns_add(search_patterns* patterns, const char* pattern) {
+	if(strchr(pattern, '\n')) {
+		fprintf(stderr, "Patterns can't contain a newline.\n");
+		return false;
+	}
+
+	unsigned n = patterns->numof_patterns;
+	char** strings = realloc(patterns->patterns, (n + 1) * sizeof(char*));
+	if(strings)
+		patterns->patterns = strings;
+	size_t* lengths = realloc(patterns->lengths, (n + 1) * sizeof(size_t));
+	if(lengths)
+		patterns->lengths = lengths;
+	if(!strings || !lengths || !(patterns->patterns[n] = strdup(pattern))) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	patterns->lengths[n] = strlen(pattern);
+	patterns->numof_patterns = n + 1;
+	return true;
+}
+
+void search_patterns_free(search_patterns* patterns) {
+	for(unsigned i = 0; i < patterns->numof_patterns; ++i)
+		free(patterns->patterns[i]);
+	free(patterns->patterns);
+	free(patterns->lengths);
+	patterns->patterns = NULL;
+	patterns->lengths = NULL;
+	patterns->numof_patterns = 0;
+}
+
+bool search_init(searcher* search, search_patterns* patterns, const char* path) {
+	memset(search, '\0', sizeof(searcher));
+	search->patterns = patterns;
+	search->path = path;
+	search->next_match = malloc((patterns->numof_patterns + 1) * sizeof(unsigned char*));
+	if(!search->next_match) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	return true;
+}
+
+void search_end(searcher* search) {
+	free(search->line);
+	free(search->next_match);
+	memset(search, '\0', sizeof(searcher));
+}
+
+// Lines of files searched on other threads may come in between, but not within
+static void print_line(
+	searcher* search, unsigned long long offset, const unsigned char* line, size_t len) {
+	flockfile(stdout);
+	printf("%s:%llu:", search->path, offset);
+	fwrite(line, 1, len, stdout);
+	putchar_unlocked('\n');
+	funlockfile(stdout);
+	atomic_fetch_add(&search->patterns->numof_matches, 1);
+}
+
+static bool line_matches(const searcher* search, const unsigned char* line, size_t len) {
+	const search_patterns* patterns = search->patterns;
+	for(unsigned i = 0; i < patterns->numof_patterns; ++i) {
+		if(memmem(line, len, patterns->patterns[i], patterns->lengths[i]))
+			return true;
+	}
+	return false;
+}
+
+// Print every line of a block of complete lines that contains a match. Rather
+// than going line by line, each pattern is looked for in the whole block with the
+// vectorized memmem and only the lines around the earliest matches are picked out.
+static void scan_block(searcher* search, const unsigned char* start, const unsigned char* end,
+	unsigned long long offset) {
+	const search_patterns* patterns = search->patterns;
+	const unsigned char** next_match = search->next_match;
+	for(unsigned i = 0; i < patterns->numof_patterns; ++i)
+		next_match[i] = memmem(start, end - start, patterns->patterns[i], patterns->lengths[i]);
+
+	const unsigned char* p = start;
+	while(p < end) {
+		// Matches on lines that were already printed are stale
+		const unsigned char* first = NULL;
+		for(unsigned i = 0; i < patterns->numof_patterns; ++i) {
+			if(next_match[i] && next_match[i] < p)
+				next_match[i] = memmem(p, end - p, patterns->patterns[i], patterns->lengths[i]);
+			if(next_match[i] && (!first || next_match[i] < first))
+				first = next_match[i];
+		}
+		if(!first)
+			break;
+
+		// The block ends with a newline, so every match is followed by one
+		const unsigned char* line = memrchr(p, '\n', first - p);
+		line = line ? line + 1 : p;
+		const unsigned char* line_end = memchr(first, '\n', end - first);
+		print_line(search, offset + (line - start), line, line_end - line);
+		p = line_end + 1;
+	}
+}
+
+// Keep the start of a line whose end is still to come
+static bool append_line(searcher* search, const unsigned char* data, size_t len) {
+	if(search->line_len + len > search->line_capacity) {
+		size_t capacity = search->line_capacity ? search->line_capacity : 4096;
+		while(capacity < search->line_len + len)
+			capacity *= 2;
+		unsigned char* line = realloc(search->line, capacity);
+		if(!line) {
+			fprintf(stderr, "Out of memory.\n");
+			return false;
+		}
+		search->line = line;
+		search->line_capacity = capacity;
+	}
+	memcpy(search->line + search->line_len, data, len);
+	search->line_len += len;
+	return true;
+}
+
+bool search_write(void* opaque, const unsigned char* data, size_t len) {
+	searcher* search = opaque;
+	const unsigned char* p = data;
+	const unsigned char* end = data + len;
+
+	// The line left over from the previous piece is completed first
+	if(search->line_len) {
+		const unsigned char* newline = memchr(p, '\n', len);
+		if(!append_line(search, p, newline ? (size_t)(newline - p) : len))
+			return false;
+		if(!newline) {
+			search->offset += len;
+			return true;
+		}
+		if(line_matches(search, search->line, search->line_len))
+			print_line(search, search->line_offset, search->line, search->line_len);
+		search->line_len = 0;
+		p = newline + 1;
+	}
+
+	const unsigned char* last_newline = p < end ? memrchr(p, '\n', end - p) : NULL;
+	const unsigned char* block_end = last_newline ? last_newline + 1 : p;
+	scan_block(search, p, block_end, search->offset + (p - data));
+
+	if(block_end < end) {
+		search->line_offset = search->offset + (block_end - data);
+		if(!append_line(search, block_end, end - block_end))
+			return false;
+	}
+	search->offset += len;
+	return true;
+}
+
+void search_finish(searcher* search) {
+	if(search->line_len && line_matches(search, search->line, search->line_len))
+		print_line(search, search->line_offset, search->line, search->line_len);
+	search->line_len = 0;
+}
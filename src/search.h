@@ -0,0 +1,49 @@
+#ifndef LZIP_SEARCH_H
+#define LZIP_SEARCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Literal patterns shared by every file of a search, a line matches if it
+// contains any of them
+typedef struct {
+	char** patterns;
+	size_t* lengths;
+	unsigned numof_patterns;
+	// Matching lines printed so far, over all files
+	atomic_ullong numof_matches;
+} search_patterns;
+
+// Finds matching lines in decompressed data as the decoder produces it and
+// prints them as "path:offset:line", offset being that of the line's start in
+// the decompressed data. Nothing else of the output is kept, apart from a line
+// that is still incomplete at the end of a piece.
+typedef struct {
+	search_patterns* patterns;
+	const char* path;
+	// Position of the next piece in the decompressed data
+	unsigned long long offset;
+
+	// Start of the current incomplete line
+	unsigned char* line;
+	size_t line_len;
+	size_t line_capacity;
+	unsigned long long line_offset;
+
+	// Next match of every pattern within the piece being scanned, NULL if none
+	const unsigned char** next_match;
+} searcher;
+
+// Patterns can't contain a newline as lines are matched one by one
+bool search_patterns_add(search_patterns* patterns, const char* pattern);
+void search_patterns_free(search_patterns* patterns);
+
+bool search_init(searcher* search, search_patterns* patterns, const char* path);
+// inflate_sink taking the next piece of decompressed data
+bool search_write(void* opaque, const unsigned char* data, size_t len);
+// The data may end without a newline
+void search_finish(searcher* search);
+void search_end(searcher* search);
+
+#endif
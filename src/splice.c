@@ -0,0 +1,172 @@
+// vmsplice is a GNU extension
+#define _GNU_SOURCE
+#include "splice.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Output of a window that goes through the pipe, the first 32K are history
+#define SLOT_OUTPUT (INFLATE_WINDOW_SIZE - MAX_DISTANCE)
+
+static bool write_data(int fd, const unsigned char* data, size_t len) {
+	while(len) {
+		ssize_t written = write(fd, data, len);
+		if(written < 0 && errno == EINTR)
+			continue;
+		if(written < 0) {
+			perror("Error writing output");
+			return false;
+		}
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+// Size of the pipe fd refers to, 0 if it isn't one
+static size_t pipe_size_of(int fd) {
+	struct stat st;
+	if(fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode))
+		return 0;
+	int size = fcntl(fd, F_GETPIPE_SZ);
+	return size > 0 ? size : 0;
+}
+
+static size_t slot_size(void) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (INFLATE_WINDOW_SIZE + MATCH_COPY_SLACK + page - 1) / page * page;
+}
+
+// Windows whose data may still be referenced by this pipe and the next one, the
+// window being filled and the one its history comes from
+static unsigned numof_slots(size_t pipe_size) {
+	return 2 + (2 * pipe_size + SLOT_OUTPUT - 1) / SLOT_OUTPUT;
+}
+
+size_t splice_footprint(int fd) {
+	size_t pipe_size = pipe_size_of(fd);
+	return pipe_size ? (numof_slots(pipe_size) + 1) * slot_size() : 0;
+}
+
+bool splice_writer_open(splice_writer* writer, int fd) {
+	memset(writer, '\0', sizeof(splice_writer));
+	writer->fd = fd;
+	if(!(writer->pipe_size = pipe_size_of(fd)))
+		return false;
+
+	writer->numof_slots = numof_slots(writer->pipe_size);
+	writer->slot_size = slot_size();
+	writer->slots = calloc(writer->numof_slots, sizeof(splice_slot));
+	if(!writer->slots)
+		return false;
+	// The spare window behind the ring is never spliced
+	unsigned char* ring = mmap(NULL, (writer->numof_slots + 1) * writer->slot_size,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ring == MAP_FAILED) {
+		free(writer->slots);
+		writer->slots = NULL;
+		return false;
+	}
+	for(unsigned i = 0; i < writer->numof_slots; ++i)
+		writer->slots[i].data = ring + i * writer->slot_size;
+	writer->spare = ring + writer->numof_slots * writer->slot_size;
+	return true;
+}
+
+void splice_writer_close(splice_writer* writer) {
+	// Pages still in the pipe stay with it
+	if(writer->slots)
+		munmap(writer->slots[0].data, (writer->numof_slots + 1) * writer->slot_size);
+	free(writer->slots);
+	writer->slots = NULL;
+}
+
+bool splice_write(splice_writer* writer, const unsigned char* data, size_t len) {
+	if(writer->use_write || !writer->slots)
+		return write_data(writer->fd, data, len);
+
+	for(unsigned i = 0; i < writer->numof_slots; ++i) {
+		splice_slot* slot = &writer->slots[i];
+		if(data >= slot->data && data < slot->data + writer->slot_size)
+			slot->end = writer->total + len;
+	}
+	while(len) {
+		struct iovec iov = {(void*)data, len};
+		ssize_t spliced = vmsplice(writer->fd, &iov, 1, SPLICE_F_GIFT);
+		if(spliced < 0 && errno == EINTR)
+			continue;
+		if(spliced < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			writer->use_write = true;
+			return write_data(writer->fd, data, len);
+		}
+		if(spliced < 0) {
+			perror("Error writing output");
+			return false;
+		}
+		data += spliced;
+		len -= spliced;
+		writer->total += spliced;
+	}
+	return true;
+}
+
+// Give up on the ring: the pages spliced so far are left alone for good and the
+// rest is written from the spare window
+static unsigned char* stop_splicing(splice_writer* writer) {
+	writer->use_write = true;
+	return writer->spare;
+}
+
+// Wait until the reader is done with the pages of the next slot. There is no
+// way to sleep on the pipe draining to a certain point, so the count is polled.
+static unsigned char* next_window(void* opaque) {
+	splice_writer* writer = opaque;
+	if(writer->use_write)
+		return writer->spare;
+
+	// Nothing was ever spliced from a slot with end 0. Otherwise another pipe's
+	// worth has to follow its data out of the pipe, which can't happen before
+	// that much was spliced after it, as with small members taking a slot each.
+	splice_slot* slot = &writer->slots[writer->next];
+	unsigned long long consumed = slot->end + writer->pipe_size;
+	if(slot->end && consumed > writer->total)
+		return stop_splicing(writer);
+	while(slot->end) {
+		int unread;
+		if(ioctl(writer->fd, FIONREAD, &unread) < 0)
+			return stop_splicing(writer);
+		if(writer->total - unread >= consumed)
+			break;
+		// Without a reader the count stays where it is, and the next write fails
+		struct pollfd p = {writer->fd, 0, 0};
+		if(poll(&p, 1, 0) > 0 && (p.revents & POLLERR))
+			return stop_splicing(writer);
+		struct timespec pause = {0, 50000};
+		nanosleep(&pause, NULL);
+	}
+	writer->next = (writer->next + 1) % writer->numof_slots;
+	return slot->data;
+}
+
+void splice_attach(splice_writer* writer, inflate_state* state) {
+	if(!writer->slots)
+		return;
+	state->next_window = next_window;
+	state->window_opaque = writer;
+}
+
+void splice_detach(inflate_state* state) {
+	state->next_window = NULL;
+	state->window_opaque = NULL;
+	state->window = state->own_window;
+}
@@ -0,0 +1,57 @@
+#ifndef LZIP_SPLICE_H
+#define LZIP_SPLICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "inflate.h"
+
+// Output to a pipe without copying it into the pipe. The decoder's window moves
+// through a ring of page-aligned slots, and whatever is flushed from it is
+// vmsplice()d: the pipe takes references to the pages instead of a copy of the
+// data. SPLICE_F_GIFT promises the kernel that the pages won't change while
+// they're in the pipe. A reader that splice()s the data on to another pipe (pv
+// does) takes the pages along, so a slot is only handed out again once the
+// reader has consumed everything spliced from it and another pipe's worth on
+// top, which FIONREAD tells. The next pipe is taken to be no larger than this
+// one.
+//
+// Where that can't be shown, because not enough output follows a slot (many
+// small members take a slot each) or the count isn't available, the rest of the
+// output is written with write() from a window that was never spliced. Anything
+// else than a pipe, or a kernel without vmsplice(), gets write() as well.
+
+typedef struct {
+	unsigned char* data;
+	// Bytes spliced in total once everything from this slot is in the pipe
+	unsigned long long end;
+} splice_slot;
+
+typedef struct {
+	int fd;
+	// Everything from now on is written from the spare window
+	bool use_write;
+	unsigned long long total;
+	size_t pipe_size;
+	splice_slot* slots;
+	unsigned numof_slots;
+	unsigned next;
+	size_t slot_size;
+	unsigned char* spare;
+} splice_writer;
+
+// Memory a writer for fd takes, 0 if it wouldn't splice
+size_t splice_footprint(int fd);
+
+// False if fd isn't a pipe or the ring couldn't be allocated, write() it is then
+bool splice_writer_open(splice_writer* writer, int fd);
+void splice_writer_close(splice_writer* writer);
+
+bool splice_write(splice_writer* writer, const unsigned char* data, size_t len);
+
+// Let the decoder's window move through the ring until it is detached. The
+// state's own window is used again from its next inflate_reset() on.
+void splice_attach(splice_writer* writer, inflate_state* state);
+void splice_detach(inflate_state* state);
+
+#endif
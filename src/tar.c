@@ -0,0 +1,349 @@
+// fallocate is Linux specific
+#define _GNU_SOURCE
+#include "tar.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paths.h"
+
+// Extended headers larger than this are assumed to be garbage
+enum { MAX_META_SIZE = 1 << 20 };
+
+// ustar header layout (POSIX.1-1988)
+enum {
+	NAME_OFFSET = 0,
+	NAME_SIZE = 100,
+	MODE_OFFSET = 100,
+	SIZE_OFFSET = 124,
+	MTIME_OFFSET = 136,
+	CHECKSUM_OFFSET = 148,
+	TYPE_OFFSET = 156,
+	LINK_OFFSET = 157,
+	MAGIC_OFFSET = 257,
+	PREFIX_OFFSET = 345,
+	PREFIX_SIZE = 155
+};
+
+void tar_init(tar_extractor* tar, bool test, bool preallocate) {
+	memset(tar, '\0', sizeof(tar_extractor));
+	tar->test = test;
+	tar->preallocate = preallocate;
+	tar->fd = -1;
+}
+
+void tar_end(tar_extractor* tar) {
+	if(tar->fd >= 0)
+		close(tar->fd);
+	free(tar->path);
+	free(tar->meta);
+	free(tar->next_path);
+	free(tar->next_link);
+	memset(tar, '\0', sizeof(tar_extractor));
+	tar->fd = -1;
+}
+
+// Octal, or base-256 with the high bit set for values that don't fit (GNU)
+static bool parse_number(const unsigned char* field, size_t len, unsigned long long* value) {
+	*value = 0;
+	if(field[0] & 0x80) {
+		for(size_t i = 0; i < len; ++i) {
+			if(*value >> 56)
+				return false;
+			*value = (*value << 8) | (i ? field[i] : field[0] & 0x7f);
+		}
+		return true;
+	}
+
+	size_t i = 0;
+	while(i < len && field[i] == ' ')
+		++i;
+	for(; i < len && field[i] >= '0' && field[i] <= '7'; ++i)
+		*value = *value * 8 + (field[i] - '0');
+	// A full field needs no terminator
+	return i == len || field[i] == ' ' || field[i] == '\0';
+}
+
+static char* field_string(const unsigned char* field, size_t len) {
+	return strndup((const char*)field, len);
+}
+
+// Records look like "<length> <key>=<value>\n" with length counting the whole record
+static bool parse_pax(tar_extractor* tar) {
+	const char* p = (const char*)tar->meta;
+	const char* end = p + tar->meta_len;
+	while(p < end) {
+		char* after;
+		unsigned long len = strtoul(p, &after, 10);
+		if(after == p || *after != ' ' || len > (unsigned long)(end - p) || p + len <= after + 1 ||
+			p[len - 1] != '\n')
+			goto corrupt;
+
+		const char* key = after + 1;
+		const char* record_end = p + len - 1;
+		const char* equals = memchr(key, '=', record_end - key);
+		if(!equals)
+			goto corrupt;
+		size_t key_len = equals - key;
+		const char* value = equals + 1;
+		size_t value_len = record_end - value;
+
+		if(key_len == 4 && !memcmp(key, "path", 4)) {
+			free(tar->next_path);
+			tar->next_path = strndup(value, value_len);
+		} else if(key_len == 8 && !memcmp(key, "linkpath", 8)) {
+			free(tar->next_link);
+			tar->next_link = strndup(value, value_len);
+		} else if(key_len == 4 && !memcmp(key, "size", 4)) {
+			tar->next_size = strtoull(value, NULL, 10);
+			tar->has_next_size = true;
+		} else if(key_len == 5 && !memcmp(key, "mtime", 5)) {
+			// Fractions of a second are dropped
+			tar->next_mtime = strtoll(value, NULL, 10);
+			tar->has_next_mtime = true;
+		}
+		p += len;
+	}
+	return true;
+
+corrupt:
+	fprintf(stderr, "Corrupt pax extended header.\n");
+	return false;
+}
+
+// Done with the data of the current entry
+static bool finish_entry(tar_extractor* tar) {
+	bool success = true;
+	if(tar->kind == TAR_FILE) {
+		struct timespec times[2] = {{tar->mtime, 0}, {tar->mtime, 0}};
+		if(futimens(tar->fd, times) < 0)
+			perror("Could not set mtime");
+		if(close(tar->fd) < 0) {
+			perror("Could not close output file");
+			tar->failed = true;
+		}
+		tar->fd = -1;
+	} else if(tar->kind == TAR_PAX) {
+		tar->meta[tar->meta_len] = '\0';
+		success = parse_pax(tar);
+	} else if(tar->kind == TAR_LONG_NAME || tar->kind == TAR_LONG_LINK) {
+		// GNU long names carry their own terminator, but don't rely on it
+		tar->meta[tar->meta_len] = '\0';
+		char** target = (tar->kind == TAR_LONG_NAME) ? &tar->next_path : &tar->next_link;
+		free(*target);
+		*target = strdup((const char*)tar->meta);
+	}
+	tar->kind = TAR_SKIP;
+	return success;
+}
+
+// Create whatever the header describes, data of files follows. Entries that can't
+// be created are skipped and reported at the end.
+static void create_entry(tar_extractor* tar, char type, const char* target, unsigned mode) {
+	const char* path = tar->path;
+	if(!is_safe_path(path)) {
+		fprintf(stderr, "Refusing to extract '%s' outside the current directory.\n", path);
+		tar->failed = true;
+		return;
+	}
+	if(tar->test)
+		return;
+
+	if(type != '5' && !make_parents(path)) {
+		tar->failed = true;
+		return;
+	}
+
+	switch(type) {
+	case '0':
+	case '\0':
+	case '7':
+		tar->fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode & 0777);
+		if(tar->fd < 0) {
+			perror("Target already exists");
+			tar->failed = true;
+			return;
+		}
+		// Not every file system can, writing works regardless
+		if(tar->preallocate && tar->remaining)
+			fallocate(tar->fd, 0, 0, tar->remaining);
+		tar->kind = TAR_FILE;
+		return;
+
+	case '5':
+		if(!make_parents(path) || (mkdir(path, (mode & 0777) | 0700) < 0 && errno != EEXIST)) {
+			perror("Could not create directory");
+			tar->failed = true;
+		}
+		return;
+
+	case '1':
+	case '2':
+		// Links must not lead out of the current directory either
+		if(!is_safe_path(target)) {
+			fprintf(stderr, "Refusing to link '%s' to '%s'.\n", path, target);
+			tar->failed = true;
+		} else if((type == '1' ? link(target, path) : symlink(target, path)) < 0) {
+			perror("Could not create link");
+			tar->failed = true;
+		}
+		return;
+
+	default:
+		fprintf(stderr, "Skipping '%s' of unsupported type '%c'.\n", path, type);
+	}
+}
+
+static bool start_entry(tar_extractor* tar) {
+	const unsigned char* header = tar->header;
+	size_t i = 0;
+	while(i < TAR_BLOCK_SIZE && !header[i])
+		++i;
+	if(i == TAR_BLOCK_SIZE) {
+		// Two zero blocks end the archive
+		if(++tar->numof_zero_blocks == 2)
+			tar->finished = true;
+		return true;
+	}
+	tar->numof_zero_blocks = 0;
+
+	// The checksum is computed with its own field set to spaces
+	unsigned long long checksum, size, mtime, mode;
+	unsigned long sum = 0;
+	for(i = 0; i < TAR_BLOCK_SIZE; ++i)
+		sum += (i >= CHECKSUM_OFFSET && i < CHECKSUM_OFFSET + 8) ? ' ' : header[i];
+	if(!parse_number(header + CHECKSUM_OFFSET, 8, &checksum) || checksum != sum ||
+		!parse_number(header + SIZE_OFFSET, 12, &size) ||
+		!parse_number(header + MTIME_OFFSET, 12, &mtime) ||
+		!parse_number(header + MODE_OFFSET, 8, &mode)) {
+		fprintf(stderr, "Corrupt tar header.\n");
+		return false;
+	}
+
+	char type = header[TYPE_OFFSET];
+	bool meta = type == 'x' || type == 'L' || type == 'K';
+	if(!meta && tar->has_next_size)
+		size = tar->next_size;
+	if(!meta && tar->has_next_mtime)
+		mtime = tar->next_mtime;
+
+	tar->remaining = size;
+	tar->padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+	tar->kind = TAR_SKIP;
+
+	// Metadata for the next entry is collected in memory
+	if(meta) {
+		if(size > MAX_META_SIZE) {
+			fprintf(stderr, "Extended tar header too large.\n");
+			return false;
+		}
+		free(tar->meta);
+		tar->meta_len = 0;
+		if(!(tar->meta = malloc(size + 1))) {
+			fprintf(stderr, "Out of memory.\n");
+			return false;
+		}
+		tar->kind = (type == 'x') ? TAR_PAX : (type == 'L') ? TAR_LONG_NAME : TAR_LONG_LINK;
+		return size || finish_entry(tar);
+	}
+	// Global pax headers hold nothing we use
+	if(type == 'g')
+		return true;
+
+	free(tar->path);
+	if(tar->next_path) {
+		tar->path = tar->next_path;
+		tar->next_path = NULL;
+	} else if(!memcmp(header + MAGIC_OFFSET, "ustar", 5) && header[PREFIX_OFFSET]) {
+		char* prefix = field_string(header + PREFIX_OFFSET, PREFIX_SIZE);
+		char* name = field_string(header + NAME_OFFSET, NAME_SIZE);
+		tar->path = (prefix && name) ? malloc(strlen(prefix) + strlen(name) + 2) : NULL;
+		if(tar->path)
+			sprintf(tar->path, "%s/%s", prefix, name);
+		free(prefix);
+		free(name);
+	} else
+		tar->path = field_string(header + NAME_OFFSET, NAME_SIZE);
+
+	char* target = tar->next_link ? tar->next_link : field_string(header + LINK_OFFSET, NAME_SIZE);
+	tar->next_link = NULL;
+	tar->has_next_size = false;
+	tar->has_next_mtime = false;
+	if(!tar->path || !target) {
+		free(target);
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+
+	tar->mtime = mtime;
+	create_entry(tar, type, target, mode);
+	free(target);
+	return tar->remaining || finish_entry(tar);
+}
+
+// Hand data of the current entry to its file or metadata buffer
+static void consume_data(tar_extractor* tar, const unsigned char* data, size_t len) {
+	if(tar->kind == TAR_FILE) {
+		while(len) {
+			ssize_t written = write(tar->fd, data, len);
+			if(written < 0) {
+				perror("Error writing output");
+				close(tar->fd);
+				tar->fd = -1;
+				tar->kind = TAR_SKIP;
+				tar->failed = true;
+				return;
+			}
+			data += written;
+			len -= written;
+		}
+	} else if(tar->kind != TAR_SKIP) {
+		memcpy(tar->meta + tar->meta_len, data, len);
+		tar->meta_len += len;
+	}
+}
+
+bool tar_write(void* opaque, const unsigned char* data, size_t len) {
+	tar_extractor* tar = opaque;
+	// Everything after the end blocks is padding up to the record size
+	while(len && !tar->finished) {
+		size_t n;
+		if(tar->remaining) {
+			// File data goes straight from the decoder's window to the file
+			n = tar->remaining < len ? tar->remaining : len;
+			consume_data(tar, data, n);
+			tar->remaining -= n;
+			if(!tar->remaining && !finish_entry(tar))
+				return false;
+		} else if(tar->padding) {
+			n = tar->padding < len ? tar->padding : len;
+			tar->padding -= n;
+		} else {
+			n = TAR_BLOCK_SIZE - tar->header_len < len ? TAR_BLOCK_SIZE - tar->header_len : len;
+			memcpy(tar->header + tar->header_len, data, n);
+			tar->header_len += n;
+			if(tar->header_len == TAR_BLOCK_SIZE) {
+				tar->header_len = 0;
+				if(!start_entry(tar))
+					return false;
+			}
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool tar_finish(tar_extractor* tar) {
+	// Some writers leave out the end blocks, which is fine on an entry boundary
+	if(!tar->finished && (tar->remaining || tar->padding || tar->header_len)) {
+		fprintf(stderr, "Unexpected end of tar archive.\n");
+		return false;
+	}
+	return !tar->failed;
+}
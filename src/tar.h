@@ -0,0 +1,61 @@
+#ifndef LZIP_TAR_H
+#define LZIP_TAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+enum { TAR_BLOCK_SIZE = 512 };
+
+typedef enum {
+	// Data is dropped, like the contents of unsupported entry types
+	TAR_SKIP,
+	TAR_FILE,
+	// Metadata applying to the next entry
+	TAR_PAX,
+	TAR_LONG_NAME,
+	TAR_LONG_LINK
+} tar_data_kind;
+
+// Extracts a ustar/pax (and GNU long name) archive into the current directory as
+// it streams past, so the tarball itself never touches the disk
+typedef struct {
+	// Only parse the archive, nothing is created
+	bool test;
+	// Reserve the size of every file with fallocate before writing it
+	bool preallocate;
+
+	unsigned char header[TAR_BLOCK_SIZE];
+	size_t header_len;
+	unsigned numof_zero_blocks;
+	bool finished;
+	// Some entry couldn't be extracted, the rest of the archive still is
+	bool failed;
+
+	// Data of the current entry still to come and the padding to the next block
+	tar_data_kind kind;
+	unsigned long long remaining;
+	size_t padding;
+	int fd;
+	char* path;
+	time_t mtime;
+	unsigned char* meta;
+	size_t meta_len;
+
+	// Overrides for the next entry from pax or GNU headers
+	char* next_path;
+	char* next_link;
+	bool has_next_size;
+	unsigned long long next_size;
+	bool has_next_mtime;
+	time_t next_mtime;
+} tar_extractor;
+
+void tar_init(tar_extractor* tar, bool test, bool preallocate);
+// inflate_sink taking the next piece of the archive
+bool tar_write(void* opaque, const unsigned char* data, size_t len);
+// The archive must have ended on an entry boundary
+bool tar_finish(tar_extractor* tar);
+void tar_end(tar_extractor* tar);
+
+#endif
@@ -0,0 +1,187 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+bool uring_init(uring* ring, unsigned entries) {
+	struct io_uring_params params;
+	memset(ring, '\0', sizeof(uring));
+	memset(&params, '\0', sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0)
+		return false;
+	// Callers count on queueing that many requests between submits
+	if(params.sq_entries < entries) {
+		uring_end(ring);
+		errno = EINVAL;
+		return false;
+	}
+	ring->entries = params.sq_entries;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->fd, IORING_OFF_SQES);
+	if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		uring_end(ring);
+		return false;
+	}
+
+	unsigned char* sq = ring->sq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	unsigned char* cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+void uring_end(uring* ring) {
+	if(ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ring && ring->cq_ring != MAP_FAILED)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if(ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if(ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, '\0', sizeof(uring));
+	ring->fd = -1;
+}
+
+bool uring_register_buffers(uring* ring, const struct iovec* iov, unsigned numof_buffers) {
+	ring->buffers_registered =
+		!syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, numof_buffers);
+	return ring->buffers_registered;
+}
+
+static bool queue(uring* ring, unsigned opcode, unsigned fixed_opcode, int fd, const void* buf,
+	unsigned len, unsigned long long offset, unsigned buffer_index, unsigned long long user_data) {
+	// Only this thread writes the tail, the kernel advances the head
+	unsigned tail = *ring->sq_tail + ring->numof_pending;
+	if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) {
+		errno = EBUSY;
+		return false;
+	}
+
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, '\0', sizeof(*sqe));
+	sqe->opcode = ring->buffers_registered ? fixed_opcode : opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)(size_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	if(ring->buffers_registered)
+		sqe->buf_index = buffer_index;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	++ring->numof_pending;
+	return true;
+}
+
+bool uring_queue_read(uring* ring, int fd, void* buf, unsigned len, unsigned long long offset,
+	unsigned buffer_index, unsigned long long user_data) {
+	return queue(ring, IORING_OP_READ, IORING_OP_READ_FIXED, fd, buf, len, offset, buffer_index,
+		user_data);
+}
+
+bool uring_queue_write(uring* ring, int fd, const void* buf, unsigned len,
+	unsigned long long offset, unsigned buffer_index, unsigned long long user_data) {
+	return queue(ring, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, fd, buf, len, offset, buffer_index,
+		user_data);
+}
+
+bool uring_submit(uring* ring, unsigned numof_completions) {
+	unsigned numof_pending = ring->numof_pending;
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + numof_pending, __ATOMIC_RELEASE);
+	ring->numof_pending = 0;
+
+	while(numof_pending || numof_completions) {
+		long submitted = syscall(__NR_io_uring_enter, ring->fd, numof_pending, numof_completions,
+			numof_completions ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(submitted < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		numof_pending -= submitted;
+		// Completions are counted by the caller reaping them
+		if(!numof_pending)
+			break;
+	}
+	return true;
+}
+
+bool uring_complete(uring* ring, unsigned long long* user_data, int* res) {
+	unsigned head = *ring->cq_head;
+	if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+#else
+
+bool uring_init(uring* ring, unsigned entries) {
+	(void)entries;
+	memset(ring, '\0', sizeof(uring));
+	ring->fd = -1;
+	errno = ENOSYS;
+	return false;
+}
+
+void uring_end(uring* ring) {
+	(void)ring;
+}
+
+bool uring_register_buffers(uring* ring, const struct iovec* iov, unsigned numof_buffers) {
+	(void)ring, (void)iov, (void)numof_buffers;
+	return false;
+}
+
+bool uring_queue_read(uring* ring, int fd, void* buf, unsigned len, unsigned long long offset,
+	unsigned buffer_index, unsigned long long user_data) {
+	(void)ring, (void)fd, (void)buf, (void)len, (void)offset, (void)buffer_index, (void)user_data;
+	return false;
+}
+
+bool uring_queue_write(uring* ring, int fd, const void* buf, unsigned len,
+	unsigned long long offset, unsigned buffer_index, unsigned long long user_data) {
+	(void)ring, (void)fd, (void)buf, (void)len, (void)offset, (void)buffer_index, (void)user_data;
+	return false;
+}
+
+bool uring_submit(uring* ring, unsigned numof_completions) {
+	(void)ring, (void)numof_completions;
+	return false;
+}
+
+bool uring_complete(uring* ring, unsigned long long* user_data, int* res) {
+	(void)ring, (void)user_data, (void)res;
+	return false;
+}
+
+#endif
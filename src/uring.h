@@ -0,0 +1,58 @@
+#ifndef LZIP_URING_H
+#define LZIP_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Just enough io_uring for queued reads and writes, talking to the kernel through
+// the raw system calls so that liburing isn't needed
+typedef struct {
+	int fd;
+	unsigned entries;
+	// Registered buffers may be used with the fixed opcodes
+	bool buffers_registered;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	// Entries prepared but not yet handed to the kernel
+	unsigned numof_pending;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} uring;
+
+// Fails where io_uring is unavailable (old kernels, seccomp) or the submission
+// queue would hold fewer than entries requests, callers fall back to plain read()
+// and write() then
+bool uring_init(uring* ring, unsigned entries);
+void uring_end(uring* ring);
+// Pin buffers once so that the kernel doesn't map them for every request, buffer
+// indices follow the order of iov
+bool uring_register_buffers(uring* ring, const struct iovec* iov, unsigned numof_buffers);
+
+// Queue a read or write at offset, user_data comes back with the completion.
+// buffer_index is used if buffers were registered. Fails with EBUSY if the
+// submission queue is full, that is entries requests are queued that the kernel
+// hasn't taken yet.
+bool uring_queue_read(uring* ring, int fd, void* buf, unsigned len, unsigned long long offset,
+	unsigned buffer_index, unsigned long long user_data);
+bool uring_queue_write(uring* ring, int fd, const void* buf, unsigned len,
+	unsigned long long offset, unsigned buffer_index, unsigned long long user_data);
+// Hand all queued requests to the kernel and wait for at least numof_completions
+bool uring_submit(uring* ring, unsigned numof_completions);
+// Take the next completion if there is one, res is the result of the system call
+bool uring_complete(uring* ring, unsigned long long* user_data, int* res);
+
+#endif
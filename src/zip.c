@@ -0,0 +1,182 @@
+#include "zip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+
+enum {
+	EOCD_SIGNATURE = 0x06054b50,
+	EOCD_SIZE = 22,
+	MAX_COMMENT_SIZE = 65535,
+	ZIP64_LOCATOR_SIGNATURE = 0x07064b50,
+	ZIP64_LOCATOR_SIZE = 20,
+	ZIP64_EOCD_SIGNATURE = 0x06064b50,
+	ZIP64_EOCD_SIZE = 56,
+	CENTRAL_SIGNATURE = 0x02014b50,
+	CENTRAL_SIZE = 46,
+	LOCAL_SIGNATURE = 0x04034b50,
+	LOCAL_SIZE = 30,
+	ZIP64_EXTRA_ID = 1
+};
+// Fields too large for their 32-bit slot are set to this and stored in the ZIP64
+// extra field instead
+#define ZIP64_MARKER 0xffffffffull
+
+// MS-DOS date and time as stored in the headers, in local time
+static time_t dos_time(unsigned date, unsigned time) {
+	struct tm tm;
+	memset(&tm, '\0', sizeof(tm));
+	tm.tm_year = (date >> 9) + 80;
+	tm.tm_mon = ((date >> 5) & 15) - 1;
+	tm.tm_mday = date & 31;
+	tm.tm_hour = time >> 11;
+	tm.tm_min = (time >> 5) & 63;
+	tm.tm_sec = (time & 31) * 2;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+// Replace the fields marked as too large with the values of the ZIP64 extra
+// field, they appear in a fixed order (see 4.5.3)
+static bool read_zip64_extra(zip_entry* entry, const unsigned char* extra, size_t len) {
+	while(len >= 4) {
+		unsigned id = load_le16(extra);
+		size_t size = load_le16(extra + 2);
+		if(size > len - 4)
+			return false;
+
+		if(id == ZIP64_EXTRA_ID) {
+			unsigned long long* fields[] = {&entry->uncompressed_size, &entry->compressed_size,
+				&entry->local_header_offset};
+			const unsigned char* p = extra + 4;
+			for(unsigned i = 0; i < 3; ++i) {
+				if(*fields[i] != ZIP64_MARKER)
+					continue;
+				if(p + 8 > extra + 4 + size)
+					return false;
+				*fields[i] = load_le64(p);
+				p += 8;
+			}
+		}
+		extra += 4 + size;
+		len -= 4 + size;
+	}
+	return true;
+}
+
+bool zip_open(zip_archive* zip, const unsigned char* data, size_t size) {
+	memset(zip, '\0', sizeof(zip_archive));
+	zip->data = data;
+	zip->size = size;
+
+	// The end of central directory record is followed by a comment of up to 64K
+	if(size < EOCD_SIZE) {
+		fprintf(stderr, "Input not in ZIP format.\n");
+		return false;
+	}
+	size_t eocd = size - EOCD_SIZE;
+	size_t lowest = size - EOCD_SIZE > MAX_COMMENT_SIZE ? size - EOCD_SIZE - MAX_COMMENT_SIZE : 0;
+	while(load_le32(data + eocd) != EOCD_SIGNATURE ||
+		eocd + EOCD_SIZE + load_le16(data + eocd + 20) > size) {
+		if(eocd == lowest) {
+			fprintf(stderr, "Input not in ZIP format.\n");
+			return false;
+		}
+		--eocd;
+	}
+
+	unsigned long long numof_entries = load_le16(data + eocd + 10);
+	unsigned long long directory_size = load_le32(data + eocd + 12);
+	unsigned long long directory_offset = load_le32(data + eocd + 16);
+
+	// ZIP64 archives keep the real values in a second record found through a locator
+	if(eocd >= ZIP64_LOCATOR_SIZE &&
+		load_le32(data + eocd - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE) {
+		unsigned long long eocd64 = load_le64(data + eocd - ZIP64_LOCATOR_SIZE + 8);
+		if(size < ZIP64_EOCD_SIZE || eocd64 > size - ZIP64_EOCD_SIZE ||
+			load_le32(data + eocd64) != ZIP64_EOCD_SIGNATURE) {
+			fprintf(stderr, "Corrupt ZIP64 end of central directory record.\n");
+			return false;
+		}
+		numof_entries = load_le64(data + eocd64 + 32);
+		directory_size = load_le64(data + eocd64 + 40);
+		directory_offset = load_le64(data + eocd64 + 48);
+	}
+
+	// Every record takes at least CENTRAL_SIZE bytes, which also bounds the allocation
+	if(directory_offset > size || directory_size > size - directory_offset ||
+		numof_entries > directory_size / CENTRAL_SIZE) {
+		fprintf(stderr, "Corrupt central directory.\n");
+		return false;
+	}
+
+	zip->entries = calloc(numof_entries ? numof_entries : 1, sizeof(zip_entry));
+	if(!zip->entries) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+
+	const unsigned char* p = data + directory_offset;
+	const unsigned char* end = p + directory_size;
+	for(; zip->numof_entries < numof_entries; ++zip->numof_entries) {
+		if(end - p < CENTRAL_SIZE || load_le32(p) != CENTRAL_SIGNATURE)
+			goto corrupt;
+		size_t name_len = load_le16(p + 28);
+		size_t extra_len = load_le16(p + 30);
+		size_t comment_len = load_le16(p + 32);
+		if((size_t)(end - p - CENTRAL_SIZE) < name_len + extra_len + comment_len)
+			goto corrupt;
+
+		zip_entry* entry = &zip->entries[zip->numof_entries];
+		entry->flags = load_le16(p + 8);
+		entry->method = load_le16(p + 10);
+		entry->mtime = dos_time(load_le16(p + 14), load_le16(p + 12));
+		entry->crc32 = load_le32(p + 16);
+		entry->compressed_size = load_le32(p + 20);
+		entry->uncompressed_size = load_le32(p + 24);
+		entry->local_header_offset = load_le32(p + 42);
+		if(!read_zip64_extra(entry, p + CENTRAL_SIZE + name_len, extra_len))
+			goto corrupt;
+
+		entry->name = malloc(name_len + 1);
+		if(!entry->name) {
+			fprintf(stderr, "Out of memory.\n");
+			zip_close(zip);
+			return false;
+		}
+		memcpy(entry->name, p + CENTRAL_SIZE, name_len);
+		entry->name[name_len] = '\0';
+
+		p += CENTRAL_SIZE + name_len + extra_len + comment_len;
+	}
+	return true;
+
+corrupt:
+	fprintf(stderr, "Corrupt central directory.\n");
+	zip_close(zip);
+	return false;
+}
+
+void zip_close(zip_archive* zip) {
+	for(size_t i = 0; i < zip->numof_entries; ++i)
+		free(zip->entries[i].name);
+	free(zip->entries);
+	zip->entries = NULL;
+	zip->numof_entries = 0;
+}
+
+const unsigned char* zip_entry_data(const zip_archive* zip, const zip_entry* entry) {
+	unsigned long long offset = entry->local_header_offset;
+	if(offset > zip->size || zip->size - offset < LOCAL_SIZE ||
+		load_le32(zip->data + offset) != LOCAL_SIGNATURE)
+		return NULL;
+
+	// The name and extra field may differ from the central directory
+	unsigned long long start =
+		offset + LOCAL_SIZE + load_le16(zip->data + offset + 26) + load_le16(zip->data + offset + 28);
+	if(start > zip->size || zip->size - start < entry->compressed_size)
+		return NULL;
+	return zip->data + start;
+}
@@ -0,0 +1,38 @@
+#ifndef LZIP_ZIP_H
+#define LZIP_ZIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+enum { ZIP_STORED = 0, ZIP_DEFLATED = 8, ZIP_ENCRYPTED = 1 };
+
+// One record of the central directory, sizes and offsets are already widened
+// from their ZIP64 extra field where needed
+typedef struct {
+	char* name;
+	unsigned flags;
+	unsigned method;
+	unsigned long crc32;
+	unsigned long long compressed_size;
+	unsigned long long uncompressed_size;
+	unsigned long long local_header_offset;
+	time_t mtime;
+} zip_entry;
+
+// The archive itself stays in the caller's memory, usually a mapping of the file
+typedef struct {
+	const unsigned char* data;
+	size_t size;
+	zip_entry* entries;
+	size_t numof_entries;
+} zip_archive;
+
+// Parse the central directory (APPNOTE 4.3.16 and 4.3.14 for ZIP64)
+bool zip_open(zip_archive* zip, const unsigned char* data, size_t size);
+void zip_close(zip_archive* zip);
+// Start of the entry's compressed data behind its local header, NULL if the local
+// header is broken or the data doesn't fit into the archive
+const unsigned char* zip_entry_data(const zip_archive* zip, const zip_entry* entry);
+
+#endif